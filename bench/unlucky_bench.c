@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Measure what the library adds to reading the clock. Every library given
+ * on the command line is preloaded into child processes (this program run
+ * again), which time the clock functions from 1 up to -t threads, and the
+ * latency of the first clock read with and without UNLUCKY_LAZY. "none" runs
+ * them without preloading, lib:mode sets UNLUCKY_MODE for the library.
+ *
+ * Every result is printed as a line of JSON:
+ *
+ *	{"lib": "...", "mode": "...", "function": "clock_gettime",
+ *	    "threads": 2, "ns_per_call": 20.51}
+ *	{"lib": "...", "mode": "...", "metric": "init_ns", "value": 81203}
+ */
+
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHILD_ENV	"UNLUCKY_BENCH_CHILD"
+#define CALLS_ENV	"UNLUCKY_BENCH_CALLS"
+#define MAX_THREADS	256
+
+enum bench_function {
+	BENCH_CLOCK_GETTIME,
+	BENCH_GETTIMEOFDAY,
+	BENCH_TIME,
+	BENCH_NFUNCTIONS,
+};
+
+static const char *function_names[BENCH_NFUNCTIONS] = {
+	"clock_gettime", "gettimeofday", "time",
+};
+
+struct bench_thread {
+	pthread_t		thread;
+	enum bench_function	function;
+	double			ns_per_call;
+};
+
+static long	calls = 1000000;
+
+static double
+elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/*
+ * Time the calls in thread cpu time, so the result doesn't depend on how
+ * many threads share a core.
+ */
+static void *
+bench_calls(void *arg)
+{
+	struct bench_thread	*bt = arg;
+	struct timespec		 start, end, ts;
+	struct timeval		 tv;
+	long			 i;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	switch (bt->function) {
+	case BENCH_CLOCK_GETTIME:
+		for (i = 0; i < calls; i++)
+			clock_gettime(CLOCK_REALTIME, &ts);
+		break;
+	case BENCH_GETTIMEOFDAY:
+		for (i = 0; i < calls; i++)
+			gettimeofday(&tv, NULL);
+		break;
+	default:
+		for (i = 0; i < calls; i++)
+			time(NULL);
+		break;
+	}
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+	bt->ns_per_call = elapsed(&start, &end) / calls;
+
+	return NULL;
+}
+
+/* Child: "calls <threads>", prints ns/call per function. */
+static void
+child_calls(int nthreads)
+{
+	struct bench_thread	threads[MAX_THREADS];
+	double			total;
+	int			f, i;
+
+	for (f = 0; f < BENCH_NFUNCTIONS; f++) {
+		for (i = 0; i < nthreads; i++) {
+			threads[i].function = f;
+			if (pthread_create(&threads[i].thread, NULL, bench_calls,
+			    &threads[i]) != 0)
+				errx(1, "pthread_create");
+		}
+		total = 0;
+		for (i = 0; i < nthreads; i++) {
+			pthread_join(threads[i].thread, NULL);
+			total += threads[i].ns_per_call;
+		}
+		printf("%.2f\n", total / nthreads);
+	}
+}
+
+/*
+ * Child: "first", prints the latency of the very first clock read. With
+ * UNLUCKY_LAZY set this includes initializing the library.
+ */
+static void
+child_first(void)
+{
+	struct timespec	start, end, ts;
+
+	/* Around the library, which initializes on any clock_gettime(). */
+	syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &start);
+	clock_gettime(CLOCK_REALTIME, &ts);
+	syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &end);
+
+	printf("%.0f\n", elapsed(&start, &end));
+}
+
+/*
+ * Run this program as a child with lib preloaded and the given task, and
+ * read the n numbers it prints. lazy additionally sets UNLUCKY_LAZY and
+ * disables the DST cache, so the init cost is the same in every run.
+ */
+static void
+run_child(const char *lib, const char *mode, const char *task, int lazy,
+    double *results, int n)
+{
+	FILE	*fp;
+	int	 fds[2], status, i;
+	pid_t	 pid;
+
+	if (pipe(fds) == -1)
+		err(1, "pipe");
+
+	switch (pid = fork()) {
+	case -1:
+		err(1, "fork");
+	case 0:
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		setenv(CHILD_ENV, task, 1);
+		if (strcmp(lib, "none") == 0)
+			unsetenv("LD_PRELOAD");
+		else
+			setenv("LD_PRELOAD", lib, 1);
+		if (mode != NULL)
+			setenv("UNLUCKY_MODE", mode, 1);
+		if (lazy) {
+			setenv("UNLUCKY_LAZY", "1", 1);
+			setenv("UNLUCKY_CACHE_DIR", "", 1);
+		}
+		execl("/proc/self/exe", "unlucky_bench", (char *)NULL);
+		err(1, "exec");
+	}
+
+	close(fds[1]);
+	if ((fp = fdopen(fds[0], "r")) == NULL)
+		err(1, "fdopen");
+	for (i = 0; i < n; i++)
+		if (fscanf(fp, "%lf", &results[i]) != 1)
+			errx(1, "%s: benchmark failed", lib);
+	fclose(fp);
+
+	if (waitpid(pid, &status, 0) == -1)
+		err(1, "waitpid");
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		errx(1, "%s: benchmark failed", lib);
+}
+
+static void
+print_json_string(const char *s)
+{
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			putchar('\\');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+static void
+print_head(const char *lib, const char *mode)
+{
+	printf("{\"lib\": ");
+	print_json_string(lib);
+	printf(", \"mode\": ");
+	print_json_string(mode != NULL ? mode : "default");
+}
+
+static void
+bench(const char *arg, int max_threads)
+{
+	char	 lib[1024], *mode, task[32];
+	double	 results[BENCH_NFUNCTIONS];
+	int	 f, nthreads;
+
+	if (snprintf(lib, sizeof(lib), "%s", arg) >= (int)sizeof(lib))
+		errx(1, "%s: too long", arg);
+	if ((mode = strrchr(lib, ':')) != NULL)
+		*mode++ = '\0';
+
+	for (nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+		snprintf(task, sizeof(task), "calls %d", nthreads);
+		run_child(lib, mode, task, 0, results, BENCH_NFUNCTIONS);
+		for (f = 0; f < BENCH_NFUNCTIONS; f++) {
+			print_head(lib, mode);
+			printf(", \"function\": \"%s\", \"threads\": %d, "
+			    "\"ns_per_call\": %.2f}\n", function_names[f],
+			    nthreads, results[f]);
+		}
+		if (nthreads < max_threads && nthreads * 2 > max_threads)
+			nthreads = max_threads / 2;
+	}
+
+	run_child(lib, mode, "first", 0, results, 1);
+	print_head(lib, mode);
+	printf(", \"metric\": \"first_call_ns\", \"value\": %.0f}\n", results[0]);
+
+	run_child(lib, mode, "first", 1, results, 1);
+	print_head(lib, mode);
+	printf(", \"metric\": \"init_ns\", \"value\": %.0f}\n", results[0]);
+
+	fflush(stdout);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: unlucky_bench [-n calls] [-t threads] lib[:mode] ...\n");
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char	*task;
+	long		 max_threads;
+	int		 ch, i;
+
+	if ((task = getenv(CALLS_ENV)) != NULL)
+		calls = strtol(task, NULL, 10);
+
+	if ((task = getenv(CHILD_ENV)) != NULL) {
+		if (strncmp(task, "calls ", 6) == 0) {
+			i = atoi(task + 6);
+			child_calls(i < 1 ? 1 : i > MAX_THREADS ? MAX_THREADS : i);
+		} else
+			child_first();
+		return 0;
+	}
+
+	if ((max_threads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		max_threads = 1;
+	if (max_threads > MAX_THREADS)
+		max_threads = MAX_THREADS;
+
+	while ((ch = getopt(argc, argv, "n:t:")) != -1) {
+		switch (ch) {
+		case 'n':
+			if ((calls = strtol(optarg, NULL, 10)) <= 0)
+				usage();
+			setenv(CALLS_ENV, optarg, 1);
+			break;
+		case 't':
+			max_threads = strtol(optarg, NULL, 10);
+			if (max_threads < 1 || max_threads > MAX_THREADS)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc == 0)
+		usage();
+
+	for (i = 0; i < argc; i++)
+		bench(argv[i], max_threads);
+
+	return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * unlucky_diff() for arrays of times. Every mode but leap_second adds the
+ * same diff to every time, which the compiler turns into vector adds. For
+ * leap_second the times are taken in blocks relative to the start time: a
+ * block in which every delta fits in 32 bits (68 years either way) goes
+ * through a 32 bit copy of unlucky_leap_seconds(), whose divisions by 60 the
+ * compiler replaces by vector multiplications with the reciprocal. Blocks
+ * always have the same length so this happens at -O2 too, which only
+ * vectorizes loops without a scalar remainder. Other blocks fall back to
+ * unlucky_leap_seconds() one time at a time. A dilated state goes through
+ * unlucky_diff() one time at a time as well.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "unlucky_time.h"
+
+#define BLOCK		256
+
+/* Leaves room for the offset and the - 1 in leap_block(). */
+#define DELTA_MAX	(INT32_MAX - 128)
+
+static inline time_t
+leap_diff(const struct unlucky_state *state, time_t t)
+{
+	return state->diff + unlucky_leap_seconds(state->start_time, t);
+}
+
+/*
+ * unlucky_leap_seconds() of a block of deltas, with start_mod being
+ * start_time % 60.
+ */
+static void
+leap_block(const int32_t *delta, int32_t *leap, int32_t start_mod)
+{
+	int32_t	offset;
+	size_t	i;
+
+	for (i = 0; i < BLOCK; i++) {
+		offset = ((delta[i] / 60) % 60 - start_mod) % 60;
+		leap[i] = -((delta[i] - offset - 1) / 60);
+	}
+}
+
+/*
+ * Store the deltas of n times in delta, padded with zeroes up to a block, or
+ * return 0 if one of them doesn't fit.
+ */
+static inline int
+block_deltas(const time_t *t, size_t stride, size_t n, time_t start_time,
+    int32_t *delta)
+{
+	time_t	d, lo = 0, hi = 0;
+	size_t	i;
+
+	for (i = 0; i < n; i++) {
+		d = t[i * stride] - start_time;
+		lo = d < lo ? d : lo;
+		hi = d > hi ? d : hi;
+		delta[i] = d;
+	}
+	for (; i < BLOCK; i++)
+		delta[i] = 0;
+
+	return lo >= -DELTA_MAX && hi <= DELTA_MAX;
+}
+
+/*
+ * Shift n times, stride time_ts apart, which covers both time_t arrays and
+ * the tv_sec of timespec arrays.
+ */
+static inline void
+shift(const struct unlucky_state *state, time_t *t, size_t stride, size_t n)
+{
+	int32_t	delta[BLOCK], leap[BLOCK], start_mod;
+	time_t	diff = state->diff;
+	size_t	i, len;
+
+	if (state->dilation_num != state->dilation_den) {
+		for (i = 0; i < n; i++)
+			t[i * stride] += unlucky_diff(state, t[i * stride]);
+		return;
+	}
+
+	if (state->mode != UNLUCKY_LEAP_SECOND) {
+		for (i = 0; i < n; i++)
+			t[i * stride] += diff;
+		return;
+	}
+
+	start_mod = state->start_time % 60;
+	for (; n > 0; t += len * stride, n -= len) {
+		len = n < BLOCK ? n : BLOCK;
+		if (!block_deltas(t, stride, len, state->start_time, delta)) {
+			for (i = 0; i < len; i++)
+				t[i * stride] += leap_diff(state, t[i * stride]);
+			continue;
+		}
+		leap_block(delta, leap, start_mod);
+		for (i = 0; i < len; i++)
+			t[i * stride] += diff + leap[i];
+	}
+}
+
+/*
+ * The inverse of t + unlucky_diff(t): the first real time which was shifted
+ * to s. A leap second repeats a shifted time, the rest of the minute makes up
+ * for it, and a dilated time is scaled back, so the estimate is at most a few
+ * seconds off.
+ */
+static time_t
+slow_unshift(const struct unlucky_state *state, time_t s)
+{
+	time_t	y, t;
+
+	y = s - state->diff - state->start_time;
+	if (state->mode == UNLUCKY_LEAP_SECOND)
+		y += y / 59;
+	t = state->start_time + unlucky_scale(y, state->dilation_den,
+	    state->dilation_num);
+
+	while (t + unlucky_diff(state, t) < s)
+		t++;
+	while (t - 1 + unlucky_diff(state, t - 1) >= s)
+		t--;
+
+	return t;
+}
+
+static inline void
+unshift(const struct unlucky_state *state, time_t *t, size_t stride, size_t n)
+{
+	time_t	diff = state->diff;
+	size_t	i;
+
+	if (state->mode != UNLUCKY_LEAP_SECOND &&
+	    state->dilation_num == state->dilation_den) {
+		for (i = 0; i < n; i++)
+			t[i * stride] -= diff;
+		return;
+	}
+
+	for (i = 0; i < n; i++)
+		t[i * stride] = slow_unshift(state, t[i * stride]);
+}
+
+void
+unlucky_shift(const struct unlucky_state *state, time_t *t, size_t n)
+{
+	shift(state, t, 1, n);
+}
+
+void
+unlucky_unshift(const struct unlucky_state *state, time_t *t, size_t n)
+{
+	unshift(state, t, 1, n);
+}
+
+void
+unlucky_shift_timespec(const struct unlucky_state *state, struct timespec *ts,
+    size_t n)
+{
+	shift(state, &ts->tv_sec, sizeof(*ts) / sizeof(time_t), n);
+}
+
+void
+unlucky_unshift_timespec(const struct unlucky_state *state, struct timespec *ts,
+    size_t n)
+{
+	unshift(state, &ts->tv_sec, sizeof(*ts) / sizeof(time_t), n);
+}
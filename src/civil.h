@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CIVIL_H
+#define CIVIL_H
+
+#include <stdint.h>
+
+/*
+ * Proleptic Gregorian dates without libc, after Howard Hinnant's
+ * days_from_civil() and civil_from_days(): the 400 year cycle is counted
+ * from March, which puts the leap day at the end of the year.
+ */
+
+#define CIVIL_SECSPERDAY	(60 * 60 * 24)
+
+struct civil {
+	long	year;
+	int	mon;		/* 1-12 */
+	int	mday;		/* 1-31 */
+	int	yday;		/* 0-365 */
+	int	hour;
+	int	min;
+	int	sec;
+};
+
+static inline int
+civil_leap(long year)
+{
+	return (year % 4) == 0 && ((year % 100) != 0 || (year % 400) == 0);
+}
+
+/* Days since 1970-01-01 of the given date, a day past the month is fine. */
+static inline long
+civil_days(long year, int mon, int mday)
+{
+	long era, yoe, doy, doe;
+
+	year -= mon <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + mday - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+/* The number of days in the month, December is followed by month 13. */
+static inline int
+civil_month_days(long year, int mon)
+{
+	return civil_days(year, mon + 1, 1) - civil_days(year, mon, 1);
+}
+
+static inline void
+civil_from_days(long days, long *year, int *mon, int *mday)
+{
+	long era, doe, yoe, doy, mp;
+
+	days += 719468;
+	era = (days >= 0 ? days : days - 146096) / 146097;
+	doe = days - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+
+	*mday = doy - (153 * mp + 2) / 5 + 1;
+	*mon = mp < 10 ? mp + 3 : mp - 9;
+	*year = yoe + era * 400 + (*mon <= 2);
+}
+
+/* Seconds since the epoch of c taken as UTC, yday is ignored. */
+static inline int64_t
+civil_time(const struct civil *c)
+{
+	return (int64_t)civil_days(c->year, c->mon, c->mday) * CIVIL_SECSPERDAY +
+	    c->hour * 60 * 60 + c->min * 60 + c->sec;
+}
+
+static inline void
+civil_split(int64_t t, struct civil *c)
+{
+	long	days;
+	int	secs;
+
+	days = t / CIVIL_SECSPERDAY - (t % CIVIL_SECSPERDAY < 0);
+	secs = t - (int64_t)days * CIVIL_SECSPERDAY;
+
+	civil_from_days(days, &c->year, &c->mon, &c->mday);
+	c->yday = days - civil_days(c->year, 1, 1);
+	c->hour = secs / (60 * 60);
+	c->min = secs / 60 % 60;
+	c->sec = secs % 60;
+}
+
+#endif /* CIVIL_H */
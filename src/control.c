@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "unlucky_time.h"
+#include "control.h"
+
+#define CONTROL_MAGIC		0x554e4c4b	/* UNLK */
+#define CONTROL_VERSION		1
+
+/* Give up on a read after this many attempts, rather than block. */
+#define CONTROL_READ_TRIES	64
+
+/* How long control_open() waits for the creator to fill in the page. */
+#define CONTROL_OPEN_WAIT	1000
+
+static int
+control_path(const char *name, char *path, size_t len)
+{
+	int r;
+
+	r = snprintf(path, len, "/unlucky-%s", name);
+
+	return r < 0 || (size_t)r >= len || strchr(name, '/') != NULL ? -1 : 0;
+}
+
+struct unlucky_control *
+control_open(const char *name, int create, int *created)
+{
+	char			 path[NAME_MAX];
+	struct unlucky_control	*control;
+	struct stat		 sb;
+	int			 fd, i;
+
+	*created = 0;
+
+	if (control_path(name, path, sizeof(path)) == -1)
+		return NULL;
+
+	fd = -1;
+	if (create) {
+		fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+		if (fd != -1) {
+			if (ftruncate(fd, sizeof(*control)) == -1) {
+				close(fd);
+				shm_unlink(path);
+				return NULL;
+			}
+			*created = 1;
+		} else if (errno != EEXIST) {
+			return NULL;
+		}
+	}
+	if (fd == -1 && (fd = shm_open(path, O_RDWR | O_CLOEXEC, 0)) == -1)
+		return NULL;
+
+	/* The creator might not have sized it yet. */
+	for (i = 0; i < CONTROL_OPEN_WAIT; i++) {
+		if (fstat(fd, &sb) == -1) {
+			close(fd);
+			return NULL;
+		}
+		if ((size_t)sb.st_size >= sizeof(*control))
+			break;
+		usleep(1000);
+	}
+	if ((size_t)sb.st_size < sizeof(*control)) {
+		close(fd);
+		return NULL;
+	}
+
+	control = mmap(NULL, sizeof(*control), PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0);
+	close(fd);
+	if (control == MAP_FAILED)
+		return NULL;
+
+	if (*created)
+		return control;
+
+	/* Nor filled it in. */
+	for (i = 0; i < CONTROL_OPEN_WAIT; i++) {
+		if (__atomic_load_n(&control->magic, __ATOMIC_ACQUIRE) == CONTROL_MAGIC)
+			break;
+		usleep(1000);
+	}
+	if (control->magic != CONTROL_MAGIC ||
+	    control->version != CONTROL_VERSION) {
+		munmap(control, sizeof(*control));
+		return NULL;
+	}
+
+	return control;
+}
+
+int
+control_unlink(const char *name)
+{
+	char path[NAME_MAX];
+
+	if (control_path(name, path, sizeof(path)) == -1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return shm_unlink(path);
+}
+
+/* Set once an invalid mode was reported, so it's only reported once. */
+static int	control_bad_mode;
+
+int
+control_read(struct unlucky_control *control, struct unlucky_state *state)
+{
+	uint32_t	seq1, seq2;
+	int32_t		mode;
+	int64_t		start_time, diff;
+	int		i;
+
+	for (i = 0; i < CONTROL_READ_TRIES; i++) {
+		seq1 = __atomic_load_n(&control->seq, __ATOMIC_ACQUIRE);
+		if (seq1 & 1)
+			continue;
+
+		mode = __atomic_load_n(&control->mode, __ATOMIC_RELAXED);
+		start_time = __atomic_load_n(&control->start_time, __ATOMIC_RELAXED);
+		diff = __atomic_load_n(&control->diff, __ATOMIC_RELAXED);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		seq2 = __atomic_load_n(&control->seq, __ATOMIC_RELAXED);
+		if (seq1 != seq2)
+			continue;
+
+		if (mode < 0 || mode >= UNLUCKY_RANDOM) {
+			if (!__atomic_exchange_n(&control_bad_mode, 1,
+			    __ATOMIC_RELAXED))
+				fprintf(stderr, "unlucky: invalid mode in the "
+				    "control page: %d\n", (int)mode);
+			return -1;
+		}
+
+		unlucky_set(state, start_time, mode, diff);
+		return 0;
+	}
+
+	return -1;
+}
+
+void
+control_write(struct unlucky_control *control, enum unlucky_mode mode,
+    time_t start_time, time_t diff)
+{
+	uint32_t seq;
+
+	/* There's a single writer at a time, the controller or the creator. */
+	seq = __atomic_load_n(&control->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&control->seq, seq | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	__atomic_store_n(&control->mode, mode, __ATOMIC_RELAXED);
+	__atomic_store_n(&control->start_time, start_time, __ATOMIC_RELAXED);
+	__atomic_store_n(&control->diff, diff, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&control->seq, (seq | 1) + 1, __ATOMIC_RELEASE);
+
+	control->version = CONTROL_VERSION;
+	__atomic_store_n(&control->magic, CONTROL_MAGIC, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+
+/*
+ * A page of shared memory which holds the mode and diff of a group of
+ * processes, so they all see the same shifted time and a controller can
+ * change it while they run. It is protected by a sequence lock: readers
+ * never write to the page or make a syscall, they retry if the writer was
+ * busy.
+ */
+struct unlucky_control {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	seq;		/* odd while the writer is busy */
+	int32_t		mode;
+	int64_t		start_time;
+	int64_t		diff;
+} __attribute__((aligned(UNLUCKY_CACHELINE)));
+
+/*
+ * Map the control page of the named group, creating it if create is set.
+ * Returns NULL on failure. *created is set if this call created it, in which
+ * case the caller is expected to control_write() it.
+ */
+struct unlucky_control	*control_open(const char *name, int create, int *created);
+int			 control_unlink(const char *name);
+
+/*
+ * Copy the current mode and diff into state. Returns -1 if no consistent
+ * copy could be made without waiting for the writer, or if the page holds a
+ * mode which isn't valid (reported once on stderr). state isn't touched in
+ * either case.
+ */
+int	control_read(struct unlucky_control *control, struct unlucky_state *state);
+void	control_write(struct unlucky_control *control, enum unlucky_mode mode, time_t start_time, time_t diff);
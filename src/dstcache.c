@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Every file in the cache directory is written to a temporary file first and
+ * renamed into place, so concurrent processes either see a complete table or
+ * none at all. A table is used straight from its mapping. The hit and miss
+ * counters live in a separate file which every process maps shared.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dstcache.h"
+#include "tzfile.h"
+
+#define DSTCACHE_MAGIC		"UNLKDST"
+#define DSTCACHE_VERSION	1
+#define DSTCACHE_MAX		4096
+
+struct dstcache_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	time_size;		/* sizeof(time_t) of the writer */
+	int32_t		tm_year;
+	uint32_t	count;
+	char		zone[PATH_MAX + 320];	/* tzfile_identity() */
+	/* followed by count time_t's */
+};
+
+struct dstcache_stats {
+	uint64_t	hits;
+	uint64_t	misses;
+};
+
+static struct dstcache_stats	*stats;
+static int			 stats_printed;
+
+/*
+ * The directory has to be the user's own and private, otherwise another user
+ * could have created it to plant tables, or links through which files of
+ * this user would be overwritten.
+ */
+static int
+cache_dir(char *dir, size_t len)
+{
+	const char	*env;
+	struct stat	 sb;
+	int		 r;
+
+	if ((env = getenv("UNLUCKY_CACHE_DIR")) != NULL)
+		r = snprintf(dir, len, "%s", env);
+	else if ((env = getenv("XDG_RUNTIME_DIR")) != NULL && *env != '\0')
+		r = snprintf(dir, len, "%s/unlucky", env);
+	else
+		r = snprintf(dir, len, "/tmp/unlucky-%lu", (unsigned long)getuid());
+
+	if (r <= 0 || (size_t)r >= len)
+		return -1;
+
+	if (mkdir(dir, 0700) == -1 && errno != EEXIST)
+		return -1;
+	if (lstat(dir, &sb) == -1 || !S_ISDIR(sb.st_mode) ||
+	    sb.st_uid != getuid() || (sb.st_mode & 077) != 0)
+		return -1;
+
+	return 0;
+}
+
+/* FNV-1a, only used to derive a file name from the zone identity. */
+static uint64_t
+hash(const char *s)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (; *s != '\0'; s++) {
+		h ^= (unsigned char)*s;
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+static int
+cache_path(int tm_year, char *path, size_t len, char *zone, size_t zone_len)
+{
+	char	dir[PATH_MAX];
+	int	r;
+
+	if (cache_dir(dir, sizeof(dir)) == -1)
+		return -1;
+	if (tzfile_identity(zone, zone_len) == -1)
+		return -1;
+
+	r = snprintf(path, len, "%s/dst-%016llx-%d.v%d", dir,
+	    (unsigned long long)hash(zone), tm_year, DSTCACHE_VERSION);
+
+	return r < 0 || (size_t)r >= len ? -1 : 0;
+}
+
+static struct dstcache_stats *
+stats_map(void)
+{
+	char	dir[PATH_MAX], path[PATH_MAX + 16];
+	void	*map;
+	int	fd;
+
+	if (stats != NULL)
+		return stats;
+
+	if (cache_dir(dir, sizeof(dir)) == -1)
+		return NULL;
+	snprintf(path, sizeof(path), "%s/stats", dir);
+
+	if ((fd = open(path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600)) == -1)
+		return NULL;
+	/* Growing a file to the same size from several processes is fine. */
+	if (ftruncate(fd, sizeof(struct dstcache_stats)) == -1) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, sizeof(struct dstcache_stats), PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return NULL;
+
+	return stats = map;
+}
+
+static void
+print_stats(void)
+{
+	uint64_t hits, misses;
+
+	dstcache_stats(&hits, &misses);
+	fprintf(stderr, "unlucky: dst cache: %llu hits, %llu misses (%.1f%%)\n",
+	    (unsigned long long)hits, (unsigned long long)misses,
+	    hits + misses ? 100.0 * hits / (hits + misses) : 0.0);
+}
+
+static void
+count(int hit)
+{
+	struct dstcache_stats *s;
+
+	if ((s = stats_map()) == NULL)
+		return;
+
+	if (!stats_printed && getenv("UNLUCKY_CACHE_STATS") != NULL) {
+		stats_printed = 1;
+		atexit(print_stats);
+	}
+
+	__atomic_add_fetch(hit ? &s->hits : &s->misses, 1, __ATOMIC_RELAXED);
+}
+
+const time_t *
+dstcache_lookup(int tm_year, size_t *size)
+{
+	char			 path[PATH_MAX], zone[sizeof(((struct dstcache_header *)0)->zone)];
+	struct dstcache_header	*header;
+	struct stat		 sb;
+	void			*map;
+	int			 fd;
+
+	if (cache_path(tm_year, path, sizeof(path), zone, sizeof(zone)) == -1)
+		return NULL;
+
+	if ((fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) == -1) {
+		count(0);
+		return NULL;
+	}
+	if (fstat(fd, &sb) == -1 || (size_t)sb.st_size < sizeof(*header)) {
+		close(fd);
+		count(0);
+		return NULL;
+	}
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		count(0);
+		return NULL;
+	}
+
+	header = map;
+	if (memcmp(header->magic, DSTCACHE_MAGIC, sizeof(DSTCACHE_MAGIC)) != 0 ||
+	    header->version != DSTCACHE_VERSION ||
+	    header->time_size != sizeof(time_t) ||
+	    header->tm_year != tm_year ||
+	    header->count > DSTCACHE_MAX ||
+	    (size_t)sb.st_size != sizeof(*header) + header->count * sizeof(time_t) ||
+	    strncmp(header->zone, zone, sizeof(header->zone)) != 0) {
+		munmap(map, sb.st_size);
+		count(0);
+		return NULL;
+	}
+
+	count(1);
+
+	/* The mapping stays around for as long as the table is used. */
+	*size = header->count;
+	return (const time_t *)(header + 1);
+}
+
+void
+dstcache_store(int tm_year, const time_t *table, size_t size)
+{
+	char			path[PATH_MAX], tmp[PATH_MAX + 16];
+	struct dstcache_header	header;
+	int			fd, r;
+
+	if (size > DSTCACHE_MAX)
+		return;
+
+	memset(&header, 0, sizeof(header));
+	if (cache_path(tm_year, path, sizeof(path), header.zone, sizeof(header.zone)) == -1)
+		return;
+
+	memcpy(header.magic, DSTCACHE_MAGIC, sizeof(DSTCACHE_MAGIC));
+	header.version = DSTCACHE_VERSION;
+	header.time_size = sizeof(time_t);
+	header.tm_year = tm_year;
+	header.count = size;
+
+	r = snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	if (r < 0 || (size_t)r >= sizeof(tmp))
+		return;
+	if ((fd = mkstemp(tmp)) == -1)
+		return;
+
+	r = write(fd, &header, sizeof(header)) == sizeof(header) &&
+	    write(fd, table, size * sizeof(time_t)) == (ssize_t)(size * sizeof(time_t));
+	if (close(fd) == -1 || !r || rename(tmp, path) == -1)
+		unlink(tmp);
+}
+
+void
+dstcache_stats(uint64_t *hits, uint64_t *misses)
+{
+	struct dstcache_stats *s;
+
+	*hits = *misses = 0;
+	if ((s = stats_map()) == NULL)
+		return;
+
+	*hits = __atomic_load_n(&s->hits, __ATOMIC_RELAXED);
+	*misses = __atomic_load_n(&s->misses, __ATOMIC_RELAXED);
+}
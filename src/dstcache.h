@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * A cache, shared between processes, of the DST changes dst_change() picks
+ * from. Tables are stored per zone and per year (tm_year) in
+ * UNLUCKY_CACHE_DIR (default $XDG_RUNTIME_DIR/unlucky, or /tmp/unlucky-<uid>
+ * without it, empty disables the cache). A directory which isn't private to
+ * the user isn't used.
+ */
+
+/*
+ * Returns the cached table for the active zone and year, mapped read-only
+ * and stored in *size entries, or NULL on a miss.
+ */
+const time_t	*dstcache_lookup(int tm_year, size_t *size);
+
+/* Store a table for the active zone and year, for the next process. */
+void		 dstcache_store(int tm_year, const time_t *table, size_t size);
+
+/*
+ * Lookups done by all processes using the same cache directory. With
+ * UNLUCKY_CACHE_STATS set these are printed to stderr at exit.
+ */
+void		 dstcache_stats(uint64_t *hits, uint64_t *misses);
@@ -17,8 +17,14 @@
 #define _GNU_SOURCE
 
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 #include <arpa/inet.h>
 #include <netinet/in.h>
@@ -27,20 +33,149 @@
 #include <err.h>
 #include <errno.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "unlucky_time.h"
+#include "control.h"
 #include "override.h"
+#include "random.h"
+#include "record.h"
+#include "simulate.h"
+#include "timeline.h"
+#include "vdso.h"
+#include "stats.h"
+#include "profile.h"
+#include "unlucky_clock.h"
 #include "utils.h"
 
 
-static int			_time_entered;
-static struct unlucky_state	state;
+/*
+ * The state is written once, by whichever thread gets to _init_once() first,
+ * and only read afterwards. Keep it on its own cache line so the clock hot
+ * path of every thread shares it read-only. Exported, with the flags, for
+ * the inline unlucky_now() of unlucky_clock.h.
+ */
+struct unlucky_state	unlucky_process_state __attribute__((aligned(UNLUCKY_CACHELINE)));
+int			unlucky_process_flags;
+
+#define state		unlucky_process_state
+
+/*
+ * Anything beyond adding the diff (UNLUCKY_FLAG_*) sets a flag, so the hot
+ * path only has to check a single word.
+ */
+static inline int
+_slow_path(void)
+{
+	return __builtin_expect(__atomic_load_n(&unlucky_process_flags, __ATOMIC_ACQUIRE) != 0, 0);
+}
+
+static void
+_set_flag(int flag, int set)
+{
+	if (set)
+		__atomic_or_fetch(&unlucky_process_flags, flag, __ATOMIC_RELEASE);
+	else
+		__atomic_and_fetch(&unlucky_process_flags, ~flag, __ATOMIC_RELEASE);
+}
+
+static pthread_once_t		_time_once = PTHREAD_ONCE_INIT;
+
+/*
+ * The mode specific builds (libunlucky-dst.so, ...) define UNLUCKY_FIXED_MODE,
+ * which lets the compiler fold the mode's diff into the overrides.
+ */
+#ifdef UNLUCKY_FIXED_MODE
+#define UNLUCKY_MODE	UNLUCKY_FIXED_MODE
+#else
+#define UNLUCKY_MODE	UNLUCKY_RANDOM
+#endif
+
+/* Set if the state is shared with other processes through UNLUCKY_SHM. */
+static struct unlucky_control	*control;
+
+#define NSEC_PER_SEC		1000000000LL
+#define VIRTUAL_RUNNING		INT64_MIN
+
+/*
+ * The virtual clock of unlucky_freeze() and friends, on top of the shifted
+ * time. frozen is the frozen time in nanoseconds, or VIRTUAL_RUNNING, in
+ * which case offset is added to the shifted time.
+ */
+static struct {
+	int64_t	frozen;
+	int64_t	offset;
+} _virtual __attribute__((aligned(UNLUCKY_CACHELINE))) = { VIRTUAL_RUNNING, 0 };
+
+/*
+ * With UNLUCKY_DILATION the wall clock runs state.dilation_num/dilation_den
+ * as fast from the start time on, and the monotonic clocks from where they
+ * were when the library was initialized. It's applied before the diff, so
+ * the diff of the mode is reached that much sooner.
+ */
+enum {
+	DILATED_MONOTONIC,
+	DILATED_MONOTONIC_RAW,
+	DILATED_MONOTONIC_COARSE,
+	DILATED_BOOTTIME,
+	DILATED_NCLOCKS,
+};
+
+static int64_t		_monotonic_origin[DILATED_NCLOCKS];
+
+static inline int64_t
+_ns(const struct timespec *tp)
+{
+	return tp->tv_sec * NSEC_PER_SEC + tp->tv_nsec;
+}
+
+static inline void
+_timespec(int64_t ns, struct timespec *tp)
+{
+	tp->tv_sec = ns / NSEC_PER_SEC;
+	tp->tv_nsec = ns % NSEC_PER_SEC;
+	if (tp->tv_nsec < 0) {
+		tp->tv_sec--;
+		tp->tv_nsec += NSEC_PER_SEC;
+	}
+}
+
+/* The clocks which follow the wall clock, and have to be shifted. */
+static inline int
+_realtime_clock(clockid_t clock_id)
+{
+	switch (clock_id) {
+	case CLOCK_REALTIME:
+#ifdef CLOCK_REALTIME_COARSE
+	case CLOCK_REALTIME_COARSE:
+#endif
+#ifdef CLOCK_REALTIME_ALARM
+	case CLOCK_REALTIME_ALARM:
+#endif
+#ifdef CLOCK_TAI
+	case CLOCK_TAI:
+#endif
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Per thread, so concurrent readers of the clock don't trip over each other. */
+static __thread int		_time_entered;
 
-static void _init_time_diff(void);
-static void _cleanup_time(void);
+/* Calls until the next UNLUCKY_PROFILE sample of this thread. */
+static __thread int		_profile_countdown;
 
 #if DEBUG
 #define DPRINTF(args...) fprintf(stderr, args)
@@ -48,13 +183,69 @@ static void _cleanup_time(void);
 #define DPRINTF(args...) do {} while(0)
 #endif
 
+#ifdef UNLUCKY_WRAP
+/*
+ * In a binary linked with --wrap=clock_gettime and so on, calls to a wrapped
+ * function end up in __wrap_clock_gettime() and libc's is
+ * __real_clock_gettime(), so nothing has to be looked up. Every function
+ * this is built to override has to be wrapped, the others are called
+ * directly.
+ */
+#ifdef OVERRIDE_GETTIMEOFDAY
+extern int	__real_gettimeofday(struct timeval *, timezone_ptr_t);
+#endif
+#ifdef OVERRIDE_TIME
+extern time_t	__real_time(time_t *);
+#endif
+#ifdef OVERRIDE_CLOCK_GETTIME
+extern int	__real_clock_gettime(clockid_t, struct timespec *);
+#endif
+#ifdef OVERRIDE_TIMESPEC_GET
+extern int	__real_timespec_get(struct timespec *, int);
+#endif
+#ifdef OVERRIDE_FTIME
+extern int	__real_ftime(struct timeb *);
+#endif
+
 static void
-_init_time(void)
+_resolve_originals(void)
 {
-	// Make sure we never enter one of the functions we override.
-	assert(_time_entered == 0);
-	_time_entered = 1;
+#ifdef OVERRIDE_GETTIMEOFDAY
+	original_gettimeofday = __real_gettimeofday;
+#else
+	original_gettimeofday = (gettimeofday_func_t)gettimeofday;
+#endif
+#ifdef OVERRIDE_TIME
+	original_time = __real_time;
+#else
+	original_time = time;
+#endif
+#ifdef OVERRIDE_CLOCK_GETTIME
+	original_clock_gettime = __real_clock_gettime;
+#else
+	original_clock_gettime = clock_gettime;
+#endif
+#ifdef OVERRIDE_TIMESPEC_GET
+	original_timespec_get = __real_timespec_get;
+#else
+	original_timespec_get = timespec_get;
+#endif
+	/* Deprecated, and only called by its override. */
+#ifdef OVERRIDE_FTIME
+	original_ftime = __real_ftime;
+#endif
+}
 
+/* Function-like, so the time member of struct timeb stays what it is. */
+#define gettimeofday(tp, tzp)		__wrap_gettimeofday(tp, tzp)
+#define time(tloc)			__wrap_time(tloc)
+#define clock_gettime(clock_id, tp)	__wrap_clock_gettime(clock_id, tp)
+#define timespec_get(ts, base)		__wrap_timespec_get(ts, base)
+#define ftime(tp)			__wrap_ftime(tp)
+#else
+static void
+_resolve_originals(void)
+{
 	if (original_gettimeofday == NULL)
 		original_gettimeofday = (gettimeofday_func_t)dlsym(RTLD_NEXT, "gettimeofday");
 
@@ -64,95 +255,2367 @@ _init_time(void)
 	if (original_clock_gettime == NULL)
 		original_clock_gettime = (clock_gettime_func_t)dlsym(RTLD_NEXT, "clock_gettime");
 
-	unlucky_init(&state, current_time(), UNLUCKY_RANDOM);
+	if (original_timespec_get == NULL)
+		original_timespec_get = (timespec_get_func_t)dlsym(RTLD_NEXT, "timespec_get");
+
+	if (original_ftime == NULL)
+		original_ftime = (ftime_func_t)dlsym(RTLD_NEXT, "ftime");
+
+#ifdef OVERRIDE_DEADLINES
+	if (original_clock_nanosleep == NULL)
+		original_clock_nanosleep = (clock_nanosleep_func_t)dlsym(RTLD_NEXT, "clock_nanosleep");
+
+	if (original_pthread_cond_timedwait == NULL)
+		original_pthread_cond_timedwait = (pthread_cond_timedwait_func_t)dlsym(RTLD_NEXT, "pthread_cond_timedwait");
+
+	if (original_pthread_cond_clockwait == NULL)
+		original_pthread_cond_clockwait = (pthread_cond_clockwait_func_t)dlsym(RTLD_NEXT, "pthread_cond_clockwait");
+
+	if (original_sem_timedwait == NULL)
+		original_sem_timedwait = (sem_timedwait_func_t)dlsym(RTLD_NEXT, "sem_timedwait");
+
+	if (original_sem_clockwait == NULL)
+		original_sem_clockwait = (sem_clockwait_func_t)dlsym(RTLD_NEXT, "sem_clockwait");
+
+	if (original_timer_settime == NULL)
+		original_timer_settime = (timer_settime_func_t)dlsym(RTLD_NEXT, "timer_settime");
+
+	if (original_timerfd_settime == NULL)
+		original_timerfd_settime = (timerfd_settime_func_t)dlsym(RTLD_NEXT, "timerfd_settime");
+#endif
+
+#ifdef OVERRIDE_SLEEPS
+	if (original_nanosleep == NULL)
+		original_nanosleep = (nanosleep_func_t)dlsym(RTLD_NEXT, "nanosleep");
+
+	if (original_usleep == NULL)
+		original_usleep = (usleep_func_t)dlsym(RTLD_NEXT, "usleep");
+
+	if (original_sleep == NULL)
+		original_sleep = (sleep_func_t)dlsym(RTLD_NEXT, "sleep");
+
+	if (original_poll == NULL)
+		original_poll = (poll_func_t)dlsym(RTLD_NEXT, "poll");
+
+	if (original_select == NULL)
+		original_select = (select_func_t)dlsym(RTLD_NEXT, "select");
+
+#ifdef __linux__
+	if (original_epoll_wait == NULL)
+		original_epoll_wait = (epoll_wait_func_t)dlsym(RTLD_NEXT, "epoll_wait");
+#endif
+#endif
+
+#ifdef OVERRIDE_SYSCALL
+	if (original_syscall == NULL)
+		original_syscall = (syscall_func_t)dlsym(RTLD_NEXT, "syscall");
+#endif
+
+#ifdef OVERRIDE_SPAWN
+	if (original_posix_spawn == NULL)
+		original_posix_spawn = (posix_spawn_func_t)dlsym(RTLD_NEXT, "posix_spawn");
+
+	if (original_posix_spawnp == NULL)
+		original_posix_spawnp = (posix_spawn_func_t)dlsym(RTLD_NEXT, "posix_spawnp");
+
+	if (original_system == NULL)
+		original_system = (system_func_t)dlsym(RTLD_NEXT, "system");
+
+	if (original_popen == NULL)
+		original_popen = (popen_func_t)dlsym(RTLD_NEXT, "popen");
+
+	if (original_pclose == NULL)
+		original_pclose = (pclose_func_t)dlsym(RTLD_NEXT, "pclose");
+#endif
+
+#ifdef OVERRIDE_FILES
+	if (original_stat == NULL)
+		original_stat = (stat_func_t)dlsym(RTLD_NEXT, "stat");
+
+	if (original_lstat == NULL)
+		original_lstat = (stat_func_t)dlsym(RTLD_NEXT, "lstat");
+
+	if (original_fstat == NULL)
+		original_fstat = (fstat_func_t)dlsym(RTLD_NEXT, "fstat");
+
+	if (original_fstatat == NULL)
+		original_fstatat = (fstatat_func_t)dlsym(RTLD_NEXT, "fstatat");
+
+	if (original_utimensat == NULL)
+		original_utimensat = (utimensat_func_t)dlsym(RTLD_NEXT, "utimensat");
+
+	if (original_futimens == NULL)
+		original_futimens = (futimens_func_t)dlsym(RTLD_NEXT, "futimens");
+
+	if (original_utimes == NULL)
+		original_utimes = (utimes_func_t)dlsym(RTLD_NEXT, "utimes");
+
+	if (original_utime == NULL)
+		original_utime = (utime_func_t)dlsym(RTLD_NEXT, "utime");
+
+#ifdef UNLUCKY_STATX
+	if (original_statx == NULL)
+		original_statx = (statx_func_t)dlsym(RTLD_NEXT, "statx");
+#endif
+
+#ifdef UNLUCKY_STAT64
+	if (original_stat64 == NULL)
+		original_stat64 = (stat64_func_t)dlsym(RTLD_NEXT, "stat64");
+
+	if (original_lstat64 == NULL)
+		original_lstat64 = (stat64_func_t)dlsym(RTLD_NEXT, "lstat64");
+
+	if (original_fstat64 == NULL)
+		original_fstat64 = (fstat64_func_t)dlsym(RTLD_NEXT, "fstat64");
+
+	if (original_fstatat64 == NULL)
+		original_fstatat64 = (fstatat64_func_t)dlsym(RTLD_NEXT, "fstatat64");
+
+	if (original_xstat == NULL)
+		original_xstat = (xstat_func_t)dlsym(RTLD_NEXT, "__xstat");
+
+	if (original_lxstat == NULL)
+		original_lxstat = (xstat_func_t)dlsym(RTLD_NEXT, "__lxstat");
+
+	if (original_fxstat == NULL)
+		original_fxstat = (fxstat_func_t)dlsym(RTLD_NEXT, "__fxstat");
+
+	if (original_fxstatat == NULL)
+		original_fxstatat = (fxstatat_func_t)dlsym(RTLD_NEXT, "__fxstatat");
+
+	if (original_xstat64 == NULL)
+		original_xstat64 = (xstat64_func_t)dlsym(RTLD_NEXT, "__xstat64");
+
+	if (original_lxstat64 == NULL)
+		original_lxstat64 = (xstat64_func_t)dlsym(RTLD_NEXT, "__lxstat64");
+
+	if (original_fxstat64 == NULL)
+		original_fxstat64 = (fxstat64_func_t)dlsym(RTLD_NEXT, "__fxstat64");
+
+	if (original_fxstatat64 == NULL)
+		original_fxstatat64 = (fxstatat64_func_t)dlsym(RTLD_NEXT, "__fxstatat64");
+#endif
+#endif
+
+#ifdef OVERRIDE_SIMULATE
+	if (original_pthread_create == NULL)
+		original_pthread_create = (pthread_create_func_t)dlsym(RTLD_NEXT, "pthread_create");
+
+	if (original_pthread_join == NULL)
+		original_pthread_join = (pthread_join_func_t)dlsym(RTLD_NEXT, "pthread_join");
+
+	if (original_pthread_cond_wait == NULL)
+		original_pthread_cond_wait = (pthread_cond_wait_func_t)dlsym(RTLD_NEXT, "pthread_cond_wait");
+
+	if (original_sem_wait == NULL)
+		original_sem_wait = (sem_wait_func_t)dlsym(RTLD_NEXT, "sem_wait");
+#endif
+}
+#endif
+
+/*
+ * The state is passed on to programs started by this one in UNLUCKY_STATE, as
+ * mode:start_time:diff:seed, so they don't pick one of their own. The seed,
+ * which they draw from as well, can be left out.
+ */
+#define UNLUCKY_STATE_ENV	"UNLUCKY_STATE"
+
+static int
+_state_parse(const char *s, enum unlucky_mode mode, struct unlucky_state *st)
+{
+	char		 name[32], *end;
+	const char	*colon;
+	enum unlucky_mode m;
+	long long	 start_time, diff;
+	unsigned long long seed = 0;
+	int		 seeded = 0;
+
+	if ((colon = strchr(s, ':')) == NULL || (size_t)(colon - s) >= sizeof(name))
+		return -1;
+	memcpy(name, s, colon - s);
+	name[colon - s] = '\0';
+	if (unlucky_mode_parse(name, &m) == -1 || m == UNLUCKY_RANDOM)
+		return -1;
+	if (mode != UNLUCKY_RANDOM && m != mode)
+		return -1;
+
+	errno = 0;
+	start_time = strtoll(colon + 1, &end, 10);
+	if (errno != 0 || *end != ':')
+		return -1;
+	diff = strtoll(end + 1, &end, 10);
+	if (errno == 0 && *end == ':') {
+		seed = strtoull(end + 1, &end, 10);
+		seeded = 1;
+	}
+	if (errno != 0 || *end != '\0')
+		return -1;
+
+	if (seeded)
+		random_seed(seed);
+	unlucky_set(st, start_time, m, diff);
+	return 0;
 }
 
+/*
+ * The variables children get, "UNLUCKY_STATE=..." and "UNLUCKY_TIMELINE=...",
+ * formatted once the state is picked. The environment of the process itself
+ * is never changed: other threads could be reading it, and the program
+ * would find them there. They are put in that of the child of a fork, and
+ * in a copy of ours for the programs started without one.
+ */
+static char		_state_env[160];
+static char		_timeline_env[sizeof("UNLUCKY_TIMELINE=") + TIMELINE_MAX * 48];
+
 static void
-_cleanup_time(void)
+_state_format(void)
 {
-	_time_entered = 0;
+	const size_t	len = sizeof("UNLUCKY_TIMELINE=") - 1;
+
+	snprintf(_state_env, sizeof(_state_env),
+	    UNLUCKY_STATE_ENV "=%s:%lld:%lld:%llu", unlucky_mode_name(state.mode),
+	    (long long)state.start_time, (long long)state.diff,
+	    (unsigned long long)random_seed_value());
+
+	memcpy(_timeline_env, "UNLUCKY_TIMELINE=", len);
+	if (!(unlucky_process_flags & UNLUCKY_FLAG_TIMELINE) ||
+	    timeline_export(_timeline_env + len, sizeof(_timeline_env) - len) == -1)
+		_timeline_env[0] = '\0';
 }
 
-time_t
-gettimediff(time_t current_time)
+/*
+ * Put var in the environment of the child of a fork. Not with setenv(3),
+ * which could wait for a lock held by a thread the child doesn't have. The
+ * child has the only thread using its environ, so the entry is pointed at
+ * var, or environ at a copy with it.
+ */
+static void
+_child_putenv(char *var)
 {
-	time_t diff;
-	_init_time();
-	diff = unlucky_diff(&state, current_time);
-	_cleanup_time();
-	return diff;
+	char	**env;
+	size_t	  len, n = 0;
+
+	len = strchr(var, '=') - var + 1;
+	for (n = 0; environ != NULL && environ[n] != NULL; n++) {
+		if (strncmp(environ[n], var, len) == 0) {
+			environ[n] = var;
+			return;
+		}
+	}
+
+	if ((env = malloc((n + 2) * sizeof(*env))) == NULL)
+		return;
+	if (n > 0)
+		memcpy(env, environ, n * sizeof(*env));
+	env[n] = var;
+	env[n + 1] = NULL;
+	environ = env;
 }
 
-#ifdef OVERRIDE_CLOCK_GETTIME
-int
-clock_gettime(clockid_t clock_id, struct timespec *tp)
+/*
+ * With UNLUCKY_START_TIME the shift is picked as if the program was started
+ * at that time, and its clock starts there.
+ */
+static void
+_pick_state(enum unlucky_mode mode)
 {
-	int	r;
-	time_t	diff = 0;
+	const char	*s;
+	char		*end;
+	long long	 start_time;
+	time_t		 now;
 
-	_init_time();
+	now = current_time();
+	if ((s = getenv("UNLUCKY_START_TIME")) == NULL) {
+		unlucky_init(&state, now, mode);
+		return;
+	}
 
-	r = original_clock_gettime(clock_id, tp);
+	errno = 0;
+	start_time = strtoll(s, &end, 10);
+	if (errno != 0 || *s == '\0' || *end != '\0') {
+		fprintf(stderr, "unlucky: invalid UNLUCKY_START_TIME: %s\n", s);
+		start_time = now;
+	}
+
+	unlucky_init(&state, start_time, mode);
+	unlucky_set(&state, now, state.mode, state.diff + (start_time - now));
+}
+
+static void
+_init_state(void)
+{
+	const char		*name;
+	enum unlucky_mode	 mode = UNLUCKY_MODE;
+	int			 created = 0;
 
-	if (r == 0 && clock_id == CLOCK_REALTIME) {
-		diff = unlucky_diff(&state, tp->tv_sec);
-		tp->tv_sec += diff;
+#ifndef UNLUCKY_FIXED_MODE
+	if ((name = getenv("UNLUCKY_MODE")) != NULL &&
+	    unlucky_mode_parse(name, &mode) == -1)
+		mode = UNLUCKY_RANDOM;
+#endif
+
+	/* A replay runs with the state of the recording. */
+	if ((name = getenv("UNLUCKY_REPLAY")) != NULL) {
+		if (replay_open(name, &state) == 0) {
+			_set_flag(UNLUCKY_FLAG_REPLAY, 1);
+			return;
+		}
+		fprintf(stderr, "unlucky: can't replay %s\n", name);
+	}
+
+	/*
+	 * The first process of a group picks the diff, the others use the
+	 * one it put in the control page.
+	 */
+	if ((name = getenv("UNLUCKY_SHM")) != NULL) {
+		control = control_open(name, 1, &created);
+		_set_flag(UNLUCKY_FLAG_CONTROL, control != NULL);
 	}
 
-	DPRINTF("clock_gettime date returned: %s (diff added: %lu)\n", asctime(localtime(&tp->tv_sec)), diff);
+	if (control == NULL || created || control_read(control, &state) == -1) {
+		if ((name = getenv(UNLUCKY_STATE_ENV)) == NULL ||
+		    _state_parse(name, mode, &state) == -1)
+			_pick_state(mode);
+	}
 
-	_cleanup_time();
+	if (control != NULL && created)
+		control_write(control, state.mode, state.start_time, state.diff);
 
-	return r;
+	if ((name = getenv("UNLUCKY_RECORD")) != NULL) {
+		if (record_open(name, &state) == 0)
+			_set_flag(UNLUCKY_FLAG_RECORD, 1);
+		else
+			fprintf(stderr, "unlucky: can't record to %s\n", name);
+	}
 }
+
+static int
+_dilation_start(const char *s)
+{
+	struct timespec	 ts;
+	clockid_t	 clocks[DILATED_NCLOCKS] = { CLOCK_MONOTONIC, -1, -1, -1 };
+	long long	 num, den = 1;
+	char		*end;
+	int		 i;
+
+	errno = 0;
+	num = strtoll(s, &end, 10);
+	if (errno == 0 && *end == '/')
+		den = strtoll(end + 1, &end, 10);
+	if (errno != 0 || end == s || *end != '\0' || num <= 0 || den <= 0)
+		return -1;
+
+#ifdef CLOCK_MONOTONIC_RAW
+	clocks[DILATED_MONOTONIC_RAW] = CLOCK_MONOTONIC_RAW;
+#endif
+#ifdef CLOCK_MONOTONIC_COARSE
+	clocks[DILATED_MONOTONIC_COARSE] = CLOCK_MONOTONIC_COARSE;
 #endif
+#ifdef CLOCK_BOOTTIME
+	clocks[DILATED_BOOTTIME] = CLOCK_BOOTTIME;
+#endif
+	for (i = 0; i < DILATED_NCLOCKS; i++)
+		if (clocks[i] != -1 && original_clock_gettime(clocks[i], &ts) == 0)
+			_monotonic_origin[i] = _ns(&ts);
 
-#ifdef OVERRIDE_GETTIMEOFDAY
-int
-gettimeofday(struct timeval *tp, struct timezone *tzp)
+	unlucky_dilate(&state, num, den);
+	_set_flag(UNLUCKY_FLAG_DILATION, num != den);
+
+	return 0;
+}
+
+static void
+_init_once(void)
 {
-	int		r;
-	struct tm	res;
-	time_t		diff;
+	struct timespec	 begin, end;
+	const char	*name;
 
-	_init_time();
+	_resolve_originals();
+	original_clock_gettime(CLOCK_MONOTONIC, &begin);
 
-	r = original_gettimeofday(tp, tzp);
+	if ((name = getenv("UNLUCKY_STATS")) != NULL) {
+		if (stats_open(name) == 0)
+			_set_flag(UNLUCKY_FLAG_STATS, 1);
+		else
+			fprintf(stderr, "unlucky: can't keep statistics\n");
+	}
 
-	if (r == 0) {
-		diff = unlucky_diff(&state, tp->tv_sec);
-		tp->tv_sec += diff;
+	if ((name = getenv("UNLUCKY_PROFILE")) != NULL) {
+		if (profile_open(strtoul(name, NULL, 10)) == 0)
+			_set_flag(UNLUCKY_FLAG_PROFILE, 1);
+		else
+			fprintf(stderr, "unlucky: UNLUCKY_PROFILE should be the number of calls between samples\n");
 	}
 
-	DPRINTF("gettimeofday date returned: %s (diff added: %lu)\n", asctime(localtime(&tp->tv_sec)), diff);
+	_init_state();
 
-	_cleanup_time();
+	if ((name = getenv("UNLUCKY_TIMELINE")) != NULL) {
+		if (timeline_open(name, &state, current_time()) == 0)
+			_set_flag(UNLUCKY_FLAG_TIMELINE, 1);
+		else
+			fprintf(stderr, "unlucky: invalid UNLUCKY_TIMELINE: %s\n", name);
+	}
 
-	return r;
-}
+	if ((name = getenv("UNLUCKY_DILATION")) != NULL) {
+		if (_dilation_start(name) == -1)
+			fprintf(stderr, "unlucky: UNLUCKY_DILATION should be a factor like 60 or 1/2\n");
+	}
+
+#ifdef OVERRIDE_SIMULATE
+	if (getenv("UNLUCKY_SIMULATE") != NULL) {
+		if (simulate_open() == 0)
+			_set_flag(UNLUCKY_FLAG_SIMULATE, 1);
+		else
+			fprintf(stderr, "unlucky: can't simulate\n");
+	}
 #endif
 
-#ifdef OVERRIDE_TIME
-time_t
-time(time_t *tloc)
+	_state_format();
+
+	if (unlucky_process_flags & UNLUCKY_FLAG_STATS) {
+		stats_seed(random_seed_value());
+		original_clock_gettime(CLOCK_MONOTONIC, &end);
+		stats_add(STATS_INIT, _ns(&end) - _ns(&begin));
+	}
+}
+
+/*
+ * The state is finished before a fork, so a thread which was still picking it
+ * can't leave the child with a half initialized one.
+ */
+static void
+_fork_prepare(void)
 {
-	time_t		r;
+	if (!_time_entered)
+		pthread_once(&_time_once, _init_once);
+}
 
-	_init_time();
+/* And it's exported in the child, for a program the child might exec. */
+static void
+_fork_child(void)
+{
+	if (_state_env[0] == '\0')
+		return;
 
-	r = original_time(tloc);
-	if (r == -1)
-		return r;
+	_child_putenv(_state_env);
+	if (_timeline_env[0] != '\0')
+		_child_putenv(_timeline_env);
+}
 
-	if (tloc) {
-		(*tloc) += unlucky_diff(&state, r);
+/*
+ * Slow path of _init_time(), only taken before the state is initialized.
+ * If we're entered recursively (e.g. libc calling one of the functions we
+ * override while we initialize) the original function has to be used as-is,
+ * and 0 is returned.
+ */
+static int
+_init_time_slow(void)
+{
+	if (_time_entered) {
+		_resolve_originals();
+		return 0;
 	}
 
-	r += unlucky_diff(&state, r);
+	_time_entered = 1;
+	pthread_once(&_time_once, _init_once);
+	_time_entered = 0;
 
-	DPRINTF("time date returned: %s\n", asctime(localtime(&r)));
+	return 1;
+}
+
+/*
+ * Returns 1 when the caller should apply the diff. Normally the constructor
+ * already did all the work and this is a single load.
+ */
+static inline int
+_init_time(void)
+{
+	if (__builtin_expect(__atomic_load_n(&state.initialized, __ATOMIC_ACQUIRE), 1))
+		return 1;
+
+	return _init_time_slow();
+}
+
+#ifdef OVERRIDE_SYSCALL
+/*
+ * With UNLUCKY_VDSO the clocks are also shifted for code which doesn't ask
+ * libc for them: raw syscall()s, and runtimes like Go's which look up the
+ * vDSO functions themselves. Those find the overrides instead, before such
+ * a runtime starts. The overrides still reach the real vDSO through libc,
+ * so a read costs what a clock_gettime() does.
+ */
+static int	_raw_clocks;
+
+static void
+_raw_clocks_start(int argc, char **argv)
+{
+	static const struct vdso_hook hooks[] = {
+		{ "__vdso_clock_gettime", clock_gettime },
+		{ "__kernel_clock_gettime", clock_gettime },
+		{ "__vdso_gettimeofday", gettimeofday },
+		{ "__kernel_gettimeofday", gettimeofday },
+		{ "__vdso_time", time },
+		{ "clock_gettime", clock_gettime },
+		{ "gettimeofday", gettimeofday },
+		{ "time", time },
+	};
+
+	_raw_clocks = 1;
+	if (vdso_redirect(argc, argv, hooks, sizeof(hooks) / sizeof(hooks[0])) == -1)
+		fprintf(stderr, "unlucky: can't redirect the vDSO\n");
+}
+#endif
+
+/*
+ * Resolve the original functions and pick the diff when the library is
+ * loaded, so the first clock read of the program doesn't pay for it. Setting
+ * UNLUCKY_LAZY postpones the latter until the clock is read for the first
+ * time, for programs which might never do so.
+ *
+ * glibc passes the arguments of main() to constructors, others don't.
+ */
+__attribute__((constructor))
+static void
+_unlucky_constructor(int argc, char **argv, char **envp)
+{
+	_resolve_originals();
+
+	pthread_atfork(_fork_prepare, NULL, _fork_child);
+
+#ifdef OVERRIDE_SYSCALL
+	if (getenv("UNLUCKY_VDSO") != NULL) {
+#ifdef __GLIBC__
+		_raw_clocks_start(argc, argv);
+#else
+		_raw_clocks_start(0, NULL);
+#endif
+	}
+#endif
+
+	if (getenv("UNLUCKY_LAZY") != NULL)
+		return;
+
+	_init_time_slow();
+}
+
+static inline time_t
+_mode_diff(struct unlucky_state *s, time_t current_time)
+{
+#ifdef UNLUCKY_FIXED_MODE
+	if (UNLUCKY_FIXED_MODE == UNLUCKY_LEAP_SECOND)
+		return s->diff + unlucky_leap_seconds(s->start_time, current_time);
+	return s->diff;
+#else
+	return s->diff + s->diff_fn(s->start_time, current_time);
+#endif
+}
+
+/*
+ * The diff to apply to the real time. When the state is shared it's read
+ * from the control page on every call, a controller might have changed it.
+ * A mode specific build only takes the diff from it, not the mode.
+ */
+static inline time_t
+_time_diff(time_t current_time)
+{
+	struct unlucky_state current;
+
+	if (control != NULL && control_read(control, &current) == 0)
+		return _mode_diff(&current, current_time);
+
+	if (__atomic_load_n(&unlucky_process_flags, __ATOMIC_ACQUIRE) &
+	    UNLUCKY_FLAG_TIMELINE)
+		return timeline_diff(current_time);
+
+	return _mode_diff(&state, current_time);
+}
+
+static inline int
+_dilated(void)
+{
+	return __atomic_load_n(&unlucky_process_flags, __ATOMIC_RELAXED) &
+	    UNLUCKY_FLAG_DILATION;
+}
+
+static int
+_monotonic_clock(clockid_t clock_id)
+{
+	switch (clock_id) {
+	case CLOCK_MONOTONIC:
+		return DILATED_MONOTONIC;
+#ifdef CLOCK_MONOTONIC_RAW
+	case CLOCK_MONOTONIC_RAW:
+		return DILATED_MONOTONIC_RAW;
+#endif
+#ifdef CLOCK_MONOTONIC_COARSE
+	case CLOCK_MONOTONIC_COARSE:
+		return DILATED_MONOTONIC_COARSE;
+#endif
+#ifdef CLOCK_BOOTTIME
+	case CLOCK_BOOTTIME:
+		return DILATED_BOOTTIME;
+#endif
+	default:
+		return -1;
+	}
+}
+
+/* A duration the program waits for, as a real one, and the other way around. */
+static inline int64_t
+_real_ns(int64_t ns)
+{
+	return unlucky_scale(ns, state.dilation_den, state.dilation_num);
+}
+
+static inline int64_t
+_program_ns(int64_t ns)
+{
+	return unlucky_scale(ns, state.dilation_num, state.dilation_den);
+}
+
+static inline int
+_simulated(void)
+{
+	return __atomic_load_n(&unlucky_process_flags, __ATOMIC_RELAXED) &
+	    UNLUCKY_FLAG_SIMULATE;
+}
+
+/* The time skipped by UNLUCKY_SIMULATE passes on every clock, before dilation. */
+static void
+_monotonic_time(int i, struct timespec *tp)
+{
+	if (_simulated())
+		_timespec(_ns(tp) + simulate_skipped(), tp);
+	if (_dilated())
+		_timespec(_monotonic_origin[i] + _program_ns(_ns(tp) - _monotonic_origin[i]), tp);
+}
+
+/* Shift a real wall clock time, without the virtual clock. */
+static void
+_shift_wall(struct timespec *tp)
+{
+	int64_t start;
+
+	if (_simulated())
+		_timespec(_ns(tp) + simulate_skipped(), tp);
+
+	if (_dilated()) {
+		start = state.start_time * NSEC_PER_SEC;
+		_timespec(start + _program_ns(_ns(tp) - start), tp);
+	}
+
+	tp->tv_sec += _time_diff(tp->tv_sec);
+}
+
+/* Shift a real wall clock time, and run it through the virtual clock. */
+static void
+_shift_realtime(struct timespec *tp)
+{
+	int64_t	frozen, offset;
+
+	_shift_wall(tp);
+
+	frozen = __atomic_load_n(&_virtual.frozen, __ATOMIC_ACQUIRE);
+	offset = __atomic_load_n(&_virtual.offset, __ATOMIC_RELAXED);
+	if (__builtin_expect(frozen != VIRTUAL_RUNNING, 0))
+		_timespec(frozen, tp);
+	else if (__builtin_expect(offset != 0, 0))
+		_timespec(_ns(tp) + offset, tp);
+}
+
+/*
+ * Turn what clock_id read into tp into the time the program should see: a
+ * real time is shifted and then run through the virtual clock, a monotonic
+ * one is dilated or skipped ahead. Returns 0 if the clock is left alone.
+ */
+static int
+_program_time(clockid_t clock_id, struct timespec *tp)
+{
+	int i;
+
+	if (_realtime_clock(clock_id)) {
+		_shift_realtime(tp);
+		return 1;
+	}
+	if ((_dilated() || _simulated()) &&
+	    (i = _monotonic_clock(clock_id)) != -1) {
+		_monotonic_time(i, tp);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Every read, of any clock, is recorded or replayed. */
+static void
+_shift_timespec_slow(enum record_fn fn, clockid_t clock_id, struct timespec *tp)
+{
+	struct timespec	raw = *tp;
+	int		flags;
+
+	_program_time(clock_id, tp);
+
+	flags = __atomic_load_n(&unlucky_process_flags, __ATOMIC_ACQUIRE);
+	if (flags & UNLUCKY_FLAG_REPLAY)
+		replay_next(fn, clock_id, tp);
+	else if (flags & UNLUCKY_FLAG_RECORD)
+		record_add(fn, clock_id, &raw, tp);
+}
+
+static inline void
+_shift_timespec(enum record_fn fn, clockid_t clock_id, struct timespec *tp)
+{
+	if (_slow_path())
+		_shift_timespec_slow(fn, clock_id, tp);
+	else if (_realtime_clock(clock_id))
+		tp->tv_sec += _mode_diff(&state, tp->tv_sec);
+}
+
+static int64_t
+_enter_slow(enum stats_fn fn, void *caller)
+{
+	struct timespec	ts;
+	int		flags;
+
+	flags = __atomic_load_n(&unlucky_process_flags, __ATOMIC_RELAXED);
+
+	if ((flags & UNLUCKY_FLAG_PROFILE) && --_profile_countdown <= 0) {
+		_profile_countdown = profile_interval;
+		profile_sample(fn, caller);
+	}
+
+	if (!(flags & UNLUCKY_FLAG_STATS))
+		return 0;
+
+	original_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return _ns(&ts);
+}
+
+/*
+ * Called by every override before and after doing its work. With
+ * UNLUCKY_STATS the call is counted and timed, _enter() returns 0 if it
+ * isn't. With UNLUCKY_PROFILE every Nth call of a thread is sampled, which
+ * is why _enter() has to be inlined: the return address is the caller of
+ * the override.
+ */
+static inline __attribute__((always_inline)) int64_t
+_enter(enum stats_fn fn)
+{
+	if (!_slow_path())
+		return 0;
+
+	return _enter_slow(fn, __builtin_return_address(0));
+}
+
+static inline void
+_leave(enum stats_fn fn, int64_t start)
+{
+	struct timespec ts;
+
+	if (start == 0)
+		return;
+
+	original_clock_gettime(CLOCK_MONOTONIC, &ts);
+	stats_add(fn, _ns(&ts) - start);
+}
+
+/* The shifted time, without the virtual clock. */
+static int64_t
+_shifted_now(void)
+{
+	struct timespec ts;
+
+	original_clock_gettime(CLOCK_REALTIME, &ts);
+	_shift_wall(&ts);
+
+	return _ns(&ts);
+}
+
+void
+unlucky_freeze(const struct timespec *at)
+{
+	int64_t frozen;
+
+	_init_time();
+
+	if (at != NULL)
+		frozen = _ns(at);
+	else if ((frozen = __atomic_load_n(&_virtual.frozen, __ATOMIC_ACQUIRE)) == VIRTUAL_RUNNING)
+		frozen = _shifted_now() + __atomic_load_n(&_virtual.offset, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&_virtual.frozen, frozen, __ATOMIC_RELEASE);
+	_set_flag(UNLUCKY_FLAG_VIRTUAL, 1);
+}
+
+void
+unlucky_advance(int64_t ns)
+{
+	int64_t frozen;
+
+	frozen = __atomic_load_n(&_virtual.frozen, __ATOMIC_ACQUIRE);
+	while (frozen != VIRTUAL_RUNNING) {
+		if (__atomic_compare_exchange_n(&_virtual.frozen, &frozen,
+		    frozen + ns, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return;
+	}
+
+	__atomic_add_fetch(&_virtual.offset, ns, __ATOMIC_RELEASE);
+	_set_flag(UNLUCKY_FLAG_VIRTUAL, 1);
+}
+
+void
+unlucky_resume(void)
+{
+	int64_t frozen;
+
+	_init_time();
+
+	frozen = __atomic_load_n(&_virtual.frozen, __ATOMIC_ACQUIRE);
+	if (frozen == VIRTUAL_RUNNING)
+		return;
+
+	/* Continue from the frozen time. */
+	__atomic_store_n(&_virtual.offset, frozen - _shifted_now(), __ATOMIC_RELAXED);
+	__atomic_store_n(&_virtual.frozen, VIRTUAL_RUNNING, __ATOMIC_RELEASE);
+}
+
+void
+unlucky_reset(void)
+{
+	_set_flag(UNLUCKY_FLAG_VIRTUAL, 0);
+	__atomic_store_n(&_virtual.offset, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_virtual.frozen, VIRTUAL_RUNNING, __ATOMIC_RELEASE);
+}
+
+int
+unlucky_gettime(clockid_t clock_id, struct timespec *tp)
+{
+	int64_t	start;
+	int	r;
+
+	if (!_init_time())
+		return original_clock_gettime(clock_id, tp);
+
+	start = _enter(STATS_CLOCK_GETTIME);
+	r = original_clock_gettime(clock_id, tp);
+	if (r == 0)
+		_shift_timespec(RECORD_CLOCK_GETTIME, clock_id, tp);
+	_leave(STATS_CLOCK_GETTIME, start);
+
+	return r;
+}
+
+time_t
+gettimediff(time_t current_time)
+{
+	struct timespec ts;
+
+	if (!_init_time())
+		return 0;
+
+	ts.tv_sec = current_time;
+	ts.tv_nsec = 0;
+	_shift_wall(&ts);
+
+	return ts.tv_sec - current_time;
+}
+
+#ifdef OVERRIDE_CLOCK_GETTIME
+int
+clock_gettime(clockid_t clock_id, struct timespec *tp)
+{
+	int64_t	start;
+	int	r;
+
+	if (!_init_time())
+		return original_clock_gettime(clock_id, tp);
+
+	start = _enter(STATS_CLOCK_GETTIME);
+	r = original_clock_gettime(clock_id, tp);
+
+	if (r == 0)
+		_shift_timespec(RECORD_CLOCK_GETTIME, clock_id, tp);
+	_leave(STATS_CLOCK_GETTIME, start);
+
+	DPRINTF("clock_gettime date returned: %s\n", asctime(localtime(&tp->tv_sec)));
+
+	return r;
+}
+#endif
+
+#ifdef OVERRIDE_GETTIMEOFDAY
+int
+gettimeofday(struct timeval *tp, timezone_ptr_t tzp)
+{
+	int		r;
+	int64_t		start;
+	struct timespec	ts;
+
+	if (!_init_time())
+		return original_gettimeofday(tp, tzp);
+
+	start = _enter(STATS_GETTIMEOFDAY);
+	r = original_gettimeofday(tp, tzp);
+
+	if (r == 0) {
+		ts.tv_sec = tp->tv_sec;
+		ts.tv_nsec = tp->tv_usec * 1000;
+		_shift_timespec(RECORD_GETTIMEOFDAY, CLOCK_REALTIME, &ts);
+		tp->tv_sec = ts.tv_sec;
+		tp->tv_usec = ts.tv_nsec / 1000;
+	}
+	_leave(STATS_GETTIMEOFDAY, start);
+
+	DPRINTF("gettimeofday date returned: %s\n", asctime(localtime(&tp->tv_sec)));
+
+	return r;
+}
+#endif
+
+#ifdef OVERRIDE_TIME
+/* The virtual clock needs the nanoseconds as well. */
+static time_t
+_time_slow(time_t *tloc)
+{
+	struct timespec	ts;
+
+	if (original_clock_gettime(CLOCK_REALTIME, &ts) == -1)
+		return -1;
+	_shift_timespec(RECORD_TIME, CLOCK_REALTIME, &ts);
+	if (tloc)
+		*tloc = ts.tv_sec;
+
+	return ts.tv_sec;
+}
+
+time_t
+time(time_t *tloc)
+{
+	time_t		r;
+	int64_t		start;
+
+	if (!_init_time())
+		return original_time(tloc);
+
+	if (_slow_path()) {
+		start = _enter(STATS_TIME);
+		r = _time_slow(tloc);
+		_leave(STATS_TIME, start);
+		return r;
+	}
+
+	r = original_time(tloc);
+	if (r == -1)
+		return r;
+
+	r += _mode_diff(&state, r);
+	if (tloc)
+		*tloc = r;
+
+	DPRINTF("time date returned: %s\n", asctime(localtime(&r)));
+
+	return r;
+}
+#endif
+
+#ifdef OVERRIDE_TIMESPEC_GET
+int
+timespec_get(struct timespec *ts, int base)
+{
+	int64_t	start;
+	int	r;
+
+	if (!_init_time())
+		return original_timespec_get(ts, base);
+
+	start = _enter(STATS_TIMESPEC_GET);
+	r = original_timespec_get(ts, base);
+	if (r == TIME_UTC)
+		_shift_timespec(RECORD_TIMESPEC_GET, CLOCK_REALTIME, ts);
+	_leave(STATS_TIMESPEC_GET, start);
+
+	return r;
+}
+#endif
+
+#ifdef OVERRIDE_FTIME
+int
+ftime(struct timeb *tp)
+{
+	struct timespec	ts;
+	int64_t		start;
+	int		r;
+
+	if (!_init_time())
+		return original_ftime(tp);
+
+	start = _enter(STATS_FTIME);
+	r = original_ftime(tp);
+	if (r == 0) {
+		ts.tv_sec = tp->time;
+		ts.tv_nsec = tp->millitm * 1000000L;
+		_shift_timespec(RECORD_FTIME, CLOCK_REALTIME, &ts);
+		tp->time = ts.tv_sec;
+		tp->millitm = ts.tv_nsec / 1000000L;
+	}
+	_leave(STATS_FTIME, start);
+
+	return r;
+}
+#endif
+
+#ifdef OVERRIDE_DEADLINES
+/*
+ * A program which waits until a time it read from the shifted wall clock
+ * would otherwise return at once, or wait for years. The deadline is turned
+ * into one on the real clock with the time left until it, scaled back when
+ * the clocks are dilated.
+ */
+static int64_t
+_real_left(clockid_t clock_id, const struct timespec *deadline)
+{
+	struct timespec	now;
+	int64_t		left;
+
+	original_clock_gettime(clock_id, &now);
+	_program_time(clock_id, &now);
+
+	left = _ns(deadline) - _ns(&now);
+	return _dilated() ? _real_ns(left) : left;
+}
+
+static void
+_real_deadline(clockid_t clock_id, const struct timespec *deadline,
+    struct timespec *real)
+{
+	struct timespec now;
+
+	original_clock_gettime(clock_id, &now);
+	_timespec(_ns(&now) + _real_left(clock_id, deadline), real);
+}
+
+/* A duration the program waits for as a real one, a zero one stays zero. */
+static void
+_real_duration(const struct timespec *duration, struct timespec *real)
+{
+	int64_t ns;
+
+	if ((ns = _ns(duration)) > 0 && (ns = _real_ns(ns)) == 0)
+		ns = 1;
+	_timespec(ns, real);
+}
+
+static void
+_program_duration(struct timespec *duration)
+{
+	_timespec(_program_ns(_ns(duration)), duration);
+}
+
+/* The clocks the program sees differently than they are. */
+static int
+_translated_clock(clockid_t clock_id)
+{
+	return _realtime_clock(clock_id) ||
+	    ((_dilated() || _simulated()) && _monotonic_clock(clock_id) != -1);
+}
+
+/*
+ * The clock of a condition variable or timer isn't known here, so a
+ * deadline is taken to be on the wall clock when it's closer to the shifted
+ * time than to the monotonic time, which are decades apart.
+ */
+static clockid_t
+_deadline_clock(const struct timespec *deadline)
+{
+	struct timespec	now, mono;
+	int64_t		d;
+
+	original_clock_gettime(CLOCK_REALTIME, &now);
+	_shift_realtime(&now);
+	original_clock_gettime(CLOCK_MONOTONIC, &mono);
+	_program_time(CLOCK_MONOTONIC, &mono);
+
+	d = _ns(deadline);
+	if (llabs(d - _ns(&now)) < llabs(d - _ns(&mono)))
+		return CLOCK_REALTIME;
+	return CLOCK_MONOTONIC;
+}
+
+/*
+ * With UNLUCKY_SIMULATE the library does the waiting, for left real
+ * nanoseconds, so it can skip it. It's done in slices: wait() waits at most
+ * the given number of nanoseconds and returns 0 if nothing happened, -1 if a
+ * signal interrupted it and 1 otherwise.
+ *
+ * When a signal ends the wait, signals are blocked in between the slices
+ * and wait() gets the mask of the caller to wait with, like ppoll() takes
+ * it. A signal which comes while the library keeps count is then caught by
+ * the next slice, or found pending before it, instead of being handled
+ * while nobody looks. Otherwise the mask is NULL.
+ *
+ * Returns what wait() last did, or 0 if the deadline passed, and what was
+ * left of it in *rest. After -1 errno is EINTR.
+ */
+static int
+_simulate_slices(int64_t left, int (*wait)(void *, int64_t, const sigset_t *),
+    void *arg, int interruptible, int64_t *rest)
+{
+	sigset_t	 all, caller, *mask = NULL;
+	int64_t		 deadline;
+	int		 r = 0, saved;
+
+	if (interruptible) {
+		sigfillset(&all);
+		pthread_sigmask(SIG_BLOCK, &all, &caller);
+		mask = &caller;
+	}
+
+	deadline = simulate_begin(left > 0 ? left : 0, mask);
+	while ((left = simulate_left(deadline)) > 0) {
+		if (mask != NULL && simulate_signalled(mask)) {
+			r = -1;
+			break;
+		}
+		if ((r = wait(arg, left < SIMULATE_SLICE ? left : SIMULATE_SLICE,
+		    mask)))
+			break;
+	}
+	simulate_end();
+
+	saved = r == -1 ? EINTR : errno;
+	if (mask != NULL)
+		pthread_sigmask(SIG_SETMASK, mask, NULL);
+	errno = saved;
+
+	if (rest != NULL)
+		*rest = left > 0 ? left : 0;
+	return r;
+}
+
+static int
+_sleep_slice(void *arg, int64_t ns, const sigset_t *mask)
+{
+	struct timespec	ts;
+
+	_timespec(ns, &ts);
+	return ppoll(NULL, 0, &ts, mask) == -1 && errno == EINTR ? -1 : 0;
+}
+
+/*
+ * A sleep, which a signal interrupts. Returns what was left of it then, in
+ * the nanoseconds of the program, or 0.
+ */
+static int64_t
+_simulate_sleep(int64_t left)
+{
+	int64_t	rest;
+
+	if (left <= 0 || !_simulate_slices(left, _sleep_slice, NULL, 1, &rest))
+		return 0;
+
+	return rest > 0 ? _program_ns(rest) : 1;
+}
+
+/* The real time on clock_id ns from now. */
+static void
+_real_after(clockid_t clock_id, int64_t ns, struct timespec *at)
+{
+	original_clock_gettime(clock_id, at);
+	_timespec(_ns(at) + ns, at);
+}
+
+struct cond_wait {
+	pthread_cond_t	*cond;
+	pthread_mutex_t	*mutex;
+	clockid_t	 clock_id;
+	int		 r;
+};
+
+static int
+_cond_slice(void *arg, int64_t ns, const sigset_t *mask)
+{
+	struct cond_wait	*w = arg;
+	struct timespec		 at;
+
+	_real_after(w->clock_id, ns, &at);
+	w->r = original_pthread_cond_timedwait(w->cond, w->mutex, &at);
+	return w->r != ETIMEDOUT;
+}
+
+static int
+_cond_clock_slice(void *arg, int64_t ns, const sigset_t *mask)
+{
+	struct cond_wait	*w = arg;
+	struct timespec		 at;
+
+	_real_after(w->clock_id, ns, &at);
+	w->r = original_pthread_cond_clockwait(w->cond, w->mutex, w->clock_id, &at);
+	return w->r != ETIMEDOUT;
+}
+
+struct sem_wait {
+	sem_t		*sem;
+	clockid_t	 clock_id;
+	int		 r;
+};
+
+/*
+ * There's no sem_timedwait() which takes a mask, so a signal which comes
+ * just before the semaphore is waited for is only handled.
+ */
+static int
+_sem_slice(void *arg, int64_t ns, const sigset_t *mask)
+{
+	struct sem_wait	*w = arg;
+	struct timespec	 at;
+	sigset_t	 all;
+	int		 saved;
+
+	_real_after(w->clock_id, ns, &at);
+	pthread_sigmask(SIG_SETMASK, mask, &all);
+	if (w->clock_id == CLOCK_REALTIME)
+		w->r = original_sem_timedwait(w->sem, &at);
+	else
+		w->r = original_sem_clockwait(w->sem, w->clock_id, &at);
+	saved = errno;
+	pthread_sigmask(SIG_SETMASK, &all, NULL);
+	errno = saved;
+
+	if (w->r == 0)
+		return 1;
+	return errno == EINTR ? -1 : errno != ETIMEDOUT;
+}
+
+int
+clock_nanosleep(clockid_t clock_id, int flags, const struct timespec *request,
+    struct timespec *remain)
+{
+	struct timespec	real;
+	int64_t		ns;
+	int		r;
+
+	if (!_init_time() || !_translated_clock(clock_id))
+		return original_clock_nanosleep(clock_id, flags, request, remain);
+
+	if (_simulated()) {
+		if (flags & TIMER_ABSTIME)
+			return _simulate_sleep(_real_left(clock_id, request)) ?
+			    EINTR : 0;
+		if ((ns = _simulate_sleep(_real_ns(_ns(request)))) == 0)
+			return 0;
+		if (remain != NULL)
+			_timespec(ns, remain);
+		return EINTR;
+	}
+
+	if (flags & TIMER_ABSTIME) {
+		_real_deadline(clock_id, request, &real);
+		return original_clock_nanosleep(clock_id, flags, &real, remain);
+	}
+
+	if (!_dilated())
+		return original_clock_nanosleep(clock_id, flags, request, remain);
+
+	_real_duration(request, &real);
+	r = original_clock_nanosleep(clock_id, flags, &real, remain);
+	if (r == EINTR && remain != NULL)
+		_program_duration(remain);
+
+	return r;
+}
+
+int
+pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+    const struct timespec *abstime)
+{
+	struct cond_wait	w = { cond, mutex };
+	struct timespec		real;
+
+	if (!_init_time() || !_translated_clock(w.clock_id = _deadline_clock(abstime)))
+		return original_pthread_cond_timedwait(cond, mutex, abstime);
+
+	if (_simulated())
+		return _simulate_slices(_real_left(w.clock_id, abstime),
+		    _cond_slice, &w, 0, NULL) ? w.r : ETIMEDOUT;
+
+	_real_deadline(w.clock_id, abstime, &real);
+	return original_pthread_cond_timedwait(cond, mutex, &real);
+}
+
+int
+pthread_cond_clockwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+    clockid_t clock_id, const struct timespec *abstime)
+{
+	struct cond_wait	w = { cond, mutex, clock_id };
+	struct timespec		real;
+
+	if (original_pthread_cond_clockwait == NULL)
+		return ENOSYS;
+	if (!_init_time() || !_translated_clock(clock_id))
+		return original_pthread_cond_clockwait(cond, mutex, clock_id, abstime);
+
+	if (_simulated())
+		return _simulate_slices(_real_left(clock_id, abstime),
+		    _cond_clock_slice, &w, 0, NULL) ? w.r : ETIMEDOUT;
+
+	_real_deadline(clock_id, abstime, &real);
+	return original_pthread_cond_clockwait(cond, mutex, clock_id, &real);
+}
+
+int
+sem_timedwait(sem_t *sem, const struct timespec *abstime)
+{
+	struct sem_wait	w = { sem, CLOCK_REALTIME };
+	struct timespec	real;
+	int		r;
+
+	if (!_init_time())
+		return original_sem_timedwait(sem, abstime);
+
+	if (_simulated()) {
+		if ((r = _simulate_slices(_real_left(CLOCK_REALTIME, abstime),
+		    _sem_slice, &w, 1, NULL)))
+			return r == -1 ? -1 : w.r;
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	_real_deadline(CLOCK_REALTIME, abstime, &real);
+	return original_sem_timedwait(sem, &real);
+}
+
+int
+sem_clockwait(sem_t *sem, clockid_t clock_id, const struct timespec *abstime)
+{
+	struct sem_wait	w = { sem, clock_id };
+	struct timespec	real;
+	int		r;
+
+	if (original_sem_clockwait == NULL) {
+		errno = ENOSYS;
+		return -1;
+	}
+	if (!_init_time() || !_translated_clock(clock_id))
+		return original_sem_clockwait(sem, clock_id, abstime);
+
+	if (_simulated()) {
+		if ((r = _simulate_slices(_real_left(clock_id, abstime),
+		    _sem_slice, &w, 1, NULL)))
+			return r == -1 ? -1 : w.r;
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	_real_deadline(clock_id, abstime, &real);
+	return original_sem_clockwait(sem, clock_id, &real);
+}
+
+/*
+ * The new value of a timer as a real one: an absolute first expiration on a
+ * translated clock is moved, and durations are scaled back when dilated.
+ */
+static void
+_real_itimerspec(int abstime, const struct itimerspec *value,
+    struct itimerspec *real)
+{
+	clockid_t clock_id;
+
+	*real = *value;
+	if (value->it_value.tv_sec == 0 && value->it_value.tv_nsec == 0)
+		return;
+
+	if (abstime) {
+		if (_translated_clock(clock_id = _deadline_clock(&value->it_value)))
+			_real_deadline(clock_id, &value->it_value, &real->it_value);
+	} else if (_dilated()) {
+		_real_duration(&value->it_value, &real->it_value);
+	}
+	if (_dilated())
+		_real_duration(&value->it_interval, &real->it_interval);
+}
+
+static void
+_program_itimerspec(struct itimerspec *value)
+{
+	if (_dilated()) {
+		_program_duration(&value->it_value);
+		_program_duration(&value->it_interval);
+	}
+}
+
+int
+timer_settime(timer_t timerid, int flags, const struct itimerspec *value,
+    struct itimerspec *ovalue)
+{
+	struct itimerspec	real;
+	int			r;
+
+	if (!_init_time() || value == NULL)
+		return original_timer_settime(timerid, flags, value, ovalue);
+
+	_real_itimerspec(flags & TIMER_ABSTIME, value, &real);
+	r = original_timer_settime(timerid, flags, &real, ovalue);
+	if (r == 0 && ovalue != NULL)
+		_program_itimerspec(ovalue);
+
+	return r;
+}
+
+#ifdef __linux__
+int
+timerfd_settime(int fd, int flags, const struct itimerspec *value,
+    struct itimerspec *ovalue)
+{
+	struct itimerspec	real;
+	int			r;
+
+	if (!_init_time() || value == NULL)
+		return original_timerfd_settime(fd, flags, value, ovalue);
+
+	_real_itimerspec(flags & TFD_TIMER_ABSTIME, value, &real);
+	r = original_timerfd_settime(fd, flags, &real, ovalue);
+	if (r == 0 && ovalue != NULL)
+		_program_itimerspec(ovalue);
+
+	return r;
+}
+#endif
+#endif
+
+#ifdef OVERRIDE_SLEEPS
+/*
+ * Sleeps and timeouts are only scaled when the clocks are dilated, what's
+ * left of them is scaled back. With UNLUCKY_SIMULATE a sleep is skipped
+ * once every thread waits, and a wait for a file descriptor polls it in
+ * slices until then.
+ */
+static int
+_real_ms(int ms)
+{
+	int64_t real;
+
+	if (ms <= 0)
+		return ms;
+	real = _real_ns(ms * 1000000LL) / 1000000;
+
+	return real > 0 ? real : 1;
+}
+
+/* Milliseconds to wait for at most ns nanoseconds, at least one. */
+static int
+_slice_ms(int64_t ns)
+{
+	return ns < 1000000 ? 1 : ns / 1000000;
+}
+
+struct poll_wait {
+	struct pollfd	*fds;
+	nfds_t		 nfds;
+	int		 r;
+};
+
+static int
+_poll_slice(void *arg, int64_t ns, const sigset_t *mask)
+{
+	struct poll_wait	*w = arg;
+	struct timespec		 ts;
+
+	_timespec(ns, &ts);
+	if ((w->r = ppoll(w->fds, w->nfds, &ts, mask)) == -1 && errno == EINTR)
+		return -1;
+	return w->r != 0;
+}
+
+struct select_wait {
+	int		 nfds;
+	fd_set		*fds[3];
+	fd_set		 saved[3];
+	int		 r;
+};
+
+static int
+_select_slice(void *arg, int64_t ns, const sigset_t *mask)
+{
+	struct select_wait	*w = arg;
+	struct timespec		 ts;
+	int			 i;
+
+	for (i = 0; i < 3; i++)
+		if (w->fds[i] != NULL)
+			*w->fds[i] = w->saved[i];
+	_timespec(ns, &ts);
+
+	w->r = pselect(w->nfds, w->fds[0], w->fds[1], w->fds[2], &ts, mask);
+	if (w->r == -1 && errno == EINTR)
+		return -1;
+	return w->r != 0;
+}
+
+#ifdef __linux__
+struct epoll_wait {
+	int			 epfd;
+	struct epoll_event	*events;
+	int			 maxevents;
+	int			 r;
+};
+
+static int
+_epoll_slice(void *arg, int64_t ns, const sigset_t *mask)
+{
+	struct epoll_wait *w = arg;
+
+	w->r = epoll_pwait(w->epfd, w->events, w->maxevents, _slice_ms(ns),
+	    mask);
+	if (w->r == -1 && errno == EINTR)
+		return -1;
+	return w->r != 0;
+}
+#endif
+
+int
+nanosleep(const struct timespec *request, struct timespec *remain)
+{
+	struct timespec	real;
+	int64_t		ns;
+	int		r;
+
+	if (!_init_time() || (!_dilated() && !_simulated()))
+		return original_nanosleep(request, remain);
+
+	if (_simulated()) {
+		if ((ns = _simulate_sleep(_real_ns(_ns(request)))) == 0)
+			return 0;
+		if (remain != NULL)
+			_timespec(ns, remain);
+		errno = EINTR;
+		return -1;
+	}
+
+	_real_duration(request, &real);
+	r = original_nanosleep(&real, remain);
+	if (r == -1 && errno == EINTR && remain != NULL)
+		_program_duration(remain);
+
+	return r;
+}
+
+int
+usleep(useconds_t usec)
+{
+	int64_t real;
+
+	if (!_init_time() || (!_dilated() && !_simulated()) || usec == 0)
+		return original_usleep(usec);
+
+	if (_simulated()) {
+		if (_simulate_sleep(_real_ns(usec * 1000LL)) == 0)
+			return 0;
+		errno = EINTR;
+		return -1;
+	}
+
+	if ((real = _real_ns(usec * 1000LL) / 1000) == 0)
+		real = 1;
+	return original_usleep(real);
+}
+
+unsigned int
+sleep(unsigned int seconds)
+{
+	struct timespec	request, remain;
+
+	if (!_init_time() || (!_dilated() && !_simulated()))
+		return original_sleep(seconds);
+
+	if (_simulated())
+		return (_simulate_sleep(_real_ns(seconds * 1000000000LL)) +
+		    999999999) / 1000000000;
+
+	request.tv_sec = seconds;
+	request.tv_nsec = 0;
+	_real_duration(&request, &request);
+	if (original_nanosleep(&request, &remain) == 0)
+		return 0;
+
+	_program_duration(&remain);
+	return remain.tv_sec + (remain.tv_nsec > 0);
+}
+
+int
+poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	struct poll_wait	w = { fds, nfds };
+	int			r;
+
+	if (!_init_time() || (!_dilated() && !_simulated()))
+		return original_poll(fds, nfds, timeout);
+
+	if (_simulated() && timeout > 0) {
+		if ((r = _simulate_slices(_real_ns(timeout * 1000000LL),
+		    _poll_slice, &w, 1, NULL)) == -1)
+			return -1;
+		return r ? w.r : 0;
+	}
+
+	return original_poll(fds, nfds, _real_ms(timeout));
+}
+
+int
+select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+    struct timeval *timeout)
+{
+	struct select_wait	w = { nfds, { readfds, writefds, exceptfds } };
+	struct timespec		ts;
+	int			i, r;
+
+	if (!_init_time() || (!_dilated() && !_simulated()) || timeout == NULL)
+		return original_select(nfds, readfds, writefds, exceptfds, timeout);
+
+	ts.tv_sec = timeout->tv_sec;
+	ts.tv_nsec = timeout->tv_usec * 1000;
+
+	if (_simulated() && _ns(&ts) > 0) {
+		for (i = 0; i < 3; i++)
+			if (w.fds[i] != NULL)
+				w.saved[i] = *w.fds[i];
+		if ((r = _simulate_slices(_real_ns(_ns(&ts)), _select_slice, &w,
+		    1, NULL)))
+			return r == -1 ? -1 : w.r;
+		for (i = 0; i < 3; i++)
+			if (w.fds[i] != NULL)
+				FD_ZERO(w.fds[i]);
+		timeout->tv_sec = 0;
+		timeout->tv_usec = 0;
+		return 0;
+	}
+
+	_real_duration(&ts, &ts);
+	timeout->tv_sec = ts.tv_sec;
+	timeout->tv_usec = (ts.tv_nsec + 999) / 1000;
+
+	r = original_select(nfds, readfds, writefds, exceptfds, timeout);
+
+	/* What's left, as Linux leaves it. */
+	ts.tv_sec = timeout->tv_sec;
+	ts.tv_nsec = timeout->tv_usec * 1000;
+	_program_duration(&ts);
+	timeout->tv_sec = ts.tv_sec;
+	timeout->tv_usec = ts.tv_nsec / 1000;
+
+	return r;
+}
+
+#ifdef __linux__
+int
+epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	struct epoll_wait	w = { epfd, events, maxevents };
+	int			r;
+
+	if (!_init_time() || (!_dilated() && !_simulated()))
+		return original_epoll_wait(epfd, events, maxevents, timeout);
+
+	if (_simulated() && timeout > 0) {
+		if ((r = _simulate_slices(_real_ns(timeout * 1000000LL),
+		    _epoll_slice, &w, 1, NULL)) == -1)
+			return -1;
+		return r ? w.r : 0;
+	}
+
+	return original_epoll_wait(epfd, events, maxevents, _real_ms(timeout));
+}
+#endif
+#endif
+
+#ifdef OVERRIDE_SYSCALL
+/*
+ * The six arguments are taken whether they were passed or not, like libc's
+ * syscall() does. This can be called by the constructor of another library
+ * before ours ran, and is called by the library itself, so it only resolves
+ * the original and leaves the state alone. Without UNLUCKY_VDSO the call is
+ * just passed on.
+ */
+long
+syscall(long number, ...)
+{
+	va_list	ap;
+	long	a[6];
+	int	i;
+
+	if (__builtin_expect(original_syscall == NULL, 0))
+		_resolve_originals();
+
+	va_start(ap, number);
+	for (i = 0; i < 6; i++)
+		a[i] = va_arg(ap, long);
+	va_end(ap);
+
+	if (__builtin_expect(_raw_clocks, 0)) {
+		switch (number) {
+		case SYS_clock_gettime:
+			return clock_gettime((clockid_t)a[0], (struct timespec *)a[1]);
+		case SYS_gettimeofday:
+			return gettimeofday((struct timeval *)a[0], (timezone_ptr_t)a[1]);
+#ifdef SYS_time
+		case SYS_time:
+			return time((time_t *)a[0]);
+#endif
+		}
+	}
+
+	return original_syscall(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+#endif
+
+#ifdef OVERRIDE_FILES
+/*
+ * Programs like make compare the times of files with the time, so those are
+ * shifted like the wall clock, without the virtual clock: a file written now
+ * is as old as the shifted time says. Times the program sets are turned back
+ * into real ones.
+ *
+ * Older files are shifted as the clock is now, not as it was when they were
+ * written, which isn't known. The time UNLUCKY_SIMULATE skipped since makes
+ * them that much newer, and UNLUCKY_DILATION scales their age as if the
+ * clock had run at that rate since start_time, also before the program did.
+ */
+static inline void
+_program_file_time(struct timespec *tp)
+{
+	if (_slow_path())
+		_shift_wall(tp);
+	else
+		tp->tv_sec += _mode_diff(&state, tp->tv_sec);
+}
+
+static int
+_program_stat(int r, struct timespec *atim, struct timespec *mtim,
+    struct timespec *ctim)
+{
+	if (r == 0) {
+		_program_file_time(atim);
+		_program_file_time(mtim);
+		_program_file_time(ctim);
+	}
+
+	return r;
+}
+
+#define STAT_TIMES(sb)	&(sb)->st_atim, &(sb)->st_mtim, &(sb)->st_ctim
+
+/*
+ * The real time the program sees as tp, found by taking the error of a guess
+ * off it. That's exact at once when only the diff is added, and gains almost
+ * two digits a step when leap_second takes a second off every minute.
+ */
+#define FILE_TIME_STEPS	16
+
+static void
+_real_file_time(struct timespec *tp)
+{
+	struct timespec	real = *tp, shifted;
+	int		i;
+
+	if (tp->tv_nsec == UTIME_NOW || tp->tv_nsec == UTIME_OMIT)
+		return;
+
+	for (i = 0; i < FILE_TIME_STEPS; i++) {
+		shifted = real;
+		_shift_wall(&shifted);
+		if (shifted.tv_sec == tp->tv_sec && shifted.tv_nsec == tp->tv_nsec)
+			break;
+		if (_dilated() || _simulated())
+			_timespec(_ns(&real) - _real_ns(_ns(&shifted) - _ns(tp)), &real);
+		else
+			real.tv_sec -= shifted.tv_sec - tp->tv_sec;
+	}
+	*tp = real;
+}
+
+/* Before 2.33 glibc linked these into the programs, calling __xstat(). */
+#if !defined(__GLIBC__) || __GLIBC_PREREQ(2, 33)
+int
+stat(const char *path, struct stat *sb)
+{
+	if (!_init_time())
+		return original_stat(path, sb);
+
+	return _program_stat(original_stat(path, sb), STAT_TIMES(sb));
+}
+
+int
+lstat(const char *path, struct stat *sb)
+{
+	if (!_init_time())
+		return original_lstat(path, sb);
+
+	return _program_stat(original_lstat(path, sb), STAT_TIMES(sb));
+}
+
+int
+fstat(int fd, struct stat *sb)
+{
+	if (!_init_time())
+		return original_fstat(fd, sb);
+
+	return _program_stat(original_fstat(fd, sb), STAT_TIMES(sb));
+}
+
+int
+fstatat(int fd, const char *path, struct stat *sb, int flag)
+{
+	if (!_init_time())
+		return original_fstatat(fd, path, sb, flag);
+
+	return _program_stat(original_fstatat(fd, path, sb, flag), STAT_TIMES(sb));
+}
+#endif
+
+#ifdef UNLUCKY_STATX
+static void
+_program_statx_time(struct statx_timestamp *sx)
+{
+	struct timespec ts;
+
+	ts.tv_sec = sx->tv_sec;
+	ts.tv_nsec = sx->tv_nsec;
+	_program_file_time(&ts);
+	sx->tv_sec = ts.tv_sec;
+	sx->tv_nsec = ts.tv_nsec;
+}
+
+int
+statx(int fd, const char *path, int flag, unsigned int mask, struct statx *sx)
+{
+	int r;
+
+	if (!_init_time())
+		return original_statx(fd, path, flag, mask, sx);
+
+	if ((r = original_statx(fd, path, flag, mask, sx)) != 0)
+		return r;
+
+	if (sx->stx_mask & STATX_ATIME)
+		_program_statx_time(&sx->stx_atime);
+	if (sx->stx_mask & STATX_BTIME)
+		_program_statx_time(&sx->stx_btime);
+	if (sx->stx_mask & STATX_CTIME)
+		_program_statx_time(&sx->stx_ctime);
+	if (sx->stx_mask & STATX_MTIME)
+		_program_statx_time(&sx->stx_mtime);
+
+	return r;
+}
+#endif
+
+#ifdef UNLUCKY_STAT64
+#if __GLIBC_PREREQ(2, 33)
+int
+stat64(const char *path, struct stat64 *sb)
+{
+	if (!_init_time())
+		return original_stat64(path, sb);
+
+	return _program_stat(original_stat64(path, sb), STAT_TIMES(sb));
+}
+
+int
+lstat64(const char *path, struct stat64 *sb)
+{
+	if (!_init_time())
+		return original_lstat64(path, sb);
+
+	return _program_stat(original_lstat64(path, sb), STAT_TIMES(sb));
+}
+
+int
+fstat64(int fd, struct stat64 *sb)
+{
+	if (!_init_time())
+		return original_fstat64(fd, sb);
+
+	return _program_stat(original_fstat64(fd, sb), STAT_TIMES(sb));
+}
+
+int
+fstatat64(int fd, const char *path, struct stat64 *sb, int flag)
+{
+	if (!_init_time())
+		return original_fstatat64(fd, path, sb, flag);
+
+	return _program_stat(original_fstatat64(fd, path, sb, flag),
+	    STAT_TIMES(sb));
+}
+#endif
+
+int
+__xstat(int ver, const char *path, struct stat *sb)
+{
+	if (!_init_time())
+		return original_xstat(ver, path, sb);
+
+	return _program_stat(original_xstat(ver, path, sb), STAT_TIMES(sb));
+}
+
+int
+__lxstat(int ver, const char *path, struct stat *sb)
+{
+	if (!_init_time())
+		return original_lxstat(ver, path, sb);
+
+	return _program_stat(original_lxstat(ver, path, sb), STAT_TIMES(sb));
+}
+
+int
+__fxstat(int ver, int fd, struct stat *sb)
+{
+	if (!_init_time())
+		return original_fxstat(ver, fd, sb);
+
+	return _program_stat(original_fxstat(ver, fd, sb), STAT_TIMES(sb));
+}
+
+int
+__fxstatat(int ver, int fd, const char *path, struct stat *sb, int flag)
+{
+	if (!_init_time())
+		return original_fxstatat(ver, fd, path, sb, flag);
+
+	return _program_stat(original_fxstatat(ver, fd, path, sb, flag),
+	    STAT_TIMES(sb));
+}
+
+int
+__xstat64(int ver, const char *path, struct stat64 *sb)
+{
+	if (!_init_time())
+		return original_xstat64(ver, path, sb);
+
+	return _program_stat(original_xstat64(ver, path, sb), STAT_TIMES(sb));
+}
+
+int
+__lxstat64(int ver, const char *path, struct stat64 *sb)
+{
+	if (!_init_time())
+		return original_lxstat64(ver, path, sb);
+
+	return _program_stat(original_lxstat64(ver, path, sb), STAT_TIMES(sb));
+}
+
+int
+__fxstat64(int ver, int fd, struct stat64 *sb)
+{
+	if (!_init_time())
+		return original_fxstat64(ver, fd, sb);
+
+	return _program_stat(original_fxstat64(ver, fd, sb), STAT_TIMES(sb));
+}
+
+int
+__fxstatat64(int ver, int fd, const char *path, struct stat64 *sb, int flag)
+{
+	if (!_init_time())
+		return original_fxstatat64(ver, fd, path, sb, flag);
+
+	return _program_stat(original_fxstatat64(ver, fd, path, sb, flag),
+	    STAT_TIMES(sb));
+}
+#endif
+
+int
+utimensat(int fd, const char *path, const struct timespec times[2], int flag)
+{
+	struct timespec real[2];
+
+	if (!_init_time() || times == NULL)
+		return original_utimensat(fd, path, times, flag);
+
+	real[0] = times[0];
+	real[1] = times[1];
+	_real_file_time(&real[0]);
+	_real_file_time(&real[1]);
+
+	return original_utimensat(fd, path, real, flag);
+}
+
+int
+futimens(int fd, const struct timespec times[2])
+{
+	struct timespec real[2];
+
+	if (!_init_time() || times == NULL)
+		return original_futimens(fd, times);
+
+	real[0] = times[0];
+	real[1] = times[1];
+	_real_file_time(&real[0]);
+	_real_file_time(&real[1]);
+
+	return original_futimens(fd, real);
+}
+
+int
+utimes(const char *path, const struct timeval times[2])
+{
+	struct timeval	real[2];
+	struct timespec	ts;
+	int		i;
+
+	if (!_init_time() || times == NULL)
+		return original_utimes(path, times);
+
+	for (i = 0; i < 2; i++) {
+		ts.tv_sec = times[i].tv_sec;
+		ts.tv_nsec = times[i].tv_usec * 1000;
+		_real_file_time(&ts);
+		real[i].tv_sec = ts.tv_sec;
+		real[i].tv_usec = ts.tv_nsec / 1000;
+	}
+
+	return original_utimes(path, real);
+}
+
+int
+utime(const char *path, const struct utimbuf *times)
+{
+	struct utimbuf	real;
+	struct timespec	ts;
+
+	if (!_init_time() || times == NULL)
+		return original_utime(path, times);
+
+	ts.tv_sec = times->actime;
+	ts.tv_nsec = 0;
+	_real_file_time(&ts);
+	real.actime = ts.tv_sec;
+	ts.tv_sec = times->modtime;
+	ts.tv_nsec = 0;
+	_real_file_time(&ts);
+	real.modtime = ts.tv_sec;
+
+	return original_utime(path, &real);
+}
+#endif
+
+#ifdef OVERRIDE_SPAWN
+/*
+ * Programs started without a fork get the state as well. posix_spawn(3) gets
+ * a copy of envp with it. system(3) and popen(3) would pass on our
+ * environment, so they're done here with posix_spawn(3) and a copy of that.
+ */
+static char **
+_spawn_env(char *const envp[])
+{
+	char	**env;
+	size_t	  i, n;
+
+	if (_time_entered || envp == NULL)
+		return NULL;
+	pthread_once(&_time_once, _init_once);
+
+	for (n = 0; envp[n] != NULL; n++)
+		;
+	if ((env = malloc((n + 3) * sizeof(*env))) == NULL)
+		return NULL;
+
+	for (n = 0, i = 0; envp[i] != NULL; i++)
+		if (strncmp(envp[i], UNLUCKY_STATE_ENV "=", sizeof(UNLUCKY_STATE_ENV)) != 0 &&
+		    (_timeline_env[0] == '\0' ||
+		    strncmp(envp[i], "UNLUCKY_TIMELINE=", 17) != 0))
+			env[n++] = envp[i];
+	env[n++] = _state_env;
+	if (_timeline_env[0] != '\0')
+		env[n++] = _timeline_env;
+	env[n] = NULL;
+
+	return env;
+}
+
+int
+posix_spawn(pid_t *pid, const char *path,
+    const posix_spawn_file_actions_t *actions, const posix_spawnattr_t *attr,
+    char *const argv[], char *const envp[])
+{
+	char	**env;
+	int	  r;
+
+	if ((env = _spawn_env(envp)) == NULL)
+		return original_posix_spawn(pid, path, actions, attr, argv, envp);
+
+	r = original_posix_spawn(pid, path, actions, attr, argv, env);
+	free(env);
+
+	return r;
+}
+
+int
+posix_spawnp(pid_t *pid, const char *file,
+    const posix_spawn_file_actions_t *actions, const posix_spawnattr_t *attr,
+    char *const argv[], char *const envp[])
+{
+	char	**env;
+	int	  r;
+
+	if ((env = _spawn_env(envp)) == NULL)
+		return original_posix_spawnp(pid, file, actions, attr, argv, envp);
+
+	r = original_posix_spawnp(pid, file, actions, attr, argv, env);
+	free(env);
+
+	return r;
+}
+
+#define SHELL	"/bin/sh"
+
+/* The status of a child, once it exited, or -1. */
+static int
+_wait_child(pid_t pid)
+{
+	int status;
+
+	while (waitpid(pid, &status, 0) == -1)
+		if (errno != EINTR)
+			return -1;
+
+	return status;
+}
+
+/* Like libc's, SIGINT and SIGQUIT are ignored while the command runs. */
+int
+system(const char *command)
+{
+	struct sigaction	 ignore, intr, quit;
+	posix_spawnattr_t	 attr;
+	sigset_t		 chld, old, dfl;
+	char			*argv[] = { "sh", "-c", (char *)command, NULL };
+	char			**env;
+	pid_t			 pid;
+	int			 status;
+
+	if (command == NULL || (env = _spawn_env(environ)) == NULL)
+		return original_system(command);
+
+	memset(&ignore, 0, sizeof(ignore));
+	ignore.sa_handler = SIG_IGN;
+	sigemptyset(&ignore.sa_mask);
+	sigaction(SIGINT, &ignore, &intr);
+	sigaction(SIGQUIT, &ignore, &quit);
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld, &old);
+
+	sigemptyset(&dfl);
+	if (intr.sa_handler != SIG_IGN)
+		sigaddset(&dfl, SIGINT);
+	if (quit.sa_handler != SIG_IGN)
+		sigaddset(&dfl, SIGQUIT);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigdefault(&attr, &dfl);
+	posix_spawnattr_setsigmask(&attr, &old);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF |
+	    POSIX_SPAWN_SETSIGMASK);
+
+	if (original_posix_spawn(&pid, SHELL, NULL, &attr, argv, env) != 0)
+		status = 127 << 8;
+	else
+		status = _wait_child(pid);
+
+	posix_spawnattr_destroy(&attr);
+	free(env);
+	sigaction(SIGINT, &intr, NULL);
+	sigaction(SIGQUIT, &quit, NULL);
+	sigprocmask(SIG_SETMASK, &old, NULL);
+
+	return status;
+}
+
+/* The children of popen(3), which pclose(3) waits for. */
+struct popen_child {
+	struct popen_child	*next;
+	FILE			*f;
+	pid_t			 pid;
+};
+
+static struct popen_child	*_popen_children;
+static pthread_mutex_t		 _popen_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The pipes of the other children aren't inherited, as POSIX asks. */
+FILE *
+popen(const char *command, const char *type)
+{
+	posix_spawn_file_actions_t	 actions;
+	struct popen_child		*c, *o;
+	char				*argv[] = { "sh", "-c", (char *)command, NULL };
+	char				**env;
+	int				 fds[2], reading, r;
+
+	if ((type[0] != 'r' && type[0] != 'w') ||
+	    (type[1] != '\0' && strcmp(type + 1, "e") != 0) ||
+	    (env = _spawn_env(environ)) == NULL)
+		return original_popen(command, type);
+
+	reading = type[0] == 'r';
+	if ((c = malloc(sizeof(*c))) == NULL) {
+		free(env);
+		return NULL;
+	}
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		free(c);
+		free(env);
+		return NULL;
+	}
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, fds[reading],
+	    reading ? STDOUT_FILENO : STDIN_FILENO);
+
+	pthread_mutex_lock(&_popen_lock);
+	for (o = _popen_children; o != NULL; o = o->next)
+		posix_spawn_file_actions_addclose(&actions, fileno(o->f));
+	r = original_posix_spawn(&c->pid, SHELL, &actions, NULL, argv, env);
+	if (r == 0 && (c->f = fdopen(fds[!reading], type)) != NULL) {
+		if (type[1] == '\0')
+			fcntl(fds[!reading], F_SETFD, 0);
+		c->next = _popen_children;
+		_popen_children = c;
+	}
+	pthread_mutex_unlock(&_popen_lock);
+
+	posix_spawn_file_actions_destroy(&actions);
+	free(env);
+	close(fds[reading]);
+	if (r != 0) {
+		close(fds[!reading]);
+		free(c);
+		errno = r;
+		return NULL;
+	}
+	if (c->f == NULL) {
+		r = errno;
+		close(fds[!reading]);
+		_wait_child(c->pid);
+		free(c);
+		errno = r;
+		return NULL;
+	}
+
+	return c->f;
+}
+
+int
+pclose(FILE *f)
+{
+	struct popen_child	**p, *c = NULL;
+	int			  status;
+
+	pthread_mutex_lock(&_popen_lock);
+	for (p = &_popen_children; *p != NULL; p = &(*p)->next) {
+		if ((*p)->f == f) {
+			c = *p;
+			*p = c->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&_popen_lock);
+
+	if (c == NULL)
+		return original_pclose(f);
+
+	fclose(f);
+	status = _wait_child(c->pid);
+	free(c);
+
+	return status;
+}
+#endif
+
+#ifdef OVERRIDE_SIMULATE
+/*
+ * UNLUCKY_SIMULATE only skips ahead while every thread waits, so it has to
+ * know the threads there are and the waits without a deadline.
+ */
+struct thread_start {
+	void	*(*start)(void *);
+	void	*arg;
+};
+
+static void *
+_thread_start(void *arg)
+{
+	struct thread_start ts = *(struct thread_start *)arg;
+
+	free(arg);
+	simulate_thread_start();
+
+	return ts.start(ts.arg);
+}
+
+int
+pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+    void *(*start)(void *), void *arg)
+{
+	struct thread_start	*ts;
+	int			 r;
+
+	if (!_init_time() || !_simulated())
+		return original_pthread_create(thread, attr, start, arg);
+
+	if ((ts = malloc(sizeof(*ts))) == NULL)
+		return EAGAIN;
+	ts->start = start;
+	ts->arg = arg;
+
+	simulate_thread_create();
+	if ((r = original_pthread_create(thread, attr, _thread_start, ts)) != 0) {
+		simulate_thread_exit();
+		free(ts);
+	}
+
+	return r;
+}
+
+int
+pthread_join(pthread_t thread, void **retval)
+{
+	int r;
+
+	if (!_init_time() || !_simulated())
+		return original_pthread_join(thread, retval);
+
+	simulate_begin(SIMULATE_FOREVER, NULL);
+	r = original_pthread_join(thread, retval);
+	simulate_end();
+
+	return r;
+}
+
+int
+pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+	int r;
+
+	if (!_init_time() || !_simulated())
+		return original_pthread_cond_wait(cond, mutex);
+
+	simulate_begin(SIMULATE_FOREVER, NULL);
+	r = original_pthread_cond_wait(cond, mutex);
+	simulate_end();
+
+	return r;
+}
+
+int
+sem_wait(sem_t *sem)
+{
+	int r;
+
+	if (!_init_time() || !_simulated())
+		return original_sem_wait(sem);
 
-	_cleanup_time();
+	simulate_begin(SIMULATE_FOREVER, NULL);
+	r = original_sem_wait(sem);
+	simulate_end();
 
 	return r;
 }
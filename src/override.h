@@ -15,19 +15,189 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/timeb.h>
 #include <netinet/in.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <utime.h>
 
 
-typedef int (*gettimeofday_func_t)(struct timeval *tp, struct timezone *tzp);
-typedef int (*time_func_t)(time_t *t);
+/* glibc declares the second argument of gettimeofday() as void *. */
+#ifdef __GLIBC__
+typedef void *timezone_ptr_t;
+#else
+typedef struct timezone *timezone_ptr_t;
+#endif
+
+typedef int (*gettimeofday_func_t)(struct timeval *tp, timezone_ptr_t tzp);
+typedef time_t (*time_func_t)(time_t *t);
 typedef int (*clock_gettime_func_t)(clockid_t clock_id, struct timespec *tp);
+typedef int (*timespec_get_func_t)(struct timespec *ts, int base);
+typedef int (*ftime_func_t)(struct timeb *tp);
 typedef int (*connect_func_t)(int s, const struct sockaddr *name, socklen_t namelen);
 
-gettimeofday_func_t	original_gettimeofday;
-time_func_t		original_time;
-clock_gettime_func_t	original_clock_gettime;
+/*
+ * unlucky_clock.h reads the clock through original_clock_gettime as well,
+ * so it's exported under a name of the library's own.
+ */
+#define original_clock_gettime	unlucky_original_clock_gettime
+
+extern gettimeofday_func_t	original_gettimeofday;
+extern time_func_t		original_time;
+extern clock_gettime_func_t	original_clock_gettime;
+extern timespec_get_func_t	original_timespec_get;
+extern ftime_func_t		original_ftime;
+
+/* The functions which wait until a time on the wall clock. */
+typedef int (*clock_nanosleep_func_t)(clockid_t clock_id, int flags,
+    const struct timespec *request, struct timespec *remain);
+typedef int (*pthread_cond_timedwait_func_t)(pthread_cond_t *cond,
+    pthread_mutex_t *mutex, const struct timespec *abstime);
+typedef int (*pthread_cond_clockwait_func_t)(pthread_cond_t *cond,
+    pthread_mutex_t *mutex, clockid_t clock_id, const struct timespec *abstime);
+typedef int (*sem_timedwait_func_t)(sem_t *sem, const struct timespec *abstime);
+typedef int (*sem_clockwait_func_t)(sem_t *sem, clockid_t clock_id,
+    const struct timespec *abstime);
+typedef int (*timer_settime_func_t)(timer_t timerid, int flags,
+    const struct itimerspec *value, struct itimerspec *ovalue);
+typedef int (*timerfd_settime_func_t)(int fd, int flags,
+    const struct itimerspec *value, struct itimerspec *ovalue);
+
+extern clock_nanosleep_func_t		original_clock_nanosleep;
+extern pthread_cond_timedwait_func_t	original_pthread_cond_timedwait;
+extern pthread_cond_clockwait_func_t	original_pthread_cond_clockwait;
+extern sem_timedwait_func_t		original_sem_timedwait;
+extern sem_clockwait_func_t		original_sem_clockwait;
+extern timer_settime_func_t		original_timer_settime;
+extern timerfd_settime_func_t		original_timerfd_settime;
+
+/* The functions which wait for a while. */
+typedef int (*nanosleep_func_t)(const struct timespec *request, struct timespec *remain);
+typedef int (*usleep_func_t)(useconds_t usec);
+typedef unsigned int (*sleep_func_t)(unsigned int seconds);
+typedef int (*poll_func_t)(struct pollfd *fds, nfds_t nfds, int timeout);
+typedef int (*select_func_t)(int nfds, fd_set *readfds, fd_set *writefds,
+    fd_set *exceptfds, struct timeval *timeout);
+#ifdef __linux__
+struct epoll_event;
+typedef int (*epoll_wait_func_t)(int epfd, struct epoll_event *events,
+    int maxevents, int timeout);
+#endif
+
+extern nanosleep_func_t		original_nanosleep;
+extern usleep_func_t		original_usleep;
+extern sleep_func_t		original_sleep;
+extern poll_func_t		original_poll;
+extern select_func_t		original_select;
+#ifdef __linux__
+extern epoll_wait_func_t	original_epoll_wait;
+#endif
+
+/* The functions UNLUCKY_SIMULATE keeps track of threads and waits with. */
+typedef int (*pthread_create_func_t)(pthread_t *thread,
+    const pthread_attr_t *attr, void *(*start)(void *), void *arg);
+typedef int (*pthread_join_func_t)(pthread_t thread, void **retval);
+typedef int (*pthread_cond_wait_func_t)(pthread_cond_t *cond,
+    pthread_mutex_t *mutex);
+typedef int (*sem_wait_func_t)(sem_t *sem);
+
+extern pthread_create_func_t	original_pthread_create;
+extern pthread_join_func_t	original_pthread_join;
+extern pthread_cond_wait_func_t	original_pthread_cond_wait;
+extern sem_wait_func_t		original_sem_wait;
+
+/* Raw system calls, which UNLUCKY_VDSO shifts the clocks of. */
+typedef long (*syscall_func_t)(long number, ...);
+
+extern syscall_func_t		original_syscall;
+
+/* The ways to start a program without a fork, which get UNLUCKY_STATE too. */
+typedef int (*posix_spawn_func_t)(pid_t *pid, const char *path,
+    const posix_spawn_file_actions_t *actions, const posix_spawnattr_t *attr,
+    char *const argv[], char *const envp[]);
+typedef int (*system_func_t)(const char *command);
+typedef FILE *(*popen_func_t)(const char *command, const char *type);
+typedef int (*pclose_func_t)(FILE *f);
+
+extern posix_spawn_func_t	original_posix_spawn;
+extern posix_spawn_func_t	original_posix_spawnp;
+extern system_func_t		original_system;
+extern popen_func_t		original_popen;
+extern pclose_func_t		original_pclose;
+
+/*
+ * The functions which read or set the times of files. glibc before 2.33
+ * had programs call __xstat() and friends instead of stat(), and with
+ * _FILE_OFFSET_BITS=64 the 64 versions.
+ */
+typedef int (*stat_func_t)(const char *path, struct stat *sb);
+typedef int (*fstat_func_t)(int fd, struct stat *sb);
+typedef int (*fstatat_func_t)(int fd, const char *path, struct stat *sb,
+    int flag);
+typedef int (*utimensat_func_t)(int fd, const char *path,
+    const struct timespec times[2], int flag);
+typedef int (*futimens_func_t)(int fd, const struct timespec times[2]);
+typedef int (*utimes_func_t)(const char *path, const struct timeval times[2]);
+typedef int (*utime_func_t)(const char *path, const struct utimbuf *times);
+
+extern stat_func_t		original_stat;
+extern stat_func_t		original_lstat;
+extern fstat_func_t		original_fstat;
+extern fstatat_func_t		original_fstatat;
+extern utimensat_func_t		original_utimensat;
+extern futimens_func_t		original_futimens;
+extern utimes_func_t		original_utimes;
+extern utime_func_t		original_utime;
+
+/* Only declared with _GNU_SOURCE, which the library is built with. */
+#if defined(__linux__) && defined(STATX_MTIME)
+#define UNLUCKY_STATX
+#endif
+#if defined(__GLIBC__) && defined(__USE_LARGEFILE64)
+#define UNLUCKY_STAT64
+#endif
+
+#ifdef UNLUCKY_STATX
+typedef int (*statx_func_t)(int fd, const char *path, int flag,
+    unsigned int mask, struct statx *sx);
+
+extern statx_func_t		original_statx;
+#endif
+
+#ifdef UNLUCKY_STAT64
+typedef int (*stat64_func_t)(const char *path, struct stat64 *sb);
+typedef int (*fstat64_func_t)(int fd, struct stat64 *sb);
+typedef int (*fstatat64_func_t)(int fd, const char *path, struct stat64 *sb,
+    int flag);
+typedef int (*xstat_func_t)(int ver, const char *path, struct stat *sb);
+typedef int (*fxstat_func_t)(int ver, int fd, struct stat *sb);
+typedef int (*fxstatat_func_t)(int ver, int fd, const char *path,
+    struct stat *sb, int flag);
+typedef int (*xstat64_func_t)(int ver, const char *path, struct stat64 *sb);
+typedef int (*fxstat64_func_t)(int ver, int fd, struct stat64 *sb);
+typedef int (*fxstatat64_func_t)(int ver, int fd, const char *path,
+    struct stat64 *sb, int flag);
+
+extern stat64_func_t		original_stat64;
+extern stat64_func_t		original_lstat64;
+extern fstat64_func_t		original_fstat64;
+extern fstatat64_func_t		original_fstatat64;
+extern xstat_func_t		original_xstat;
+extern xstat_func_t		original_lxstat;
+extern fxstat_func_t		original_fxstat;
+extern fxstatat_func_t		original_fxstatat;
+extern xstat64_func_t		original_xstat64;
+extern xstat64_func_t		original_lxstat64;
+extern fxstat64_func_t		original_fxstat64;
+extern fxstatat64_func_t	original_fxstatat64;
+#endif
 
 time_t			gettimediff(time_t current_time);
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Samples are counted in a hash table per thread, keyed on the function and
+ * the callers, which only its thread writes to. The tables are never freed,
+ * so the report at exit can add up those of threads which are gone. They are
+ * mapped rather than malloc()ed, the clock might be read from within
+ * malloc().
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "unlucky_time.h"
+#include "stats.h"
+#include "profile.h"
+
+#define PROFILE_ENTRIES	1024	/* per thread, a power of two */
+#define PROFILE_TOP	10	/* callers reported per function */
+
+struct profile_entry {
+	uint64_t	count;
+	uint32_t	fn;
+	uint32_t	depth;
+	void		*pc[PROFILE_DEPTH];
+};
+
+struct profile_table {
+	struct profile_table	*next;
+	uint64_t		 dropped;
+	struct profile_entry	 entries[PROFILE_ENTRIES];
+};
+
+unsigned int			 profile_interval;
+
+static struct profile_table	*_profile_tables;
+static __thread struct profile_table *_profile_table;
+
+static struct profile_table *
+_thread_table(void)
+{
+	struct profile_table *t;
+
+	t = mmap(NULL, sizeof(*t), PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (t == MAP_FAILED)
+		return NULL;
+
+	t->next = __atomic_load_n(&_profile_tables, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&_profile_tables, &t->next, t, 0,
+	    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	return t;
+}
+
+static uint32_t
+_hash(enum stats_fn fn, void * const *pc, int depth)
+{
+	uint32_t	h = 2166136261u ^ fn;
+	int		i;
+
+	for (i = 0; i < depth; i++)
+		h = (h ^ (uint32_t)((uintptr_t)pc[i] >> 2)) * 16777619u;
+
+	return h;
+}
+
+void
+profile_sample(enum stats_fn fn, void *caller)
+{
+	struct profile_table	*t = _profile_table;
+	struct profile_entry	*e;
+	void			*frames[PROFILE_DEPTH + 8], **pc;
+	uint32_t		 h, i;
+	int			 n, depth;
+
+	if (t == NULL && (t = _profile_table = _thread_table()) == NULL)
+		return;
+
+	/* Everything up to the caller is this library. */
+	n = backtrace(frames, PROFILE_DEPTH + 8);
+	for (i = 0; i < (uint32_t)n && frames[i] != caller; i++)
+		;
+	if (i < (uint32_t)n) {
+		pc = &frames[i];
+		depth = n - i < PROFILE_DEPTH ? n - i : PROFILE_DEPTH;
+	} else {
+		pc = &caller;
+		depth = 1;
+	}
+
+	h = _hash(fn, pc, depth);
+	for (i = 0; i < PROFILE_ENTRIES; i++) {
+		e = &t->entries[(h + i) & (PROFILE_ENTRIES - 1)];
+		if (e->count == 0) {
+			e->fn = fn;
+			e->depth = depth;
+			memcpy(e->pc, pc, depth * sizeof(*pc));
+		} else if (e->fn != fn || e->depth != (uint32_t)depth ||
+		    memcmp(e->pc, pc, depth * sizeof(*pc)) != 0) {
+			continue;
+		}
+		__atomic_store_n(&e->count, e->count + 1, __ATOMIC_RELEASE);
+		return;
+	}
+
+	t->dropped++;
+}
+
+static int
+_key_cmp(const struct profile_entry *a, const struct profile_entry *b)
+{
+	if (a->fn != b->fn)
+		return a->fn < b->fn ? -1 : 1;
+	if (a->depth != b->depth)
+		return a->depth < b->depth ? -1 : 1;
+	return memcmp(a->pc, b->pc, a->depth * sizeof(a->pc[0]));
+}
+
+static int
+_entry_cmp(const void *a, const void *b)
+{
+	return _key_cmp(a, b);
+}
+
+/* By function, the most sampled first. */
+static int
+_count_cmp(const void *a, const void *b)
+{
+	const struct profile_entry *x = a, *y = b;
+
+	if (x->fn != y->fn)
+		return x->fn < y->fn ? -1 : 1;
+	return x->count > y->count ? -1 : x->count < y->count;
+}
+
+static void
+_print_pc(FILE *fp, void *pc)
+{
+	Dl_info		 info;
+	const char	*name;
+
+	if (dladdr(pc, &info) == 0) {
+		fprintf(fp, "%p", pc);
+	} else if (info.dli_sname != NULL) {
+		fprintf(fp, "%s+%#lx", info.dli_sname,
+		    (unsigned long)((char *)pc - (char *)info.dli_saddr));
+	} else {
+		name = strrchr(info.dli_fname, '/');
+		fprintf(fp, "%s+%#lx", name ? name + 1 : info.dli_fname,
+		    (unsigned long)((char *)pc - (char *)info.dli_fbase));
+	}
+}
+
+void
+profile_print(FILE *fp)
+{
+	struct profile_table	*t;
+	struct profile_entry	*all, *e;
+	uint64_t		 dropped = 0, total[STATS_NFN];
+	size_t			 i, j, n = 0, shown;
+
+	for (t = __atomic_load_n(&_profile_tables, __ATOMIC_ACQUIRE); t != NULL; t = t->next)
+		n += PROFILE_ENTRIES;
+	if (n == 0 || (all = calloc(n, sizeof(*all))) == NULL)
+		return;
+
+	n = 0;
+	for (t = _profile_tables; t != NULL; t = t->next) {
+		dropped += t->dropped;
+		for (i = 0; i < PROFILE_ENTRIES; i++)
+			if (__atomic_load_n(&t->entries[i].count, __ATOMIC_ACQUIRE) > 0)
+				all[n++] = t->entries[i];
+	}
+
+	/* Add up the samples of the same callers in different threads. */
+	qsort(all, n, sizeof(*all), _entry_cmp);
+	for (i = 0, j = 0; i < n; i++) {
+		if (j > 0 && _key_cmp(&all[j - 1], &all[i]) == 0)
+			all[j - 1].count += all[i].count;
+		else
+			all[j++] = all[i];
+	}
+	n = j;
+	qsort(all, n, sizeof(*all), _count_cmp);
+
+	memset(total, 0, sizeof(total));
+	for (i = 0; i < n; i++)
+		total[all[i].fn] += all[i].count;
+
+	fprintf(fp, "unlucky: callers sampled every %u calls\n", profile_interval);
+	for (i = 0; i < n; i += shown) {
+		e = &all[i];
+		fprintf(fp, "%s: %llu samples\n", stats_name(e->fn),
+		    (unsigned long long)total[e->fn]);
+		for (shown = 0; i + shown < n && all[i + shown].fn == e->fn; shown++) {
+			if (shown >= PROFILE_TOP)
+				continue;
+			fprintf(fp, "%10llu %5.1f%%  ",
+			    (unsigned long long)all[i + shown].count,
+			    100.0 * all[i + shown].count / total[e->fn]);
+			for (j = 0; j < all[i + shown].depth; j++) {
+				if (j > 0)
+					fprintf(fp, " <- ");
+				_print_pc(fp, all[i + shown].pc[j]);
+			}
+			fprintf(fp, "\n");
+		}
+	}
+	if (dropped > 0)
+		fprintf(fp, "%llu samples didn't fit\n", (unsigned long long)dropped);
+
+	free(all);
+}
+
+static void
+_profile_exit(void)
+{
+	profile_print(stderr);
+}
+
+/* A child reports its own samples. */
+static void
+_fork_child(void)
+{
+	struct profile_table *t;
+
+	for (t = _profile_tables; t != NULL; t = t->next) {
+		memset(t->entries, 0, sizeof(t->entries));
+		t->dropped = 0;
+	}
+}
+
+int
+profile_open(unsigned int interval)
+{
+	void *frames[1];
+
+	if (interval == 0)
+		return -1;
+	profile_interval = interval;
+
+	/* The first backtrace() loads the unwinder, which allocates. */
+	backtrace(frames, 1);
+
+	pthread_atfork(NULL, NULL, _fork_child);
+	atexit(_profile_exit);
+
+	return 0;
+}
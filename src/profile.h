@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+
+/* The callers recorded per sample, innermost first. */
+#define PROFILE_DEPTH	4
+
+/*
+ * Sample every interval'th call of an override per thread, and print the
+ * callers sampled most at exit. Returns -1 on failure.
+ */
+int	profile_open(unsigned int interval);
+
+/* The per thread interval, as parsed from UNLUCKY_PROFILE. */
+extern unsigned int	profile_interval;
+
+/*
+ * Record a sample of fn, called from caller. The frames above it are taken
+ * from a backtrace.
+ */
+void	profile_sample(enum stats_fn fn, void *caller);
+
+void	profile_print(FILE *fp);
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A draw is splitmix64 of the seed plus the draw number times the golden
+ * ratio, so threads can draw at the same time by bumping the counter, and a
+ * number is reduced to a range without a division with Lemire's method.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <sys/random.h>
+#endif
+
+#include "random.h"
+
+#define GOLDEN_GAMMA	0x9e3779b97f4a7c15ULL
+
+/* States of _seeded. */
+#define SEED_UNSET	0
+#define SEED_PICKING	1
+#define SEED_SET	2
+
+static uint64_t	_seed;
+static int	_seeded;
+static uint64_t	_counter;
+
+static uint64_t
+_mix(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+
+	return z ^ (z >> 31);
+}
+
+/*
+ * Picking the seed twice gives another one, so only the first thread to do
+ * it gets to set it.
+ */
+static uint64_t
+_pick_seed(void)
+{
+	const char		*s;
+	char			*end;
+	unsigned long long	 seed;
+#ifdef __linux__
+	const unsigned char	*at_random;
+	uint64_t		 words[2];
+#endif
+
+	if ((s = getenv("UNLUCKY_SEED")) != NULL && *s != '\0') {
+		errno = 0;
+		seed = strtoull(s, &end, 0);
+		if (errno == 0 && *end == '\0')
+			return seed;
+	}
+
+#ifdef __linux__
+	/*
+	 * libc takes the stack protector canary and the pointer guard from
+	 * these bytes, which a seed that gets printed mustn't give away. Both
+	 * halves go into the hash, so neither can be worked back from it.
+	 */
+	if ((at_random = (const unsigned char *)getauxval(AT_RANDOM)) != NULL) {
+		memcpy(words, at_random, sizeof(words));
+		return _mix(_mix(words[0] ^ (uintptr_t)&seed) + words[1]);
+	}
+	/* Nor the addresses of the process. */
+	if (getrandom(words, sizeof(words), GRND_NONBLOCK) == sizeof(words))
+		return _mix(_mix(words[0]) + words[1]);
+	return _mix((uint64_t)getpid() ^ GOLDEN_GAMMA);
+#else
+	return ((uint64_t)arc4random() << 32) | arc4random();
+#endif
+}
+
+void
+random_seed(uint64_t seed)
+{
+	__atomic_store_n(&_seed, seed, __ATOMIC_RELAXED);
+	__atomic_store_n(&_counter, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&_seeded, SEED_SET, __ATOMIC_RELEASE);
+}
+
+/*
+ * Threads which race to pick the seed all use the one of the thread which
+ * got there first, so the seed that's reported gives the numbers that were
+ * drawn.
+ */
+uint64_t
+random_seed_value(void)
+{
+	uint64_t	seed;
+	int		unset = SEED_UNSET;
+
+	if (__builtin_expect(__atomic_load_n(&_seeded, __ATOMIC_ACQUIRE) ==
+	    SEED_SET, 1))
+		return __atomic_load_n(&_seed, __ATOMIC_RELAXED);
+
+	seed = _pick_seed();
+	if (__atomic_compare_exchange_n(&_seeded, &unset, SEED_PICKING, 0,
+	    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&_seed, seed, __ATOMIC_RELAXED);
+		__atomic_store_n(&_seeded, SEED_SET, __ATOMIC_RELEASE);
+	}
+	while (__atomic_load_n(&_seeded, __ATOMIC_ACQUIRE) != SEED_SET)
+		;
+
+	return __atomic_load_n(&_seed, __ATOMIC_RELAXED);
+}
+
+static uint64_t
+_next(void)
+{
+	return _mix(random_seed_value() +
+	    (__atomic_fetch_add(&_counter, 1, __ATOMIC_RELAXED) + 1) * GOLDEN_GAMMA);
+}
+
+uint32_t
+random_uniform(uint32_t upper_bound)
+{
+	uint64_t	m;
+	uint32_t	l, threshold;
+
+	if (upper_bound < 2)
+		return 0;
+
+	m = (uint64_t)(uint32_t)_next() * upper_bound;
+	l = (uint32_t)m;
+	if (l < upper_bound) {
+		threshold = -upper_bound % upper_bound;
+		while (l < threshold) {
+			m = (uint64_t)(uint32_t)_next() * upper_bound;
+			l = (uint32_t)m;
+		}
+	}
+
+	return m >> 32;
+}
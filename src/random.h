@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+
+/*
+ * The scenarios are drawn from a counter based generator: draw n is a hash of
+ * the seed and n. The seed is taken from UNLUCKY_SEED, or is a hash of the
+ * random bytes the kernel hands every process when it isn't set, neither of
+ * which takes a system call.
+ */
+
+/* Use seed from now on, and start counting draws from 0. */
+void		random_seed(uint64_t seed);
+
+/* The seed in use, the one picked on first use if none was set. */
+uint64_t	random_seed_value(void);
+
+/* A uniformly distributed number less than upper_bound. */
+uint32_t	random_uniform(uint32_t upper_bound);
@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Every thread records into a buffer of its own, which only it writes to, so
+ * a read costs a fetch-and-add of the sequence number and a few stores. A
+ * full buffer is appended to the file in a single write(2) by its thread,
+ * which doesn't interleave with the writes of other threads. What is left in
+ * the buffers is written when a thread exits, and at exit for the thread
+ * calling exit(3). Threads still running then lose what they didn't write.
+ *
+ * The buffers are mapped rather than malloc()ed, the clock might be read
+ * from within malloc(). Those of exited threads are reused.
+ *
+ * The child of a fork records to a file of its own, numbered from 0 again,
+ * which is created when it first writes: one which execs or calls _exit(2)
+ * right away doesn't leave an empty recording behind.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "unlucky_time.h"
+#include "record.h"
+#include "utils.h"
+
+#define RECORD_ENTRIES	4096
+#define REPLAY_RESYNC	64
+
+struct record_buffer {
+	struct record_buffer	*next;
+	int			 used;		/* owned by a thread */
+	uint32_t		 tid;
+	size_t			 n;
+	struct record_entry	 entries[RECORD_ENTRIES];
+};
+
+static int			 _record_fd = -1;
+static char			 _record_path[PATH_MAX];
+static struct record_header	 _record_header;
+static pthread_mutex_t		 _record_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t			 _record_seq __attribute__((aligned(UNLUCKY_CACHELINE)));
+static struct record_buffer	*_record_buffers;
+static pthread_key_t		 _record_key;
+static __thread struct record_buffer *_record_buffer;
+
+static struct {
+	struct record_entry	*entries;
+	size_t			 count;
+	size_t			 next;
+	size_t			 skipped;
+	size_t			 missed;
+} _replay;
+
+static int64_t
+_ns(const struct timespec *tp)
+{
+	return tp->tv_sec * 1000000000LL + tp->tv_nsec;
+}
+
+/* Create the recording named name, for this process. */
+static int
+_create(const char *name)
+{
+	int fd;
+
+	fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -1;
+	if (write(fd, &_record_header, sizeof(_record_header)) !=
+	    sizeof(_record_header)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * The recording of a child, named like its parent's with its process id for
+ * %p, or with it added as in "name.<pid>". Given up on if it can't be made.
+ */
+static int
+_child_fd(void)
+{
+	char	name[PATH_MAX];
+	int	r;
+
+	pthread_mutex_lock(&_record_lock);
+	if (_record_fd == -1 && _record_path[0] != '\0') {
+		if (strstr(_record_path, "%p") != NULL)
+			r = pid_path(_record_path, name, sizeof(name));
+		else
+			r = snprintf(name, sizeof(name), "%s.%d", _record_path,
+			    (int)getpid()) >= (int)sizeof(name) ? -1 : 0;
+		if (r == -1 || (_record_fd = _create(name)) == -1)
+			_record_path[0] = '\0';
+	}
+	pthread_mutex_unlock(&_record_lock);
+
+	return _record_fd;
+}
+
+static void
+_flush(struct record_buffer *b)
+{
+	size_t	n;
+	ssize_t	r;
+	int	fd;
+
+	n = __atomic_load_n(&b->n, __ATOMIC_ACQUIRE);
+	if (n == 0)
+		return;
+
+	if ((fd = __atomic_load_n(&_record_fd, __ATOMIC_ACQUIRE)) != -1 ||
+	    (fd = _child_fd()) != -1) {
+		do {
+			r = write(fd, b->entries, n * sizeof(b->entries[0]));
+		} while (r == -1 && errno == EINTR);
+	}
+	__atomic_store_n(&b->n, 0, __ATOMIC_RELEASE);
+}
+
+static void
+_thread_exit(void *arg)
+{
+	struct record_buffer *b = arg;
+
+	_flush(b);
+	_record_buffer = NULL;
+	__atomic_store_n(&b->used, 0, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * A child starts without the reads of its parent, and doesn't write to its
+ * recording.
+ */
+static void
+_fork_child(void)
+{
+	struct record_buffer *b;
+
+	pthread_mutex_init(&_record_lock, NULL);
+	close(_record_fd);
+	_record_fd = -1;
+	_record_seq = 0;
+
+	for (b = _record_buffers; b != NULL; b = b->next)
+		b->n = 0;
+	if (_record_buffer != NULL)
+		_record_buffer->tid = syscall(SYS_gettid);
+}
+
+static struct record_buffer *
+_thread_buffer(void)
+{
+	struct record_buffer	*b;
+	int			 unused = 0;
+
+	for (b = __atomic_load_n(&_record_buffers, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {
+		if (__atomic_compare_exchange_n(&b->used, &unused, 1, 0,
+		    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+		unused = 0;
+	}
+
+	if (b == NULL) {
+		b = mmap(NULL, sizeof(*b), PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (b == MAP_FAILED)
+			return NULL;
+		b->used = 1;
+		b->next = __atomic_load_n(&_record_buffers, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&_record_buffers, &b->next,
+		    b, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+	}
+
+	b->tid = syscall(SYS_gettid);
+	pthread_setspecific(_record_key, b);
+
+	return b;
+}
+
+int
+record_open(const char *path, const struct unlucky_state *state)
+{
+	char name[PATH_MAX];
+
+	if (pid_path(path, name, sizeof(name)) == -1 ||
+	    strlen(path) >= sizeof(_record_path))
+		return -1;
+	strcpy(_record_path, path);
+
+	memset(&_record_header, 0, sizeof(_record_header));
+	memcpy(_record_header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+	_record_header.version = RECORD_VERSION;
+	_record_header.mode = state->mode;
+	_record_header.start_time = state->start_time;
+	_record_header.diff = state->diff;
+
+	if ((_record_fd = _create(name)) == -1)
+		return -1;
+	if (pthread_key_create(&_record_key, _thread_exit) != 0) {
+		close(_record_fd);
+		_record_fd = -1;
+		return -1;
+	}
+
+	pthread_atfork(NULL, NULL, _fork_child);
+	atexit(record_flush);
+
+	return 0;
+}
+
+void
+record_add(enum record_fn fn, clockid_t clock_id, const struct timespec *raw,
+    const struct timespec *shifted)
+{
+	struct record_buffer	*b = _record_buffer;
+	struct record_entry	*e;
+	uint64_t		 seq;
+
+	if (__builtin_expect(b == NULL, 0) &&
+	    (b = _record_buffer = _thread_buffer()) == NULL)
+		return;
+
+	seq = __atomic_fetch_add(&_record_seq, 1, __ATOMIC_RELAXED);
+
+	e = &b->entries[b->n];
+	e->seq = seq | (uint64_t)fn << RECORD_SEQ_BITS;
+	e->raw = _ns(raw);
+	e->shifted = _ns(shifted);
+	e->clock = clock_id;
+	e->tid = b->tid;
+	__atomic_store_n(&b->n, b->n + 1, __ATOMIC_RELEASE);
+
+	if (b->n == RECORD_ENTRIES)
+		_flush(b);
+}
+
+/*
+ * The buffers of other threads still running are left alone, they could be
+ * adding to them. Unowned ones are taken while they're written.
+ */
+void
+record_flush(void)
+{
+	struct record_buffer	*b;
+	int			 unused = 0;
+
+	if (_record_buffer != NULL)
+		_flush(_record_buffer);
+
+	for (b = __atomic_load_n(&_record_buffers, __ATOMIC_ACQUIRE); b != NULL; b = b->next) {
+		if (!__atomic_compare_exchange_n(&b->used, &unused, 1, 0,
+		    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			unused = 0;
+			continue;
+		}
+		_flush(b);
+		__atomic_store_n(&b->used, 0, __ATOMIC_RELEASE);
+	}
+}
+
+static int
+_seq_cmp(const void *a, const void *b)
+{
+	uint64_t x, y;
+
+	x = ((const struct record_entry *)a)->seq << (64 - RECORD_SEQ_BITS);
+	y = ((const struct record_entry *)b)->seq << (64 - RECORD_SEQ_BITS);
+
+	return x < y ? -1 : x > y;
+}
+
+static void
+_replay_exit(void)
+{
+	if (_replay.missed > 0 || _replay.skipped > 0 ||
+	    _replay.next < _replay.count)
+		fprintf(stderr, "unlucky: replay diverged: %zu of %zu reads "
+		    "replayed, %zu skipped, %zu not recorded\n",
+		    _replay.next - _replay.skipped, _replay.count,
+		    _replay.skipped, _replay.missed);
+}
+
+int
+replay_open(const char *path, struct unlucky_state *state)
+{
+	struct record_header	 header;
+	struct stat		 st;
+	char			*base;
+	int			 fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(header) ||
+	    read(fd, &header, sizeof(header)) != sizeof(header) ||
+	    memcmp(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 ||
+	    header.version != RECORD_VERSION)
+		goto fail;
+
+	_replay.count = (st.st_size - sizeof(header)) / sizeof(struct record_entry);
+	if (_replay.count > 0) {
+		/* Private, the entries are sorted in place. */
+		base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE, fd, 0);
+		if (base == MAP_FAILED)
+			goto fail;
+		_replay.entries = (struct record_entry *)(base + sizeof(header));
+	}
+	close(fd);
+
+	/* The entries of a thread were written a buffer at a time. */
+	qsort(_replay.entries, _replay.count, sizeof(struct record_entry), _seq_cmp);
+
+	unlucky_set(state, header.start_time, header.mode, header.diff);
+	atexit(_replay_exit);
+
+	return 0;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+static int
+_replay_match(const struct record_entry *e, enum record_fn fn,
+    clockid_t clock_id)
+{
+	return e->seq >> RECORD_SEQ_BITS == fn && e->clock == clock_id;
+}
+
+/*
+ * A read the recording has but the replay doesn't make would keep every read
+ * after it from matching. So when the next entry isn't of the same function
+ * and clock, the ones up to REPLAY_RESYNC further on are skipped if one of
+ * those is.
+ */
+int
+replay_next(enum record_fn fn, clockid_t clock_id, struct timespec *tp)
+{
+	const struct record_entry	*e;
+	size_t				 i, j, end;
+
+	i = __atomic_load_n(&_replay.next, __ATOMIC_ACQUIRE);
+	do {
+		end = i + REPLAY_RESYNC < _replay.count ?
+		    i + REPLAY_RESYNC : _replay.count;
+		for (j = i; j < end; j++)
+			if (_replay_match(&_replay.entries[j], fn, clock_id))
+				break;
+		if (j == end)
+			goto missed;
+		e = &_replay.entries[j];
+	} while (!__atomic_compare_exchange_n(&_replay.next, &i, j + 1, 0,
+	    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+
+	if (j > i)
+		__atomic_add_fetch(&_replay.skipped, j - i, __ATOMIC_RELAXED);
+
+	tp->tv_sec = e->shifted / 1000000000LL;
+	tp->tv_nsec = e->shifted % 1000000000LL;
+	if (tp->tv_nsec < 0) {
+		tp->tv_sec--;
+		tp->tv_nsec += 1000000000LL;
+	}
+
+	return 0;
+
+missed:
+	__atomic_add_fetch(&_replay.missed, 1, __ATOMIC_RELAXED);
+	return -1;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#define RECORD_MAGIC	"UNLKREC"
+#define RECORD_VERSION	1
+
+/* The function a clock read was made through. */
+enum record_fn {
+	RECORD_CLOCK_GETTIME = 1,
+	RECORD_GETTIMEOFDAY,
+	RECORD_TIME,
+	RECORD_TIMESPEC_GET,
+	RECORD_FTIME,
+};
+
+/*
+ * A recording is a header followed by the entries of every thread, a buffer
+ * full at a time. seq orders the reads of all threads.
+ */
+struct record_header {
+	char		magic[8];
+	uint32_t	version;
+	int32_t		mode;
+	int64_t		start_time;
+	int64_t		diff;
+};
+
+struct record_entry {
+	uint64_t	seq;		/* fn in the top 8 bits */
+	int64_t		raw;		/* the real time, in nanoseconds */
+	int64_t		shifted;	/* what the program got */
+	int32_t		clock;
+	uint32_t	tid;
+};
+
+#define RECORD_SEQ_BITS	56
+
+/*
+ * Record every clock read of the process to path, in which %p is replaced by
+ * the process id. Returns -1 if it couldn't be created.
+ */
+int	record_open(const char *path, const struct unlucky_state *state);
+void	record_add(enum record_fn fn, clockid_t clock_id, const struct timespec *raw,
+	    const struct timespec *shifted);
+
+/*
+ * Write out what the calling thread and the threads which exited recorded so
+ * far, done at exit as well.
+ */
+void	record_flush(void);
+
+/*
+ * Load a recording and set state to the one it was made with. Returns -1 if
+ * it can't be read.
+ */
+int	replay_open(const char *path, struct unlucky_state *state);
+
+/*
+ * Replace tp by the next recorded read if it was made through the same
+ * function and clock, skipping a few recorded reads to find one if needed.
+ * Returns -1 if there is none, tp is left alone then.
+ */
+int	replay_next(enum record_fn fn, clockid_t clock_id, struct timespec *tp);
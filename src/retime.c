@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Rewrite the timestamps in a log written by a shifted process to real time,
+ * or the other way around with -r.
+ *
+ * The file is mapped and cut into chunks at line ends. Every round each
+ * thread takes a chunk, finds its timestamps, converts them at once with
+ * unlucky_unshift() and formats the chunk into a buffer of its own. The
+ * buffers are written out in order before the next round, so the memory
+ * used doesn't depend on the size of the file.
+ *
+ * Recognized are Unix times of 10 digits and ISO 8601 times like
+ * 2016-01-02T09:53:55 or 2016-01-02 09:53:55, which are taken to be UTC.
+ * Anything following them, like fractions of a second, is left as it is.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "unlucky_time.h"
+
+#define CHUNK_SIZE	(8 * 1024 * 1024)
+#define EPOCH_LEN	10
+#define ISO_LEN		19
+
+enum stamp_kind {
+	STAMP_EPOCH,
+	STAMP_ISO,
+};
+
+struct stamp {
+	size_t		 off;
+	enum stamp_kind	 kind;
+};
+
+struct chunk {
+	const char	*start;
+	size_t		 len;
+
+	/* Filled in by retime(). */
+	char		*out;
+	size_t		 out_len;
+	size_t		 out_size;
+	int		 error;
+};
+
+static struct unlucky_state	state;
+static int			rflag;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: unlucky-retime [-r] [-j jobs] [-o output] "
+	    "-m mode -s start_time -d diff file\n");
+	exit(1);
+}
+
+static long long
+parse_number(const char *s, const char *what)
+{
+	char		*end;
+	long long	 v;
+
+	errno = 0;
+	v = strtoll(s, &end, 10);
+	if (errno != 0 || *s == '\0' || *end != '\0')
+		errx(1, "invalid %s: %s", what, s);
+
+	return v;
+}
+
+static int
+digits(const char *p, size_t n, int *v)
+{
+	size_t	i;
+
+	*v = 0;
+	for (i = 0; i < n; i++) {
+		if (!isdigit((unsigned char)p[i]))
+			return 0;
+		*v = *v * 10 + (p[i] - '0');
+	}
+
+	return 1;
+}
+
+/*
+ * An ISO 8601 time at p, which has at least ISO_LEN bytes.
+ */
+static int
+parse_iso(const char *p, time_t *t)
+{
+	struct tm	tm;
+
+	if (p[4] != '-' || p[7] != '-' || (p[10] != 'T' && p[10] != ' ') ||
+	    p[13] != ':' || p[16] != ':')
+		return 0;
+
+	memset(&tm, 0, sizeof(tm));
+	if (!digits(p, 4, &tm.tm_year) || !digits(p + 5, 2, &tm.tm_mon) ||
+	    !digits(p + 8, 2, &tm.tm_mday) || !digits(p + 11, 2, &tm.tm_hour) ||
+	    !digits(p + 14, 2, &tm.tm_min) || !digits(p + 17, 2, &tm.tm_sec))
+		return 0;
+	if (tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 ||
+	    tm.tm_mday > 31 || tm.tm_hour > 23 || tm.tm_min > 59 ||
+	    tm.tm_sec > 60)
+		return 0;
+
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	*t = timegm(&tm);
+
+	return 1;
+}
+
+static int
+reserve(struct chunk *c, size_t n)
+{
+	size_t	 size;
+	char	*out;
+
+	if (c->out_len + n <= c->out_size)
+		return 0;
+
+	size = c->out_size * 2;
+	if (size < c->out_len + n)
+		size = c->out_len + n;
+	if ((out = realloc(c->out, size)) == NULL)
+		return -1;
+	c->out = out;
+	c->out_size = size;
+
+	return 0;
+}
+
+static int
+append(struct chunk *c, const char *p, size_t n)
+{
+	if (reserve(c, n) == -1)
+		return -1;
+	memcpy(c->out + c->out_len, p, n);
+	c->out_len += n;
+
+	return 0;
+}
+
+static int
+append_stamp(struct chunk *c, const struct stamp *stamp, time_t t)
+{
+	struct tm	tm;
+	char		buf[64];
+	int		n;
+
+	if (stamp->kind == STAMP_EPOCH) {
+		n = snprintf(buf, sizeof(buf), "%lld", (long long)t);
+	} else {
+		if (gmtime_r(&t, &tm) == NULL)
+			return -1;
+		n = snprintf(buf, sizeof(buf), "%04d-%02d-%02d%c%02d:%02d:%02d",
+		    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+		    c->start[stamp->off + 10], tm.tm_hour, tm.tm_min,
+		    tm.tm_sec);
+	}
+
+	return append(c, buf, n);
+}
+
+/*
+ * Find the timestamps in a chunk, storing where they are in stamps and their
+ * values in times. Returns the number found.
+ */
+static size_t
+find_stamps(const struct chunk *c, struct stamp **stamps, time_t **times,
+    size_t *size)
+{
+	const char	*p = c->start;
+	size_t		 i, j, n = 0;
+	time_t		 t;
+
+	for (i = 0; i < c->len; i++) {
+		if (!isdigit((unsigned char)p[i]))
+			continue;
+		if (i > 0 && isalnum((unsigned char)p[i - 1])) {
+			while (i + 1 < c->len && isdigit((unsigned char)p[i + 1]))
+				i++;
+			continue;
+		}
+
+		for (j = i; j < c->len && isdigit((unsigned char)p[j]); j++)
+			;
+
+		if (n == *size) {
+			*size = *size ? *size * 2 : 1024;
+			*stamps = reallocarray(*stamps, *size, sizeof(**stamps));
+			*times = reallocarray(*times, *size, sizeof(**times));
+			if (*stamps == NULL || *times == NULL)
+				err(1, NULL);
+		}
+
+		if (j - i == 4 && c->len - i >= ISO_LEN &&
+		    parse_iso(p + i, &t)) {
+			(*stamps)[n].off = i;
+			(*stamps)[n].kind = STAMP_ISO;
+			(*times)[n++] = t;
+			i += ISO_LEN - 1;
+		} else {
+			if (j - i == EPOCH_LEN) {
+				for (t = 0; i < j; i++)
+					t = t * 10 + (p[i] - '0');
+				(*stamps)[n].off = j - EPOCH_LEN;
+				(*stamps)[n].kind = STAMP_EPOCH;
+				(*times)[n++] = t;
+			}
+			i = j - 1;
+		}
+	}
+
+	return n;
+}
+
+static void *
+retime(void *arg)
+{
+	struct chunk	*c = arg;
+	struct stamp	*stamps = NULL;
+	time_t		*times = NULL;
+	size_t		 i, n, prev, size = 0;
+
+	c->out_len = 0;
+	c->error = 0;
+
+	n = find_stamps(c, &stamps, &times, &size);
+	if (rflag)
+		unlucky_shift(&state, times, n);
+	else
+		unlucky_unshift(&state, times, n);
+
+	if (reserve(c, c->len + n) == -1)
+		goto fail;
+	for (prev = 0, i = 0; i < n; i++) {
+		if (append(c, c->start + prev, stamps[i].off - prev) == -1 ||
+		    append_stamp(c, &stamps[i], times[i]) == -1)
+			goto fail;
+		prev = stamps[i].off +
+		    (stamps[i].kind == STAMP_EPOCH ? EPOCH_LEN : ISO_LEN);
+	}
+	if (append(c, c->start + prev, c->len - prev) == -1)
+		goto fail;
+
+	free(stamps);
+	free(times);
+	return NULL;
+
+fail:
+	c->error = errno;
+	free(stamps);
+	free(times);
+	return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct chunk	*chunks;
+	pthread_t	*threads;
+	struct stat	 st;
+	enum unlucky_mode mode;
+	const char	*data, *end, *nl, *output = NULL;
+	time_t		 start_time = 0, diff = 0;
+	FILE		*out = stdout;
+	long		 jobs;
+	int		 ch, fd, i, n, dflag = 0, mflag = 0, sflag = 0;
+
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((ch = getopt(argc, argv, "d:j:m:o:rs:")) != -1) {
+		switch (ch) {
+		case 'd':
+			diff = parse_number(optarg, "diff");
+			dflag = 1;
+			break;
+		case 'j':
+			jobs = parse_number(optarg, "number of jobs");
+			if (jobs < 1)
+				errx(1, "invalid number of jobs: %s", optarg);
+			break;
+		case 'm':
+			if (unlucky_mode_parse(optarg, &mode) == -1 ||
+			    mode == UNLUCKY_RANDOM)
+				errx(1, "unknown mode: %s", optarg);
+			mflag = 1;
+			break;
+		case 'o':
+			output = optarg;
+			break;
+		case 'r':
+			rflag = 1;
+			break;
+		case 's':
+			start_time = parse_number(optarg, "start time");
+			sflag = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1 || !dflag || !mflag || !sflag)
+		usage();
+	if (jobs < 1)
+		jobs = 1;
+
+	unlucky_set(&state, start_time, mode, diff);
+
+	if ((fd = open(argv[0], O_RDONLY)) == -1)
+		err(1, "%s", argv[0]);
+	if (fstat(fd, &st) == -1)
+		err(1, "%s", argv[0]);
+	if (!S_ISREG(st.st_mode))
+		errx(1, "%s: not a regular file", argv[0]);
+	if (output != NULL && (out = fopen(output, "w")) == NULL)
+		err(1, "%s", output);
+	if (st.st_size == 0)
+		return 0;
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		err(1, "%s", argv[0]);
+	madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+	end = data + st.st_size;
+
+	chunks = calloc(jobs, sizeof(*chunks));
+	threads = calloc(jobs, sizeof(*threads));
+	if (chunks == NULL || threads == NULL)
+		err(1, NULL);
+
+	while (data < end) {
+		for (n = 0; n < jobs && data < end; n++) {
+			chunks[n].start = data;
+			chunks[n].len = end - data;
+			if (chunks[n].len > CHUNK_SIZE) {
+				nl = memchr(data + CHUNK_SIZE, '\n',
+				    end - data - CHUNK_SIZE);
+				chunks[n].len = nl ? nl + 1 - data : end - data;
+			}
+			data += chunks[n].len;
+		}
+
+		for (i = 1; i < n; i++) {
+			errno = pthread_create(&threads[i], NULL, retime,
+			    &chunks[i]);
+			if (errno != 0)
+				err(1, "pthread_create");
+		}
+		retime(&chunks[0]);
+		for (i = 1; i < n; i++)
+			pthread_join(threads[i], NULL);
+
+		for (i = 0; i < n; i++) {
+			if (chunks[i].error != 0) {
+				errno = chunks[i].error;
+				err(1, NULL);
+			}
+			if (fwrite(chunks[i].out, 1, chunks[i].out_len, out) !=
+			    chunks[i].out_len)
+				err(1, "%s", output ? output : "stdout");
+		}
+	}
+
+	if (fclose(out) == EOF)
+		err(1, "%s", output ? output : "stdout");
+
+	return 0;
+}
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The threads which wait are kept in a list, with their deadlines, under a
+ * single lock; waiting isn't something to be fast at. Every thread waits in
+ * slices of SIMULATE_SLICE, so a signal can interrupt it, and looks between
+ * them whether every thread waits now. The first one which finds so moves
+ * the clocks to the earliest deadline, which the others notice within a
+ * slice.
+ *
+ * The threads created with pthread_create() are counted, but on Linux those
+ * of the kernel are before a jump, as some are started otherwise or before
+ * the library is loaded.
+ *
+ * A thread which was woken by another, but didn't run yet, still counts as
+ * waiting. So the clocks only jump when nothing changed for a moment.
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "override.h"
+#include "simulate.h"
+
+#define SIMULATE_GRACE	50000	/* ns nothing has to change before a jump */
+
+struct waiter {
+	struct waiter	*next;
+	const sigset_t	*mask;
+	int64_t		 deadline;
+	int		 depth;
+};
+
+static struct {
+	pthread_mutex_t	 lock;
+	struct waiter	*waiters;
+	int		 nthreads;
+	int		 nwaiting;
+	uint64_t	 generation;	/* bumped when a wait begins or ends */
+} _sim = { PTHREAD_MUTEX_INITIALIZER };
+
+static int64_t			_skipped;
+static pthread_key_t		_thread_key;
+static __thread struct waiter	_waiter;
+
+static int64_t
+_mono(void)
+{
+	struct timespec ts;
+
+	original_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline int64_t
+_now(void)
+{
+	return _mono() + __atomic_load_n(&_skipped, __ATOMIC_ACQUIRE);
+}
+
+/* The number of threads of the process, at least the ones counted. */
+static int
+_threads(void)
+{
+#ifdef __linux__
+	char	 buf[1024], *p;
+	ssize_t	 n;
+	int	 fd, i;
+
+	if ((fd = open("/proc/self/stat", O_RDONLY | O_CLOEXEC)) == -1)
+		return _sim.nthreads;
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0)
+		return _sim.nthreads;
+	buf[n] = '\0';
+
+	/* The 20th field, after the name in parentheses. */
+	p = strrchr(buf, ')');
+	for (i = 2; i < 20 && p != NULL; i++)
+		p = strchr(p + 1, ' ');
+	if (p != NULL && (n = atoi(p + 1)) > _sim.nthreads)
+		return n;
+#endif
+	return _sim.nthreads;
+}
+
+/*
+ * Called with the lock held, which it might drop for a while. A signal
+ * which comes meanwhile has to end the wait of the caller, so the clocks
+ * don't jump then.
+ */
+static void
+_advance(void)
+{
+	struct timespec	 pause = { 0, SIMULATE_GRACE };
+	struct waiter	*w;
+	int64_t		 earliest, now;
+	uint64_t	 generation;
+	int		 interrupted;
+
+	if (_sim.nwaiting < _sim.nthreads)
+		return;
+
+	generation = _sim.generation;
+	pthread_mutex_unlock(&_sim.lock);
+	interrupted = original_nanosleep(&pause, NULL) == -1;
+	pthread_mutex_lock(&_sim.lock);
+	if (interrupted || generation != _sim.generation ||
+	    _sim.nwaiting < _threads())
+		return;
+	if (_waiter.mask != NULL && simulate_signalled(_waiter.mask))
+		return;
+
+	earliest = SIMULATE_FOREVER;
+	for (w = _sim.waiters; w != NULL; w = w->next)
+		if (w->deadline < earliest)
+			earliest = w->deadline;
+	if (earliest == SIMULATE_FOREVER)
+		return;
+
+	now = _now();
+	if (earliest > now)
+		__atomic_add_fetch(&_skipped, earliest - now, __ATOMIC_RELEASE);
+}
+
+int64_t
+simulate_skipped(void)
+{
+	return __atomic_load_n(&_skipped, __ATOMIC_ACQUIRE);
+}
+
+int64_t
+simulate_begin(int64_t left, const sigset_t *mask)
+{
+	struct waiter *w = &_waiter;
+
+	pthread_mutex_lock(&_sim.lock);
+	if (w->depth++ > 0) {
+		pthread_mutex_unlock(&_sim.lock);
+		return left == SIMULATE_FOREVER ? left : _now() + left;
+	}
+
+	w->mask = mask;
+	w->deadline = left == SIMULATE_FOREVER ? left : _now() + left;
+	w->next = _sim.waiters;
+	_sim.waiters = w;
+	_sim.nwaiting++;
+	_sim.generation++;
+	_advance();
+	pthread_mutex_unlock(&_sim.lock);
+
+	return w->deadline;
+}
+
+void
+simulate_end(void)
+{
+	struct waiter *w = &_waiter, **p;
+
+	pthread_mutex_lock(&_sim.lock);
+	if (--w->depth == 0) {
+		for (p = &_sim.waiters; *p != NULL; p = &(*p)->next) {
+			if (*p == w) {
+				*p = w->next;
+				break;
+			}
+		}
+		_sim.nwaiting--;
+		_sim.generation++;
+	}
+	pthread_mutex_unlock(&_sim.lock);
+}
+
+int64_t
+simulate_left(int64_t deadline)
+{
+	pthread_mutex_lock(&_sim.lock);
+	_advance();
+	pthread_mutex_unlock(&_sim.lock);
+
+	return deadline == SIMULATE_FOREVER ? deadline : deadline - _now();
+}
+
+int
+simulate_signalled(const sigset_t *mask)
+{
+	struct sigaction	sa;
+	sigset_t		pending;
+	int			sig;
+
+	if (sigpending(&pending) == -1)
+		return 0;
+	for (sig = 1; sig < NSIG; sig++) {
+		if (sigismember(&pending, sig) != 1 || sigismember(mask, sig) == 1)
+			continue;
+		if (sigaction(sig, NULL, &sa) == 0 && sa.sa_handler != SIG_DFL &&
+		    sa.sa_handler != SIG_IGN)
+			return 1;
+	}
+
+	return 0;
+}
+
+void
+simulate_thread_create(void)
+{
+	pthread_mutex_lock(&_sim.lock);
+	_sim.nthreads++;
+	pthread_mutex_unlock(&_sim.lock);
+}
+
+static void
+_thread_exit(void *arg)
+{
+	simulate_thread_exit();
+}
+
+void
+simulate_thread_start(void)
+{
+	pthread_setspecific(_thread_key, &_waiter);
+}
+
+/* The waiting threads notice when this was the last one running. */
+void
+simulate_thread_exit(void)
+{
+	pthread_mutex_lock(&_sim.lock);
+	_sim.nthreads--;
+	_sim.generation++;
+	pthread_mutex_unlock(&_sim.lock);
+}
+
+/*
+ * The child is left with the thread which forked, which wasn't waiting, and
+ * the time skipped so far.
+ */
+static void
+_fork_child(void)
+{
+	pthread_mutex_init(&_sim.lock, NULL);
+	_sim.waiters = NULL;
+	_sim.nthreads = 1;
+	_sim.nwaiting = 0;
+	_sim.generation = 0;
+	_waiter.depth = 0;
+}
+
+int
+simulate_open(void)
+{
+	if (pthread_key_create(&_thread_key, _thread_exit) != 0)
+		return -1;
+
+	_sim.nthreads = 1;
+	pthread_atfork(NULL, NULL, _fork_child);
+
+	return 0;
+}
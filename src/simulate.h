@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <signal.h>
+#include <stdint.h>
+
+/*
+ * With UNLUCKY_SIMULATE time doesn't pass while every thread waits for it:
+ * the clocks jump to the earliest deadline instead. Deadlines are kept in
+ * nanoseconds on the real monotonic clock plus the time skipped so far.
+ */
+
+/* A wait without a deadline, which another thread has to end. */
+#define SIMULATE_FOREVER	INT64_MAX
+
+/* The real time a wait waits before looking again. */
+#define SIMULATE_SLICE		1000000
+
+int	simulate_open(void);
+
+/* The time skipped so far, added to every clock the program reads. */
+int64_t	simulate_skipped(void);
+
+/*
+ * Keep count of the threads of the process. simulate_thread_create() is
+ * called by the creating thread, and undone with simulate_thread_exit() if
+ * creating the thread failed. simulate_thread_start() is called by the new
+ * thread, which is counted until it exits.
+ */
+void	simulate_thread_create(void);
+void	simulate_thread_start(void);
+void	simulate_thread_exit(void);
+
+/*
+ * Wait for the real duration left, or SIMULATE_FOREVER. Returns the
+ * deadline. When this leaves every thread waiting the clocks jump to the
+ * earliest deadline. A wait which a signal ends passes the mask of the
+ * caller, and blocks signals until it's done: the clocks don't jump over a
+ * signal it has pending then.
+ */
+int64_t	simulate_begin(int64_t left, const sigset_t *mask);
+void	simulate_end(void);
+
+/*
+ * What's left until deadline, which may have been skipped. Called by a
+ * waiting thread between slices of SIMULATE_SLICE, it skips ahead when every
+ * thread waits.
+ */
+int64_t	simulate_left(int64_t deadline);
+
+/* Whether a signal is pending which mask lets through and a handler catches. */
+int	simulate_signalled(const sigset_t *mask);
@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A thread only ever writes to its own slot, with plain (relaxed) loads and
+ * stores, so counting doesn't bounce cache lines between threads. Readers add
+ * up the slots without locking; a sum taken while the process runs may be a
+ * few calls behind.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "unlucky_time.h"
+#include "stats.h"
+#include "utils.h"
+
+#define STATS_MAGIC	0x554e4c53	/* UNLS */
+#define STATS_VERSION	2
+
+static const char *stats_names[STATS_NFN] = {
+	"init",
+	"clock_gettime",
+	"gettimeofday",
+	"time",
+	"timespec_get",
+	"ftime",
+};
+
+static struct stats_page	*_stats_page;
+static char			 _stats_path[PATH_MAX];
+static pthread_key_t		 _stats_key;
+static __thread struct stats_slot *_stats_slot;
+
+static int
+stats_shm_path(pid_t pid, char *path, size_t len)
+{
+	int r;
+
+	r = snprintf(path, len, "/unlucky-stats-%d", (int)pid);
+
+	return r < 0 || (size_t)r >= len ? -1 : 0;
+}
+
+static struct stats_page *
+stats_create(void)
+{
+	struct stats_page	*page;
+	char			 path[NAME_MAX];
+	int			 fd;
+
+	if (stats_shm_path(getpid(), path, sizeof(path)) == -1)
+		return NULL;
+
+	/* A page left behind by an earlier process with this pid is reset. */
+	fd = shm_open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1)
+		return NULL;
+	if (ftruncate(fd, sizeof(*page)) == -1) {
+		close(fd);
+		shm_unlink(path);
+		return NULL;
+	}
+
+	page = mmap(NULL, sizeof(*page), PROT_READ | PROT_WRITE, MAP_SHARED,
+	    fd, 0);
+	close(fd);
+	if (page == MAP_FAILED) {
+		shm_unlink(path);
+		return NULL;
+	}
+
+	page->version = STATS_VERSION;
+	page->pid = getpid();
+	__atomic_store_n(&page->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+
+	return page;
+}
+
+static void
+stats_fold(struct stats_slot *to, struct stats_slot *from)
+{
+	struct stats_counter	*t, *f;
+	size_t			 i, j;
+
+	for (i = 0; i < STATS_NFN; i++) {
+		t = &to->fn[i];
+		f = &from->fn[i];
+		__atomic_add_fetch(&t->calls, f->calls, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&t->ns, f->ns, __ATOMIC_RELAXED);
+		for (j = 0; j < STATS_BUCKETS; j++)
+			__atomic_add_fetch(&t->buckets[j], f->buckets[j], __ATOMIC_RELAXED);
+	}
+}
+
+static void
+stats_thread_exit(void *arg)
+{
+	struct stats_slot *slot = arg;
+
+	stats_fold(&_stats_page->slot[0], slot);
+	memset(slot->fn, 0, sizeof(slot->fn));
+	_stats_slot = NULL;
+	__atomic_store_n(&slot->used, 0, __ATOMIC_RELEASE);
+}
+
+static struct stats_slot *
+stats_thread_slot(void)
+{
+	struct stats_slot	*slot;
+	uint32_t		 unused;
+	size_t			 i;
+
+	for (i = 1; i < STATS_SLOTS; i++) {
+		slot = &_stats_page->slot[i];
+		unused = 0;
+		if (__atomic_compare_exchange_n(&slot->used, &unused, 1, 0,
+		    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			slot->tid = syscall(SYS_gettid);
+			pthread_setspecific(_stats_key, slot);
+			return slot;
+		}
+	}
+
+	return &_stats_page->slot[0];
+}
+
+static void
+stats_exit(void)
+{
+	struct stats_counter	 sum[STATS_NFN];
+	char			 path[NAME_MAX];
+	FILE			*fp = stderr;
+
+	stats_sum(_stats_page, sum);
+
+	if (_stats_path[0] != '\0' && (fp = fopen(_stats_path, "w")) == NULL)
+		fp = stderr;
+	if (fp == stderr)
+		fprintf(fp, "unlucky: clock reads of process %d\n", (int)getpid());
+	fprintf(fp, "seed %llu\n", (unsigned long long)_stats_page->seed);
+	stats_print(fp, sum);
+	if (fp != stderr)
+		fclose(fp);
+
+	if (stats_shm_path(getpid(), path, sizeof(path)) == 0)
+		shm_unlink(path);
+}
+
+/* A child counts for itself, in a page of its own. */
+static void
+stats_fork_child(void)
+{
+	struct stats_page *page;
+
+	_stats_slot = NULL;
+	if ((page = stats_create()) != NULL) {
+		page->seed = _stats_page->seed;
+		_stats_page = page;
+	}
+}
+
+int
+stats_open(const char *path)
+{
+	if (strcmp(path, "-") == 0)
+		path = "";
+	if (pid_path(path, _stats_path, sizeof(_stats_path)) == -1)
+		return -1;
+
+	if (pthread_key_create(&_stats_key, stats_thread_exit) != 0)
+		return -1;
+	if ((_stats_page = stats_create()) == NULL)
+		return -1;
+
+	pthread_atfork(NULL, NULL, stats_fork_child);
+	atexit(stats_exit);
+
+	return 0;
+}
+
+void
+stats_seed(uint64_t seed)
+{
+	_stats_page->seed = seed;
+}
+
+void
+stats_add(enum stats_fn fn, uint64_t ns)
+{
+	struct stats_slot	*slot = _stats_slot;
+	struct stats_counter	*c;
+	int			 bucket;
+
+	if (__builtin_expect(slot == NULL, 0))
+		slot = _stats_slot = stats_thread_slot();
+
+	bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+	if (bucket >= STATS_BUCKETS)
+		bucket = STATS_BUCKETS - 1;
+
+	c = &slot->fn[fn];
+	if (slot == &_stats_page->slot[0]) {
+		__atomic_add_fetch(&c->calls, 1, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&c->ns, ns, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&c->buckets[bucket], 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	__atomic_store_n(&c->calls, c->calls + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->ns, c->ns + ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&c->buckets[bucket], c->buckets[bucket] + 1, __ATOMIC_RELAXED);
+}
+
+const char *
+stats_name(enum stats_fn fn)
+{
+	return stats_names[fn];
+}
+
+const struct stats_page *
+stats_attach(pid_t pid)
+{
+	struct stats_page	*page;
+	char			 path[NAME_MAX];
+	int			 fd;
+
+	if (stats_shm_path(pid, path, sizeof(path)) == -1)
+		return NULL;
+	if ((fd = shm_open(path, O_RDONLY | O_CLOEXEC, 0)) == -1)
+		return NULL;
+
+	page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (page == MAP_FAILED)
+		return NULL;
+
+	if (__atomic_load_n(&page->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC ||
+	    page->version != STATS_VERSION) {
+		munmap(page, sizeof(*page));
+		return NULL;
+	}
+
+	return page;
+}
+
+void
+stats_sum(const struct stats_page *page, struct stats_counter sum[STATS_NFN])
+{
+	const struct stats_counter	*c;
+	size_t				 i, j, k;
+
+	memset(sum, 0, sizeof(*sum) * STATS_NFN);
+
+	for (i = 0; i < STATS_SLOTS; i++) {
+		for (j = 0; j < STATS_NFN; j++) {
+			c = &page->slot[i].fn[j];
+			sum[j].calls += __atomic_load_n(&c->calls, __ATOMIC_RELAXED);
+			sum[j].ns += __atomic_load_n(&c->ns, __ATOMIC_RELAXED);
+			for (k = 0; k < STATS_BUCKETS; k++)
+				sum[j].buckets[k] += __atomic_load_n(&c->buckets[k], __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/*
+ * The upper bound of the bucket in which the given fraction of the calls
+ * fall.
+ */
+static unsigned long long
+stats_percentile(const struct stats_counter *c, double fraction)
+{
+	uint64_t	n = 0;
+	size_t		i;
+
+	for (i = 0; i < STATS_BUCKETS; i++) {
+		n += c->buckets[i];
+		if (n > 0 && n >= fraction * c->calls)
+			break;
+	}
+	if (i == STATS_BUCKETS)
+		i--;
+
+	return 1ULL << i;
+}
+
+/*
+ * The percentiles are the upper bounds of their buckets, so powers of two.
+ */
+void
+stats_print(FILE *fp, const struct stats_counter sum[STATS_NFN])
+{
+	size_t i;
+
+	fprintf(fp, "%-14s %12s %10s %10s %10s %10s\n", "function", "calls",
+	    "avg ns", "p50 ns", "p99 ns", "max ns");
+	for (i = 0; i < STATS_NFN; i++) {
+		if (sum[i].calls == 0)
+			continue;
+		fprintf(fp, "%-14s %12llu %10llu %10llu %10llu %10llu\n",
+		    stats_names[i], (unsigned long long)sum[i].calls,
+		    (unsigned long long)(sum[i].ns / sum[i].calls),
+		    stats_percentile(&sum[i], 0.5),
+		    stats_percentile(&sum[i], 0.99),
+		    stats_percentile(&sum[i], 1.0));
+	}
+}
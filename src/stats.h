@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* What is counted. */
+enum stats_fn {
+	STATS_INIT,
+	STATS_CLOCK_GETTIME,
+	STATS_GETTIMEOFDAY,
+	STATS_TIME,
+	STATS_TIMESPEC_GET,
+	STATS_FTIME,
+	STATS_NFN,
+};
+
+/* Bucket i counts the calls which took less than 2^i nanoseconds. */
+#define STATS_BUCKETS	32
+
+struct stats_counter {
+	uint64_t	calls;
+	uint64_t	ns;
+	uint64_t	buckets[STATS_BUCKETS];
+};
+
+/*
+ * Every thread counts in a slot of its own, on cache lines of its own. Slot 0
+ * holds the counts of threads which exited, and of those which didn't get a
+ * slot; it is only changed with atomic adds.
+ */
+struct stats_slot {
+	uint32_t		used;
+	uint32_t		tid;
+	struct stats_counter	fn[STATS_NFN];
+} __attribute__((aligned(UNLUCKY_CACHELINE)));
+
+#define STATS_SLOTS	64
+
+/*
+ * The counters of a process are kept in a shared memory page named after
+ * its pid (/unlucky-stats-<pid>), so they can be read while it runs.
+ */
+struct stats_page {
+	uint32_t		magic;
+	uint32_t		version;
+	int32_t			pid;
+	uint64_t		seed;		/* of the scenario */
+	struct stats_slot	slot[STATS_SLOTS];
+};
+
+/*
+ * Start counting for this process. The counters are printed at exit to path,
+ * or stderr if it's empty or "-". Returns -1 on failure.
+ */
+int	stats_open(const char *path);
+
+/* The seed the scenario was drawn from, printed with the counters. */
+void	stats_seed(uint64_t seed);
+
+/* Count a call of fn which took ns nanoseconds. */
+void	stats_add(enum stats_fn fn, uint64_t ns);
+const char	*stats_name(enum stats_fn fn);
+
+/* Map the counters of another process read-only, NULL on failure. */
+const struct stats_page	*stats_attach(pid_t pid);
+
+/* Add up the counters of all threads and print them. */
+void	stats_sum(const struct stats_page *page, struct stats_counter sum[STATS_NFN]);
+void	stats_print(FILE *fp, const struct stats_counter sum[STATS_NFN]);
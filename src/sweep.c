@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Run a command in every scenario: every mode, with a number of seeds and
+ * start times, and report which of them failed.
+ *
+ * Scenarios are handed out to a pool of threads, one per core unless -j says
+ * otherwise, which take the next one as soon as their command exits. A
+ * thread spawns its command with the scenario in the environment, stdin and
+ * stdout on /dev/null and stderr on a pipe, of which the start is kept to be
+ * shown when the command fails.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "unlucky_time.h"
+
+#ifndef LIBDIR
+#define LIBDIR		"/usr/local/lib"
+#endif
+
+#define STDERR_KEPT	4096	/* of the stderr of a failed command */
+#define MAX_TIMES	64
+
+struct scenario {
+	enum unlucky_mode	 mode;
+	unsigned long long	 seed;
+	int			 time;		/* index in start_times, or -1 */
+
+	int			 status;
+	int			 spawned;
+	char			*err;
+	size_t			 err_len;
+	size_t			 err_dropped;
+};
+
+extern char		**environ;
+
+static struct scenario	*scenarios;
+static size_t		 nscenarios;
+static size_t		 next_scenario;
+
+static long long	 start_times[MAX_TIMES];
+static int		 ntimes;
+
+static char		**command;
+static char		**base_env;
+static size_t		 nbase_env;
+static const char	*library = LIBDIR "/libunlucky.so";
+static char		*preload;
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: unlucky-sweep [-j jobs] [-l library] [-m mode] "
+	    "[-n seeds] [-s start_time] command [arg ...]\n");
+	exit(1);
+}
+
+static long long
+parse_number(const char *s, const char *what)
+{
+	char		*end;
+	long long	 v;
+
+	errno = 0;
+	v = strtoll(s, &end, 10);
+	if (errno != 0 || *s == '\0' || *end != '\0')
+		errx(1, "invalid %s: %s", what, s);
+
+	return v;
+}
+
+/* The variables which describe a scenario are set by us. */
+static int
+scenario_var(const char *var)
+{
+	static const char *names[] = {
+		"LD_PRELOAD=", "UNLUCKY_MODE=", "UNLUCKY_SEED=",
+		"UNLUCKY_START_TIME=", "UNLUCKY_STATE=", "UNLUCKY_REPLAY=",
+		"UNLUCKY_SHM=", "UNLUCKY_TIMELINE=", "UNLUCKY_DILATION=",
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if (strncmp(var, names[i], strlen(names[i])) == 0)
+			return 1;
+
+	return 0;
+}
+
+/* The library is added to what the user preloads, if anything. */
+static void
+init_env(void)
+{
+	const char	*user;
+	size_t		 i, n;
+	int		 r;
+
+	for (n = 0; environ[n] != NULL; n++)
+		;
+	if ((base_env = calloc(n + 1, sizeof(*base_env))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < n; i++)
+		if (!scenario_var(environ[i]))
+			base_env[nbase_env++] = environ[i];
+
+	if ((user = getenv("LD_PRELOAD")) != NULL && *user != '\0')
+		r = asprintf(&preload, "LD_PRELOAD=%s %s", user, library);
+	else
+		r = asprintf(&preload, "LD_PRELOAD=%s", library);
+	if (r == -1)
+		err(1, NULL);
+}
+
+static void
+keep_stderr(struct scenario *s, int fd)
+{
+	char	buf[4096];
+	ssize_t	n;
+	size_t	keep;
+
+	while ((n = read(fd, buf, sizeof(buf))) != 0) {
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		keep = STDERR_KEPT - s->err_len;
+		if (keep > (size_t)n)
+			keep = n;
+		memcpy(s->err + s->err_len, buf, keep);
+		s->err_len += keep;
+		s->err_dropped += n - keep;
+	}
+}
+
+static void
+run(struct scenario *s)
+{
+	posix_spawn_file_actions_t	 actions;
+	char				 vars[3][64], **env;
+	pid_t				 pid;
+	size_t				 n;
+	int				 fds[2];
+
+	if ((s->err = malloc(STDERR_KEPT)) == NULL)
+		err(1, NULL);
+	if ((env = calloc(nbase_env + 6, sizeof(*env))) == NULL)
+		err(1, NULL);
+	memcpy(env, base_env, nbase_env * sizeof(*env));
+	n = nbase_env;
+
+	snprintf(vars[0], sizeof(vars[0]), "UNLUCKY_MODE=%s",
+	    unlucky_mode_name(s->mode));
+	snprintf(vars[1], sizeof(vars[1]), "UNLUCKY_SEED=%llu", s->seed);
+	env[n++] = vars[0];
+	env[n++] = vars[1];
+	if (s->time != -1) {
+		snprintf(vars[2], sizeof(vars[2]), "UNLUCKY_START_TIME=%lld",
+		    start_times[s->time]);
+		env[n++] = vars[2];
+	}
+	env[n++] = preload;
+
+	/* Close on exec, or the commands of other threads keep it open. */
+	if (pipe2(fds, O_CLOEXEC) == -1)
+		err(1, "pipe");
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], 2);
+
+	errno = posix_spawnp(&pid, command[0], &actions, NULL, command, env);
+	posix_spawn_file_actions_destroy(&actions);
+	close(fds[1]);
+
+	if (errno != 0) {
+		s->err_len = snprintf(s->err, STDERR_KEPT, "%s: %s\n",
+		    command[0], strerror(errno));
+	} else {
+		s->spawned = 1;
+		keep_stderr(s, fds[0]);
+		while (waitpid(pid, &s->status, 0) == -1)
+			if (errno != EINTR)
+				err(1, "waitpid");
+	}
+	close(fds[0]);
+
+	free(env);
+}
+
+static void *
+worker(void *arg)
+{
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&next_scenario, 1, __ATOMIC_RELAXED)) <
+	    nscenarios)
+		run(&scenarios[i]);
+
+	return NULL;
+}
+
+static int
+failed(const struct scenario *s)
+{
+	return !s->spawned || !WIFEXITED(s->status) ||
+	    WEXITSTATUS(s->status) != 0;
+}
+
+/*
+ * A row per mode and a column per start time, in which the number of seeds
+ * which failed.
+ */
+static int
+report(const enum unlucky_mode *modes, int nmodes, unsigned long long nseeds)
+{
+	const struct scenario	*s;
+	char			 cell[32];
+	size_t			 i;
+	int			 m, t, columns, nfailed = 0;
+	unsigned long long	 f;
+
+	columns = ntimes > 0 ? ntimes : 1;
+
+	printf("%-16s", "mode");
+	for (t = 0; t < columns; t++) {
+		if (ntimes == 0)
+			printf(" %12s", "now");
+		else
+			printf(" %12lld", start_times[t]);
+	}
+	printf("\n");
+
+	for (m = 0; m < nmodes; m++) {
+		printf("%-16s", unlucky_mode_name(modes[m]));
+		for (t = 0; t < columns; t++) {
+			f = 0;
+			for (i = 0; i < nscenarios; i++) {
+				s = &scenarios[i];
+				if (s->mode == modes[m] &&
+				    (ntimes == 0 || s->time == t) && failed(s))
+					f++;
+			}
+			if (f == 0)
+				snprintf(cell, sizeof(cell), "ok");
+			else
+				snprintf(cell, sizeof(cell), "%llu/%llu", f,
+				    nseeds);
+			printf(" %12s", cell);
+		}
+		printf("\n");
+	}
+
+	for (i = 0; i < nscenarios; i++) {
+		s = &scenarios[i];
+		if (!failed(s))
+			continue;
+		nfailed++;
+
+		printf("\nUNLUCKY_MODE=%s UNLUCKY_SEED=%llu",
+		    unlucky_mode_name(s->mode), s->seed);
+		if (s->time != -1)
+			printf(" UNLUCKY_START_TIME=%lld", start_times[s->time]);
+		if (!s->spawned)
+			printf(": not run\n");
+		else if (WIFEXITED(s->status))
+			printf(": exit %d\n", WEXITSTATUS(s->status));
+		else
+			printf(": signal %d\n", WTERMSIG(s->status));
+		fwrite(s->err, 1, s->err_len, stdout);
+		if (s->err_len > 0 && s->err[s->err_len - 1] != '\n')
+			printf("\n");
+		if (s->err_dropped > 0)
+			printf("(%zu more bytes)\n", s->err_dropped);
+	}
+
+	return nfailed;
+}
+
+int
+main(int argc, char *argv[])
+{
+	enum unlucky_mode	 modes[UNLUCKY_RANDOM], mode;
+	pthread_t		*threads;
+	unsigned long long	 seed, nseeds = 1;
+	long			 jobs;
+	size_t			 i;
+	int			 ch, m, t, nmodes = 0;
+
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((ch = getopt(argc, argv, "+j:l:m:n:s:")) != -1) {
+		switch (ch) {
+		case 'j':
+			jobs = parse_number(optarg, "number of jobs");
+			if (jobs < 1)
+				errx(1, "invalid number of jobs: %s", optarg);
+			break;
+		case 'l':
+			library = optarg;
+			break;
+		case 'm':
+			if (unlucky_mode_parse(optarg, &mode) == -1 ||
+			    mode == UNLUCKY_RANDOM)
+				errx(1, "unknown mode: %s", optarg);
+			if (nmodes < UNLUCKY_RANDOM)
+				modes[nmodes++] = mode;
+			break;
+		case 'n':
+			if (parse_number(optarg, "number of seeds") < 1)
+				errx(1, "invalid number of seeds: %s", optarg);
+			nseeds = strtoull(optarg, NULL, 10);
+			break;
+		case 's':
+			if (ntimes == MAX_TIMES)
+				errx(1, "too many start times");
+			start_times[ntimes++] = parse_number(optarg, "start time");
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1)
+		usage();
+	command = argv;
+	if (jobs < 1)
+		jobs = 1;
+
+	if (nmodes == 0)
+		for (mode = 0; mode < UNLUCKY_RANDOM; mode++)
+			modes[nmodes++] = mode;
+
+	nscenarios = nmodes * nseeds * (ntimes > 0 ? ntimes : 1);
+	if ((scenarios = calloc(nscenarios, sizeof(*scenarios))) == NULL)
+		err(1, NULL);
+	for (i = 0, m = 0; m < nmodes; m++) {
+		for (t = 0; t < (ntimes > 0 ? ntimes : 1); t++) {
+			for (seed = 1; seed <= nseeds; seed++, i++) {
+				scenarios[i].mode = modes[m];
+				scenarios[i].seed = seed;
+				scenarios[i].time = ntimes > 0 ? t : -1;
+			}
+		}
+	}
+
+	if ((size_t)jobs > nscenarios)
+		jobs = nscenarios;
+	init_env();
+
+	if ((threads = calloc(jobs, sizeof(*threads))) == NULL)
+		err(1, NULL);
+	for (i = 1; i < (size_t)jobs; i++) {
+		errno = pthread_create(&threads[i], NULL, worker, NULL);
+		if (errno != 0)
+			err(1, "pthread_create");
+	}
+	worker(NULL);
+	for (i = 1; i < (size_t)jobs; i++)
+		pthread_join(threads[i], NULL);
+
+	return report(modes, nmodes, nseeds) > 0;
+}
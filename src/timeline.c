@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A timeline is a list of steps separated by commas, each a number of
+ * seconds after the previous step (or after the start, 0 if left out), a
+ * colon and what happens then:
+ *
+ *	dst_change,600:-3,600:leap_second
+ *
+ * A mode name jumps to a new scenario of that mode, picked from the shifted
+ * time at that moment, and a signed number of seconds moves the clock by
+ * that much. "generate:n" draws n steps from the seed instead.
+ *
+ * The segments never change once they're compiled. A clock read finds its
+ * segment with a binary search, unless it's the one the thread found last.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "random.h"
+#include "timeline.h"
+
+#define GENERATE_STEPS	16
+
+static struct unlucky_state	_segments[TIMELINE_MAX];
+static size_t			_nsegments;
+static __thread size_t		_hint;
+
+/* Add a segment at real time at, moving the clock or picking a scenario. */
+static int
+_step(time_t at, int jump, long long seconds, enum unlucky_mode mode)
+{
+	struct unlucky_state	*prev, *seg, pick;
+	time_t			 diff;
+
+	if (_nsegments == TIMELINE_MAX)
+		return -1;
+	prev = &_segments[_nsegments - 1];
+	seg = &_segments[_nsegments++];
+
+	/* What the previous segment had come to, leap seconds included. */
+	diff = unlucky_diff(prev, at);
+
+	if (jump) {
+		unlucky_set(seg, at, prev->mode, diff + seconds);
+	} else {
+		memset(&pick, 0, sizeof(pick));
+		unlucky_init(&pick, at + diff, mode);
+		unlucky_set(seg, at, pick.mode, diff + pick.diff);
+	}
+
+	return 0;
+}
+
+static int
+_generate(const char *s, time_t now)
+{
+	char		*end;
+	long long	 n, i;
+
+	errno = 0;
+	n = *s == '\0' ? GENERATE_STEPS : strtoll(s, &end, 10);
+	if (*s != '\0' && (errno != 0 || *end != '\0' || n < 1))
+		return -1;
+
+	for (i = 0; i < n; i++) {
+		now += 60 + random_uniform(30 * 60);
+		switch (random_uniform(4)) {
+		case 0:
+			if (_step(now, 1, -1 - (long long)random_uniform(5), 0) == -1)
+				return -1;
+			break;
+		case 1:
+			if (_step(now, 1, 1 + random_uniform(60 * 60), 0) == -1)
+				return -1;
+			break;
+		default:
+			if (_step(now, 0, 0, UNLUCKY_RANDOM) == -1)
+				return -1;
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static int
+_compile(char *spec, time_t now)
+{
+	enum unlucky_mode	 mode;
+	char			*step, *event, *end, *last;
+	long long		 after, seconds;
+
+	for (step = strtok_r(spec, ",", &last); step != NULL;
+	    step = strtok_r(NULL, ",", &last)) {
+		after = 0;
+		if ((event = strchr(step, ':')) != NULL) {
+			errno = 0;
+			after = strtoll(step, &end, 10);
+			if (errno != 0 || end != event || end == step || after < 0)
+				return -1;
+			event++;
+		} else {
+			event = step;
+		}
+		now += after;
+
+		if (*event == '+' || *event == '-' || isdigit((unsigned char)*event)) {
+			errno = 0;
+			seconds = strtoll(event, &end, 10);
+			if (errno != 0 || *end != '\0' || end == event ||
+			    _step(now, 1, seconds, 0) == -1)
+				return -1;
+		} else if (unlucky_mode_parse(event, &mode) == -1 ||
+		    _step(now, 0, 0, mode) == -1) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* The exported form, @mode:start:diff for every segment after the first. */
+static int
+_import(char *spec)
+{
+	enum unlucky_mode	 mode;
+	char			*seg, *colon, *end, *last;
+	long long		 start, diff;
+
+	for (seg = strtok_r(spec, ",", &last); seg != NULL;
+	    seg = strtok_r(NULL, ",", &last)) {
+		if ((colon = strchr(seg, ':')) == NULL || _nsegments == TIMELINE_MAX)
+			return -1;
+		*colon = '\0';
+		if (unlucky_mode_parse(seg, &mode) == -1 || mode == UNLUCKY_RANDOM)
+			return -1;
+
+		errno = 0;
+		start = strtoll(colon + 1, &end, 10);
+		if (errno != 0 || *end != ':')
+			return -1;
+		diff = strtoll(end + 1, &end, 10);
+		if (errno != 0 || *end != '\0' ||
+		    start < _segments[_nsegments - 1].start_time)
+			return -1;
+
+		unlucky_set(&_segments[_nsegments++], start, mode, diff);
+	}
+
+	return 0;
+}
+
+int
+timeline_open(const char *spec, const struct unlucky_state *base, time_t now)
+{
+	char	*copy;
+	int	 r;
+
+	if ((copy = strdup(spec)) == NULL)
+		return -1;
+
+	_segments[0] = *base;
+	_nsegments = 1;
+
+	if (*copy == '@')
+		r = _import(copy + 1);
+	else if (strncmp(copy, "generate", 8) == 0 &&
+	    (copy[8] == '\0' || copy[8] == ':'))
+		r = _generate(copy + 8 + (copy[8] == ':'), now);
+	else
+		r = _compile(copy, now);
+	free(copy);
+
+	if (r == -1)
+		_nsegments = 1;
+	return r;
+}
+
+time_t
+timeline_diff(time_t t)
+{
+	size_t	i = _hint, lo, hi, mid;
+
+	if (i >= _nsegments || _segments[i].start_time > t ||
+	    (i + 1 < _nsegments && _segments[i + 1].start_time <= t)) {
+		/* The last segment starting at or before t, or the first. */
+		lo = 0;
+		hi = _nsegments;
+		while (hi - lo > 1) {
+			mid = lo + (hi - lo) / 2;
+			if (_segments[mid].start_time <= t)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		_hint = i = lo;
+	}
+
+	return _segments[i].diff + _segments[i].diff_fn(_segments[i].start_time, t);
+}
+
+int
+timeline_export(char *buf, size_t len)
+{
+	size_t	i, off;
+	int	r;
+
+	if ((r = snprintf(buf, len, "@")) < 0 || (size_t)r >= len)
+		return -1;
+	for (off = r, i = 1; i < _nsegments; i++, off += r) {
+		r = snprintf(buf + off, len - off, "%s%s:%lld:%lld",
+		    i > 1 ? "," : "", unlucky_mode_name(_segments[i].mode),
+		    (long long)_segments[i].start_time,
+		    (long long)_segments[i].diff);
+		if (r < 0 || (size_t)r >= len - off)
+			return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "unlucky_time.h"
+
+/*
+ * With UNLUCKY_TIMELINE a run goes through several scenarios rather than
+ * one. The steps are compiled into segments when the library starts: each
+ * is a state which is in effect from its start time on, on the real clock,
+ * until the start of the next.
+ */
+
+#define TIMELINE_MAX	256
+
+/*
+ * Compile spec into segments following base, the first step counting from
+ * now. Returns -1 if spec isn't a timeline.
+ */
+int	timeline_open(const char *spec, const struct unlucky_state *base, time_t now);
+
+/* The diff of the segment in effect at real time t. */
+time_t	timeline_diff(time_t t);
+
+/*
+ * The compiled segments as a timeline of their own, for children to run
+ * through the same ones. Returns -1 if they don't fit.
+ */
+int	timeline_export(char *buf, size_t len);
+
+#endif /* TIMELINE_H */
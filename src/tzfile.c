@@ -0,0 +1,683 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A reader for the TZif files described in RFC 8536. Instead of asking libc
+ * for the local time every 12 hours and bisecting, the daylight saving time
+ * changes are read straight from the transition table, and for the years
+ * after the table from the POSIX TZ rule in the footer.
+ *
+ * A zone is read once for every value of TZ and kept, so looking up the
+ * offset from UTC at some time takes neither libc's lock nor a system call.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "civil.h"
+#include "tzfile.h"
+
+#define TZDEFAULT	"/etc/localtime"
+#define TZDIR		"/usr/share/zoneinfo"
+
+#define TZIF_HEADER	44
+#define SECSPERDAY	CIVIL_SECSPERDAY
+
+struct tzdata {
+	const unsigned char	*times;		/* transition times, big endian */
+	const unsigned char	*idxs;		/* local time type per transition */
+	const unsigned char	*types;		/* ttinfo, 6 bytes each */
+	uint32_t		 timecnt;
+	uint32_t		 typecnt;
+	int			 width;		/* 4 (v1) or 8 (v2+) bytes */
+	const char		*footer;
+	size_t			 footer_len;
+};
+
+struct tzrule_date {
+	char	kind;		/* 'J' (Jn), 'D' (n) or 'M' (Mm.w.d) */
+	int	m, w, d;
+	long	time;		/* seconds after local midnight */
+};
+
+struct tzrule {
+	long			std_utoff;
+	long			dst_utoff;
+	int			has_dst;
+	struct tzrule_date	start;
+	struct tzrule_date	end;
+};
+
+/* The offset from UTC in effect from time on. */
+struct tztrans {
+	int64_t	time;
+	long	utoff;
+	int	isdst;
+};
+
+/*
+ * A zone as read for one value of TZ. Zones are only ever added to the
+ * front of the list, and never change or go away once they're on it.
+ */
+struct tzzone {
+	struct tzzone	*next;
+	char		*tz;		/* NULL when TZ isn't set */
+	int		 error;		/* couldn't be read, ask libc */
+	struct tztrans	 first;		/* in effect before the transitions */
+	struct tztrans	*trans;
+	uint32_t	 ntrans;
+	struct tzrule	 rule;		/* in effect after them, if has_rule */
+	int		 has_rule;
+};
+
+static struct tzzone	*zones;
+
+static uint32_t
+get32(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3];
+}
+
+static int64_t
+get_time(const struct tzdata *tz, uint32_t i)
+{
+	const unsigned char *p = tz->times + (size_t)i * tz->width;
+
+	if (tz->width == 4)
+		return (int32_t)get32(p);
+
+	return (int64_t)((uint64_t)get32(p) << 32 | get32(p + 4));
+}
+
+static int
+type_isdst(const struct tzdata *tz, uint32_t type)
+{
+	return tz->types[type * 6 + 4];
+}
+
+static long
+year_of(int64_t t)
+{
+	struct civil c;
+
+	civil_split(t, &c);
+	return c.year;
+}
+
+/*
+ * Parse one of the two data blocks of a TZif file, returns a pointer past it
+ * or NULL if it doesn't fit in the file.
+ */
+static const unsigned char *
+parse_block(const unsigned char *p, const unsigned char *end, int width,
+    struct tzdata *tz)
+{
+	uint32_t	isutcnt, isstdcnt, leapcnt, charcnt;
+	size_t		len;
+
+	if (end - p < TZIF_HEADER || memcmp(p, "TZif", 4) != 0)
+		return NULL;
+
+	isutcnt = get32(p + 20);
+	isstdcnt = get32(p + 24);
+	leapcnt = get32(p + 28);
+	tz->timecnt = get32(p + 32);
+	tz->typecnt = get32(p + 36);
+	charcnt = get32(p + 40);
+	p += TZIF_HEADER;
+
+	if (tz->typecnt == 0 || tz->timecnt > 1 << 20 || tz->typecnt > 256 ||
+	    leapcnt > 1 << 20 || charcnt > 1 << 20 || isutcnt > 256 ||
+	    isstdcnt > 256)
+		return NULL;
+
+	len = (size_t)tz->timecnt * (width + 1) + (size_t)tz->typecnt * 6 +
+	    charcnt + (size_t)leapcnt * (width + 4) + isstdcnt + isutcnt;
+	if ((size_t)(end - p) < len)
+		return NULL;
+
+	tz->width = width;
+	tz->times = p;
+	tz->idxs = p + (size_t)tz->timecnt * width;
+	tz->types = tz->idxs + tz->timecnt;
+
+	for (len = 0; len < tz->timecnt; len++)
+		if (tz->idxs[len] >= tz->typecnt)
+			return NULL;
+
+	return tz->types + (size_t)tz->typecnt * 6 + charcnt +
+	    (size_t)leapcnt * (width + 4) + isstdcnt + isutcnt;
+}
+
+static int
+parse_tzif(const unsigned char *p, size_t size, struct tzdata *tz)
+{
+	const unsigned char	*end = p + size, *next, *nl;
+
+	memset(tz, 0, sizeof(*tz));
+
+	if ((next = parse_block(p, end, 4, tz)) == NULL)
+		return -1;
+
+	/* Version 1 files only have the 32 bit block and no footer. */
+	if (p[4] == '\0')
+		return 0;
+
+	if ((next = parse_block(next, end, 8, tz)) == NULL)
+		return -1;
+
+	if (next < end && *next == '\n') {
+		next++;
+		nl = memchr(next, '\n', end - next);
+		if (nl != NULL) {
+			tz->footer = (const char *)next;
+			tz->footer_len = nl - next;
+		}
+	}
+
+	return 0;
+}
+
+static const char *
+parse_name(const char *s)
+{
+	const char *start = s;
+
+	if (*s == '<') {
+		while (*s != '\0' && *s != '>')
+			s++;
+		return *s == '>' ? s + 1 : NULL;
+	}
+
+	while (isalpha((unsigned char)*s))
+		s++;
+
+	return s - start >= 3 ? s : NULL;
+}
+
+/*
+ * [+-]hh[:mm[:ss]], hours may go up to 167 for the transition times of
+ * version 3 files.
+ */
+static const char *
+parse_secs(const char *s, long *secs)
+{
+	long	sign = 1, v, part;
+	int	i;
+
+	if (*s == '+' || *s == '-')
+		sign = *s++ == '-' ? -1 : 1;
+
+	if (!isdigit((unsigned char)*s))
+		return NULL;
+	for (v = 0; isdigit((unsigned char)*s) && v <= 167; s++)
+		v = v * 10 + (*s - '0');
+	v *= 60 * 60;
+
+	for (i = 0; i < 2 && *s == ':'; i++) {
+		s++;
+		if (!isdigit((unsigned char)*s))
+			return NULL;
+		for (part = 0; isdigit((unsigned char)*s) && part < 60; s++)
+			part = part * 10 + (*s - '0');
+		v += i == 0 ? part * 60 : part;
+	}
+
+	*secs = sign * v;
+	return s;
+}
+
+static const char *
+parse_number(const char *s, int *n)
+{
+	if (!isdigit((unsigned char)*s))
+		return NULL;
+	for (*n = 0; isdigit((unsigned char)*s) && *n < 1000; s++)
+		*n = *n * 10 + (*s - '0');
+	return s;
+}
+
+static const char *
+parse_date(const char *s, struct tzrule_date *date)
+{
+	memset(date, 0, sizeof(*date));
+	date->time = 2 * 60 * 60;
+
+	if (*s == 'J') {
+		date->kind = 'J';
+		s = parse_number(s + 1, &date->d);
+		if (s == NULL || date->d < 1 || date->d > 365)
+			return NULL;
+	} else if (*s == 'M') {
+		date->kind = 'M';
+		if ((s = parse_number(s + 1, &date->m)) == NULL || *s++ != '.' ||
+		    (s = parse_number(s, &date->w)) == NULL || *s++ != '.' ||
+		    (s = parse_number(s, &date->d)) == NULL)
+			return NULL;
+		if (date->m < 1 || date->m > 12 || date->w < 1 ||
+		    date->w > 5 || date->d > 6)
+			return NULL;
+	} else {
+		date->kind = 'D';
+		s = parse_number(s, &date->d);
+		if (s == NULL || date->d > 365)
+			return NULL;
+	}
+
+	if (*s == '/')
+		s = parse_secs(s + 1, &date->time);
+
+	return s;
+}
+
+/*
+ * std offset [dst [offset] [,start[/time],end[/time]]]
+ *
+ * Note that POSIX offsets are positive west of Greenwich, the utoffs are
+ * the other way around.
+ */
+static int
+parse_rule(const char *s, struct tzrule *rule)
+{
+	long offset;
+
+	memset(rule, 0, sizeof(*rule));
+
+	if ((s = parse_name(s)) == NULL || (s = parse_secs(s, &offset)) == NULL)
+		return -1;
+	rule->std_utoff = -offset;
+
+	if (*s == '\0')
+		return 0;
+
+	if ((s = parse_name(s)) == NULL)
+		return -1;
+	rule->has_dst = 1;
+	rule->dst_utoff = rule->std_utoff + 60 * 60;
+
+	if (*s != ',' && *s != '\0') {
+		if ((s = parse_secs(s, &offset)) == NULL)
+			return -1;
+		rule->dst_utoff = -offset;
+	}
+
+	if (*s == '\0') {
+		/* The POSIX default, the US rules. */
+		s = "M3.2.0,M11.1.0";
+	} else if (*s++ != ',') {
+		return -1;
+	}
+
+	if ((s = parse_date(s, &rule->start)) == NULL || *s++ != ',' ||
+	    (s = parse_date(s, &rule->end)) == NULL || *s != '\0')
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Local time (as seconds since the epoch, as if it were UTC) at which date
+ * happens in the given year.
+ */
+static int64_t
+rule_date(const struct tzrule_date *date, long year)
+{
+	long	days, first;
+	int	mday, mdays, wday;
+	static const int monthdays[] = {
+		31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+	};
+
+	switch (date->kind) {
+	case 'J':
+		days = civil_days(year, 1, 1) + date->d - 1;
+		if (civil_leap(year) && date->d >= 60)
+			days++;
+		break;
+	case 'D':
+		days = civil_days(year, 1, 1) + date->d;
+		break;
+	default:
+		first = civil_days(year, date->m, 1);
+		/* 1970-01-01 was a thursday. */
+		wday = ((first + 4) % 7 + 7) % 7;
+		mday = 1 + (date->d - wday + 7) % 7;
+		mday += (date->w - 1) * 7;
+		mdays = monthdays[date->m - 1] + (date->m == 2 && civil_leap(year));
+		while (mday > mdays)
+			mday -= 7;
+		days = first + mday - 1;
+		break;
+	}
+
+	return (int64_t)days * SECSPERDAY + date->time;
+}
+
+static size_t
+add_change(int64_t change, time_t start, time_t end, time_t *table,
+    size_t n, size_t size)
+{
+	/* The last second before the change, like bisect() returns. */
+	change -= 1;
+
+	if (change >= start && change < end && n < size)
+		table[n++] = change;
+
+	return n;
+}
+
+static size_t
+rule_changes(const struct tzrule *rule, int64_t after, time_t start,
+    time_t end, time_t *table, size_t n, size_t size)
+{
+	int64_t	on, off, first, second;
+	long	year;
+
+	if (!rule->has_dst)
+		return n;
+
+	year = year_of(start > after ? start : (time_t)after);
+	for (; year <= year_of(end) && n < size; year++) {
+		on = rule_date(&rule->start, year) - rule->std_utoff;
+		off = rule_date(&rule->end, year) - rule->dst_utoff;
+
+		first = on < off ? on : off;
+		second = on < off ? off : on;
+
+		if (first > after)
+			n = add_change(first, start, end, table, n, size);
+		if (second > after)
+			n = add_change(second, start, end, table, n, size);
+	}
+
+	return n;
+}
+
+/*
+ * Figure out which file describes the active zone. Returns 0 and fills path,
+ * 1 if TZ is a POSIX rule instead of a zone name (*posix points to it), or
+ * -1 if it's UTC without any daylight saving time.
+ */
+static int
+zone_path(char *path, size_t len, const char **posix)
+{
+	const char	*tz, *tzdir;
+	int		 r;
+
+	tz = getenv("TZ");
+	if (tz == NULL) {
+		r = snprintf(path, len, "%s", TZDEFAULT);
+		return r < 0 || (size_t)r >= len ? -1 : 0;
+	}
+
+	if (*tz == ':')
+		tz++;
+	if (*tz == '\0')
+		return -1;
+
+	if (*tz == '/') {
+		r = snprintf(path, len, "%s", tz);
+	} else {
+		if ((tzdir = getenv("TZDIR")) == NULL)
+			tzdir = TZDIR;
+		r = snprintf(path, len, "%s/%s", tzdir, tz);
+	}
+	if (r < 0 || (size_t)r >= len)
+		return -1;
+
+	if (access(path, R_OK) == -1) {
+		*posix = tz;
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+tzfile_identity(char *id, size_t len)
+{
+	char		 path[PATH_MAX];
+	const char	*posix = NULL, *tz;
+	struct stat	 sb;
+	int		 r;
+
+	if ((tz = getenv("TZ")) == NULL)
+		tz = "";
+
+	switch (zone_path(path, sizeof(path), &posix)) {
+	case 0:
+		if (stat(path, &sb) == -1)
+			return -1;
+		r = snprintf(id, len, "TZ=%s;%s;%llu:%llu:%lld:%lld", tz, path,
+		    (unsigned long long)sb.st_dev, (unsigned long long)sb.st_ino,
+		    (long long)sb.st_size, (long long)sb.st_mtime);
+		break;
+	default:
+		r = snprintf(id, len, "TZ=%s", tz);
+		break;
+	}
+
+	return r < 0 || (size_t)r >= len ? -1 : 0;
+}
+
+static struct tztrans
+type_trans(const struct tzdata *tz, uint32_t type)
+{
+	struct tztrans tr;
+
+	tr.time = INT64_MIN;
+	tr.utoff = (int32_t)get32(tz->types + type * 6);
+	tr.isdst = type_isdst(tz, type);
+
+	return tr;
+}
+
+static int
+zone_read(const char *path, struct tzzone *z)
+{
+	char		 footer[256];
+	struct tzdata	 tz;
+	struct stat	 sb;
+	void		*map;
+	uint32_t	 i;
+	int		 fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+	if (fstat(fd, &sb) == -1 || sb.st_size < TZIF_HEADER) {
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	if (parse_tzif(map, sb.st_size, &tz) == -1 ||
+	    (z->trans = calloc(tz.timecnt + 1, sizeof(*z->trans))) == NULL) {
+		munmap(map, sb.st_size);
+		return -1;
+	}
+
+	/* Before the first transition local time type 0 is in effect. */
+	z->first = type_trans(&tz, 0);
+	for (i = 0; i < tz.timecnt; i++) {
+		z->trans[i] = type_trans(&tz, tz.idxs[i]);
+		z->trans[i].time = get_time(&tz, i);
+	}
+	z->ntrans = tz.timecnt;
+
+	if (tz.footer_len > 0 && tz.footer_len < sizeof(footer)) {
+		memcpy(footer, tz.footer, tz.footer_len);
+		footer[tz.footer_len] = '\0';
+		z->has_rule = parse_rule(footer, &z->rule) == 0;
+	}
+
+	munmap(map, sb.st_size);
+
+	return 0;
+}
+
+static struct tzzone *
+zone_load(const char *tzenv)
+{
+	char		 path[PATH_MAX];
+	const char	*posix = NULL;
+	struct tzzone	*z;
+
+	if ((z = calloc(1, sizeof(*z))) == NULL)
+		return NULL;
+	if (tzenv != NULL && (z->tz = strdup(tzenv)) == NULL) {
+		free(z);
+		return NULL;
+	}
+
+	switch (zone_path(path, sizeof(path), &posix)) {
+	case -1:
+		break;
+	case 1:
+		z->error = parse_rule(posix, &z->rule) == -1;
+		z->has_rule = !z->error;
+		break;
+	default:
+		z->error = zone_read(path, z) == -1;
+		break;
+	}
+
+	return z;
+}
+
+/*
+ * The zone of the current value of TZ, read the first time it's asked for.
+ * Two threads reading the same zone at once both add it, which is harmless.
+ */
+static const struct tzzone *
+zone_get(void)
+{
+	const char	*tzenv = getenv("TZ");
+	struct tzzone	*z;
+
+	for (z = __atomic_load_n(&zones, __ATOMIC_ACQUIRE); z != NULL; z = z->next) {
+		if (tzenv == NULL ? z->tz == NULL :
+		    z->tz != NULL && strcmp(z->tz, tzenv) == 0)
+			return z;
+	}
+
+	if ((z = zone_load(tzenv)) == NULL)
+		return NULL;
+	z->next = __atomic_load_n(&zones, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&zones, &z->next, z, 0,
+	    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+
+	return z;
+}
+
+/* The offset the rule puts in effect at t. */
+static struct tztrans
+rule_trans(const struct tzrule *rule, int64_t t)
+{
+	struct tztrans	tr = { t, rule->std_utoff, 0 };
+	int64_t		on, off;
+	long		year;
+
+	if (!rule->has_dst)
+		return tr;
+
+	year = year_of(t + rule->std_utoff);
+	on = rule_date(&rule->start, year) - rule->std_utoff;
+	off = rule_date(&rule->end, year) - rule->dst_utoff;
+
+	/* South of the equator daylight saving time spans the new year. */
+	if (on < off)
+		tr.isdst = t >= on && t < off;
+	else
+		tr.isdst = t >= on || t < off;
+	if (tr.isdst)
+		tr.utoff = rule->dst_utoff;
+
+	return tr;
+}
+
+int
+tzfile_local(time_t t, long *utoff)
+{
+	const struct tzzone	*z;
+	struct tztrans		 tr;
+	uint32_t		 lo, hi, mid;
+
+	if ((z = zone_get()) == NULL || z->error)
+		return -1;
+
+	if (z->has_rule && (z->ntrans == 0 || t > z->trans[z->ntrans - 1].time)) {
+		tr = rule_trans(&z->rule, t);
+	} else if (z->ntrans == 0 || t < z->trans[0].time) {
+		tr = z->first;
+	} else {
+		/* The last transition at or before t. */
+		lo = 0;
+		hi = z->ntrans;
+		while (hi - lo > 1) {
+			mid = lo + (hi - lo) / 2;
+			if (z->trans[mid].time <= t)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		tr = z->trans[lo];
+	}
+
+	*utoff = tr.utoff;
+	return tr.isdst;
+}
+
+ssize_t
+tzfile_dst_changes(time_t start, time_t end, time_t *table, size_t size)
+{
+	const struct tzzone	*z;
+	int64_t			 after = INT64_MIN;
+	size_t			 n = 0;
+	uint32_t		 i;
+	int			 prev_isdst;
+
+	if ((z = zone_get()) == NULL || z->error)
+		return -1;
+
+	prev_isdst = z->first.isdst;
+	for (i = 0; i < z->ntrans; i++) {
+		if (z->trans[i].isdst != prev_isdst)
+			n = add_change(z->trans[i].time, start, end, table, n, size);
+		prev_isdst = z->trans[i].isdst;
+		after = z->trans[i].time;
+	}
+
+	if (z->has_rule)
+		n = rule_changes(&z->rule, after, start, end, table, n, size);
+
+	return n;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <time.h>
+
+/*
+ * Store the daylight saving time changes of the active time zone (TZ, or
+ * /etc/localtime) between start and end in table. Like bisect(), every
+ * entry is the last second before the wall clock changes.
+ *
+ * Returns the number of changes stored, or -1 if the zone couldn't be read
+ * and the caller should fall back to asking libc.
+ */
+ssize_t	tzfile_dst_changes(time_t start, time_t end, time_t *table, size_t size);
+
+/*
+ * The offset from UTC of the active time zone at t, in seconds east, like
+ * tm_gmtoff. Returns whether it's daylight saving time, or -1 if the zone
+ * couldn't be read and the caller should fall back to asking libc.
+ */
+int	tzfile_local(time_t t, long *utoff);
+
+/*
+ * A string identifying the active time zone and the version of its zone
+ * file, for caching the result of the above. Returns -1 if it doesn't fit.
+ */
+int	tzfile_identity(char *id, size_t len);
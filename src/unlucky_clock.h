@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The shifted time for programs linked against libunlucky, rather than
+ * having it preloaded. unlucky_now() is inline: once the library is
+ * initialized it reads the clock through the resolved libc function and adds
+ * the diff itself, without going through the override. It falls back to
+ * unlucky_gettime(), which is what clock_gettime() does, while the library
+ * isn't initialized yet or when the control page, the virtual clock,
+ * recording, statistics, profiling, dilation, simulation or a timeline are
+ * in use. Both give the same results as the preloaded clock_gettime().
+ *
+ * For C++ there is unlucky_clock, a std::chrono clock on top of it.
+ */
+
+#ifndef UNLUCKY_CLOCK_H
+#define UNLUCKY_CLOCK_H
+
+#include <time.h>
+
+#ifdef __cplusplus
+#include <chrono>
+#include <ctime>
+
+extern "C" {
+#endif
+
+#include "unlucky_time.h"
+
+/* Bits in unlucky_process_flags, any of them takes unlucky_gettime(). */
+#define UNLUCKY_FLAG_CONTROL	0x01	/* state is in a control page */
+#define UNLUCKY_FLAG_VIRTUAL	0x02	/* virtual clock in use */
+#define UNLUCKY_FLAG_RECORD	0x04	/* reads are recorded */
+#define UNLUCKY_FLAG_REPLAY	0x08	/* reads are replayed */
+#define UNLUCKY_FLAG_STATS	0x10	/* calls are counted */
+#define UNLUCKY_FLAG_PROFILE	0x20	/* callers are sampled */
+#define UNLUCKY_FLAG_DILATION	0x40	/* the clocks run faster or slower */
+#define UNLUCKY_FLAG_SIMULATE	0x80	/* idle time is skipped */
+#define UNLUCKY_FLAG_TIMELINE	0x100	/* the diff changes over time */
+
+extern struct unlucky_state	unlucky_process_state;
+extern int			unlucky_process_flags;
+extern int			(*unlucky_original_clock_gettime)(clockid_t, struct timespec *);
+
+int	unlucky_gettime(clockid_t clock_id, struct timespec *tp);
+
+static inline int
+unlucky_now(struct timespec *tp)
+{
+	const struct unlucky_state	*s = &unlucky_process_state;
+	time_t				 real;
+
+	if (__builtin_expect(!__atomic_load_n(&s->initialized, __ATOMIC_ACQUIRE) ||
+	    __atomic_load_n(&unlucky_process_flags, __ATOMIC_ACQUIRE) != 0, 0))
+		return unlucky_gettime(CLOCK_REALTIME, tp);
+
+	if (unlucky_original_clock_gettime(CLOCK_REALTIME, tp) == -1)
+		return -1;
+
+	real = tp->tv_sec;
+	tp->tv_sec += s->diff;
+	if (s->mode == UNLUCKY_LEAP_SECOND)
+		tp->tv_sec += unlucky_leap_seconds(s->start_time, real);
+
+	return 0;
+}
+
+#ifdef __cplusplus
+}
+
+/* Meets the TrivialClock requirements, like std::chrono::system_clock. */
+struct unlucky_clock {
+	typedef std::chrono::nanoseconds			duration;
+	typedef duration::rep					rep;
+	typedef duration::period				period;
+	typedef std::chrono::time_point<unlucky_clock>		time_point;
+
+	static constexpr bool is_steady = false;
+
+	static time_point
+	now() noexcept
+	{
+		struct timespec ts;
+
+		unlucky_now(&ts);
+		return time_point(std::chrono::seconds(ts.tv_sec) +
+		    std::chrono::nanoseconds(ts.tv_nsec));
+	}
+
+	static std::time_t
+	to_time_t(const time_point &t) noexcept
+	{
+		return std::chrono::duration_cast<std::chrono::seconds>(
+		    t.time_since_epoch()).count();
+	}
+
+	static time_point
+	from_time_t(std::time_t t) noexcept
+	{
+		return time_point(std::chrono::seconds(t));
+	}
+};
+#endif
+
+#endif /* UNLUCKY_CLOCK_H */
@@ -15,24 +15,30 @@
  */
 
 #include <assert.h>
-#include <bsd/stdlib.h>
 #include <err.h>
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 
+#include "civil.h"
+#include "dstcache.h"
+#include "random.h"
+#include "tzfile.h"
 #include "unlucky_time.h"
 #include "utils.h"
 
 #define YEARS_IN_FUTURE 20
 
+#define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
+
 static time_t	first_of_month(time_t start_time);
 static time_t	last_of_month(time_t start_time);
 static time_t	leap_day(time_t start_time);
 static time_t	dst_change(time_t start_time);
-static int	leap_year(time_t start_time);
+static long	leap_year(time_t start_time);
 static time_t	nil(time_t start_time);
 
-static int	future_year(time_t start_time);
+static long	future_year(time_t start_time);
 static int	clock_changed(time_t start, time_t end);
 static time_t	bisect(time_t start, time_t end);
 static size_t find_dst_changes(time_t start_time, time_t *table, size_t size);
@@ -41,57 +47,114 @@ static time_t leap_seconds(time_t start_time, time_t current_time);
 static time_t normal_seconds(time_t start_time, time_t current_time);
 
 
+static const struct {
+	time_t			(*fn)(time_t);
+	time_t			(*diff_fn)(time_t, time_t);
+	enum unlucky_mode	 mode;
+	const char		*name;
+} time_functions[] = {
+	{first_of_month, normal_seconds, UNLUCKY_FIRST_OF_MONTH, "first_of_month"},
+	{last_of_month, normal_seconds, UNLUCKY_LAST_OF_MONTH, "last_of_month"},
+	{leap_day, normal_seconds, UNLUCKY_LEAP_DAY, "leap_day"},
+	{dst_change, normal_seconds, UNLUCKY_DST_CHANGE, "dst_change"},
+	{nil, leap_seconds, UNLUCKY_LEAP_SECOND, "leap_second"},
+};
+
 void
 unlucky_init(struct unlucky_state *state, time_t start_time, enum unlucky_mode mode)
 {
-	struct {
-		time_t			(*fn)(time_t);
-		time_t			(*diff_fn)(time_t, time_t);
-		enum unlucky_mode	 mode;
-	} time_functions[] = {
-		{first_of_month, normal_seconds, UNLUCKY_FIRST_OF_MONTH},
-		{last_of_month, normal_seconds, UNLUCKY_LAST_OF_MONTH},
-		{leap_day, normal_seconds, UNLUCKY_LEAP_DAY},
-		{dst_change, normal_seconds, UNLUCKY_DST_CHANGE},
-		{nil, leap_seconds, UNLUCKY_LEAP_SECOND},
-	};
 	size_t chosen_mode, mapping_size;
 
-	if (state->initialized)
+	if (__atomic_load_n(&state->initialized, __ATOMIC_ACQUIRE))
 		return;
 
-	mapping_size = sizeof(time_functions)/sizeof(time_functions[0]);
+	mapping_size = nitems(time_functions);
 
 	if (mode == UNLUCKY_RANDOM)
-		chosen_mode = arc4random_uniform(mapping_size);
+		chosen_mode = random_uniform(mapping_size);
 	else
 		chosen_mode = mode;
 
+	unlucky_set(state, start_time, chosen_mode,
+	    time_functions[chosen_mode].fn(start_time) - start_time);
+}
+
+void
+unlucky_set(struct unlucky_state *state, time_t start_time, enum unlucky_mode mode, time_t diff)
+{
+	if (mode >= nitems(time_functions))
+		mode = UNLUCKY_FIRST_OF_MONTH;
+
+	state->mode = mode;
 	state->start_time = start_time;
-	state->initialized = 1;
-	state->diff = time_functions[chosen_mode].fn(start_time) - start_time;
-	state->diff_fn = time_functions[chosen_mode].diff_fn;
+	state->diff = diff;
+	state->diff_fn = time_functions[mode].diff_fn;
+	state->dilation_num = 1;
+	state->dilation_den = 1;
+	__atomic_store_n(&state->initialized, 1, __ATOMIC_RELEASE);
+}
+
+void
+unlucky_dilate(struct unlucky_state *state, int64_t num, int64_t den)
+{
+	if (num <= 0 || den <= 0)
+		num = den = 1;
+
+	state->dilation_num = num;
+	state->dilation_den = den;
+}
+
+const char *
+unlucky_mode_name(enum unlucky_mode mode)
+{
+	if (mode == UNLUCKY_RANDOM)
+		return "random";
+	if (mode >= nitems(time_functions))
+		return NULL;
+	return time_functions[mode].name;
+}
+
+int
+unlucky_mode_parse(const char *name, enum unlucky_mode *mode)
+{
+	size_t i;
+
+	if (strcmp(name, "random") == 0) {
+		*mode = UNLUCKY_RANDOM;
+		return 0;
+	}
+
+	for (i = 0; i < nitems(time_functions); i++) {
+		if (strcmp(name, time_functions[i].name) == 0) {
+			*mode = time_functions[i].mode;
+			return 0;
+		}
+	}
+
+	return -1;
 }
 
+/*
+ * A dilated time is the start time plus the scaled time since, the diff of
+ * the mode is added to that.
+ */
 time_t
-unlucky_diff(struct unlucky_state *state, time_t current_time)
+unlucky_diff(const struct unlucky_state *state, time_t current_time)
 {
 	time_t start_time = state->start_time;
-	return state->diff + state->diff_fn(start_time, current_time);
+	time_t t = current_time;
+
+	if (state->dilation_num != state->dilation_den)
+		t = start_time + unlucky_scale(current_time - start_time,
+		    state->dilation_num, state->dilation_den);
+
+	return t - current_time + state->diff + state->diff_fn(start_time, t);
 }
 
 time_t
 leap_seconds(time_t start_time, time_t current_time)
 {
-	time_t delta, offset, leap_seconds;
-	delta = current_time - start_time;
-
-	// Every minute in the delta 1 leap second should be subtracted.
-	// The offset deals with 60 happening twice nicely, and not 59, or something else.
-	offset = ((delta/60) % 60 - start_time % 60)  % 60;
-	leap_seconds = (delta-offset-1) / 60;
-
-	return -leap_seconds;
+	return unlucky_leap_seconds(start_time, current_time);
 }
 
 static time_t
@@ -101,99 +164,132 @@ normal_seconds(time_t start_time, time_t current_time)
 }
 
 
-static int
+static long
 leap_year(time_t start_time)
 {
-	int tm_year;
+	long year;
 
 	do {
-		tm_year = future_year(start_time);
-	} while (! is_leap_year(tm_year));
+		year = future_year(start_time);
+	} while (!civil_leap(year));
 
-	return tm_year;
+	return year;
 }
 
-static int
+static long
 future_year(time_t start_time)
 {
-	int		random_offset, tm_year, current_year;
-	struct timespec	ts;
-	struct tm	tm;
+	struct civil	c;
+	int		random_offset;
 
-	random_offset = arc4random_uniform(YEARS_IN_FUTURE);
+	random_offset = random_uniform(YEARS_IN_FUTURE);
+	civil_split(start_time, &c);
 
-	if (gmtime_r(&start_time, &tm) == NULL)
-		err(1, "gmtime_r");
-
-	return tm.tm_year + random_offset;
+	return c.year + random_offset;
 }
 
-/* Return a randomized struct tm which at its latests
+/* Return a randomized time which at its latests
  * is 1 hour before the end of the day (23:00).
  */
 static void
-random_tm(struct tm *tm)
+random_civil(struct civil *c)
+{
+	c->year = 1900 + random_uniform(YEARS_IN_FUTURE);
+	c->mon = 1 + random_uniform(12);
+	c->mday = 1 + random_uniform(civil_month_days(c->year, c->mon));
+
+	c->sec = random_uniform(59);
+	c->min = random_uniform(59);
+	c->hour = random_uniform(22);
+}
+
+/*
+ * The offset from UTC at t, from the zone as read by tzfile.c, or from libc
+ * if it couldn't read it.
+ */
+static long
+utc_offset(time_t t, int *isdst)
+{
+	struct tm	tm;
+	long		utoff;
+	int		r;
+
+	if ((r = tzfile_local(t, &utoff)) != -1) {
+		*isdst = r;
+		return utoff;
+	}
+
+	if (localtime_r(&t, &tm) == NULL)
+		err(1, "localtime_r");
+	*isdst = tm.tm_isdst > 0;
+
+	return tm.tm_gmtoff;
+}
+
+/*
+ * The time at which the wall clock shows c, like mktime(). The offset at
+ * the wall clock time taken as UTC is only a guess, which is right unless
+ * the offset changes in between.
+ */
+static time_t
+local_time(const struct civil *c)
 {
-	int tm_year, tm_month, tm_mday;
-
-	tm_year = arc4random_uniform(YEARS_IN_FUTURE);
-	tm_month = arc4random_uniform(12);
-	tm_mday = arc4random_uniform(days_in_month(tm_month, tm_year));
-
-	tm->tm_sec = arc4random_uniform(59);
-	tm->tm_min = arc4random_uniform(59);
-	tm->tm_hour = arc4random_uniform(22);
-	tm->tm_mday = tm_mday;
-	tm->tm_mon = tm_month;
-	tm->tm_year = tm_year;
-	tm->tm_isdst = 0;
+	int64_t	local;
+	time_t	t;
+	int	isdst;
+
+	local = civil_time(c);
+	t = local - utc_offset(local, &isdst);
+
+	return local - utc_offset(t, &isdst);
 }
 
 static time_t
 first_of_month(time_t start_time)
 {
-	struct tm	first_of_month;
+	struct civil	first_of_month;
 
-	random_tm(&first_of_month);
+	random_civil(&first_of_month);
 
-	first_of_month.tm_mday = 1;
-	first_of_month.tm_mon = arc4random_uniform(12);
-	first_of_month.tm_year = future_year(start_time);
+	first_of_month.mday = 1;
+	first_of_month.mon = 1 + random_uniform(12);
+	first_of_month.year = future_year(start_time);
 
-	return mktime(&first_of_month);
+	return local_time(&first_of_month);
 }
 
 static time_t
 last_of_month(time_t start_time)
 {
-	struct tm	last_of_month;
-	int		tm_month, tm_year;
+	struct civil	last_of_month;
+	long		year;
+	int		mon;
 
-	tm_year = future_year(start_time);
-	tm_month = arc4random_uniform(12);
+	year = future_year(start_time);
+	mon = 1 + random_uniform(12);
 
-	random_tm(&last_of_month);
+	random_civil(&last_of_month);
 
-	last_of_month.tm_mday = days_in_month(tm_month, tm_year);
-	last_of_month.tm_mon = tm_month;
-	last_of_month.tm_year = tm_year;
+	last_of_month.mday = civil_month_days(year, mon);
+	last_of_month.mon = mon;
+	last_of_month.year = year;
 
-	return mktime(&last_of_month);
+	return local_time(&last_of_month);
 }
 
 static time_t
 leap_day(time_t start_time)
 {
-	struct tm	leap_day;
-	int tm_year = leap_year(start_time);
+	struct civil	leap_day;
+	long		year = leap_year(start_time);
 
-	random_tm(&leap_day);
+	random_civil(&leap_day);
 
-	leap_day.tm_mday = 29;
-	leap_day.tm_mon = 2;
-	leap_day.tm_year = tm_year;
+	leap_day.mday = 29;
+	leap_day.mon = 2;
+	leap_day.year = year;
 
-	return mktime(&leap_day);
+	return local_time(&leap_day);
 }
 
 /*
@@ -202,52 +298,21 @@ leap_day(time_t start_time)
 static int
 clock_changed(time_t start, time_t end)
 {
-	struct tm start_tm, end_tm;
+	int start_isdst, end_isdst;
 
-	if (localtime_r(&start, &start_tm) == NULL)
-		err(1, "localtime_r");
-	if (localtime_r(&end, &end_tm) == NULL)
-		err(1, "localtime_r");
+	utc_offset(start, &start_isdst);
+	utc_offset(end, &end_isdst);
 
-	return start_tm.tm_isdst != end_tm.tm_isdst;
+	return start_isdst != end_isdst;
 }
 
+/* How far the wall clock moved from start to end. */
 static time_t
 clock_delta(time_t start, time_t end)
 {
-#define isleap(y) (((y) % 4) == 0 && (((y) % 100) != 0 || ((y) % 400) == 0))
-#define isleap_sum(a, b)        isleap((a) % 400 + (b) % 400)
-#define DAYSPERNYEAR    365
-#define HOURSPERDAY     24
-#define TM_YEAR_BASE    1900
-#define MINSPERHOUR     60
-#define SECSPERMIN      60
-#define SECSPERHOUR     (SECSPERMIN * MINSPERHOUR)
-#define SECSPERDAY      ((int_fast32_t) SECSPERHOUR * HOURSPERDAY)
-
-	struct tm start_tm, end_tm;
-	time_t    local_start, local_end;
-        long      result;
-        int       tmy;
-
-	if (localtime_r(&start, &start_tm) == NULL)
-		err(1, "localtime_r");
-	if (localtime_r(&end, &end_tm) == NULL)
-		err(1, "localtime_r");
+	int isdst;
 
-        if (end_tm.tm_year < start_tm.tm_year)
-                return -clock_delta(start, end);
-        result = 0;
-        for (tmy = start_tm.tm_year; tmy < end_tm.tm_year; ++tmy)
-                result += DAYSPERNYEAR + isleap_sum(tmy, TM_YEAR_BASE);
-        result += end_tm.tm_yday - start_tm.tm_yday;
-        result *= HOURSPERDAY;
-        result += end_tm.tm_hour - start_tm.tm_hour;
-        result *= MINSPERHOUR;
-        result += end_tm.tm_min - start_tm.tm_min;
-        result *= SECSPERMIN;
-        result += end_tm.tm_sec - start_tm.tm_sec;
-        return result;
+	return end + utc_offset(end, &isdst) - (start + utc_offset(start, &isdst));
 }
 
 static time_t
@@ -282,7 +347,7 @@ find_dst_changes(time_t start_time, time_t *table, size_t size)
 	tzset();
 
 	start = start_time;
-	end = start + (60 * 60 * 24 * 365 * 20);
+	end = start + (60 * 60 * 24 * 365 * YEARS_IN_FUTURE);
 
 	for (current = start; current < end; ) {
 		next = current + (60 * 60 * 12);
@@ -301,16 +366,65 @@ find_dst_changes(time_t start_time, time_t *table, size_t size)
 	return i;
 }
 
+/*
+ * Fill table with the DST changes from the start of tm_year up to
+ * YEARS_IN_FUTURE years after it.
+ */
+static size_t
+year_dst_changes(int tm_year, time_t *table, size_t size)
+{
+	time_t		start, end;
+	ssize_t		n;
+
+	start = (time_t)civil_days(tm_year + 1900, 1, 1) * CIVIL_SECSPERDAY;
+	end = (time_t)civil_days(tm_year + 1900 + YEARS_IN_FUTURE + 1, 1, 1) *
+	    CIVIL_SECSPERDAY;
+
+	/*
+	 * Reading the zone's transitions directly is a lot faster than
+	 * searching for them through libc. Fall back to the latter when the
+	 * zone information can't be read.
+	 */
+	n = tzfile_dst_changes(start, end, table, size);
+	if (n == -1)
+		n = find_dst_changes(start, table, size);
+
+	return n;
+}
+
 static time_t
 dst_change(time_t start_time)
 {
 	time_t dst_changes[500], start, end, start_change, delta;
-	size_t size, i;
+	const time_t *table;
+	size_t size, first, last, i;
+	struct civil c;
+
+	/*
+	 * The table only depends on the zone and the year, so it's likely
+	 * another process computed it already.
+	 */
+	civil_split(start_time, &c);
+	table = dstcache_lookup(c.year - 1900, &size);
+	if (table == NULL) {
+		size = year_dst_changes(c.year - 1900, dst_changes, nitems(dst_changes));
+		dstcache_store(c.year - 1900, dst_changes, size);
+		table = dst_changes;
+	}
+
+	end = start_time + (60 * 60 * 24 * 365 * YEARS_IN_FUTURE);
+	for (first = 0; first < size && table[first] < start_time; first++)
+		;
+	for (last = first; last < size && table[last] < end; last++)
+		;
+
+	/* No daylight saving time in this zone. */
+	if (first == last)
+		return start_time;
 
-	size = find_dst_changes(start_time, dst_changes, sizeof *dst_changes);
-	i = arc4random_uniform(size);
+	i = first + random_uniform(last - first);
 
-	start = dst_changes[i];
+	start = table[i];
 	end = start + 1;
 	delta = clock_delta(start, end);
 	if (delta > 0) {
@@ -326,7 +440,7 @@ dst_change(time_t start_time)
 		 * until half until the repeated period (~30 minutes in this case)
 		 */
 		start -= (60 * 4);
-		start += arc4random_uniform(((-delta)/2) + (60 * 4));
+		start += random_uniform(((-delta)/2) + (60 * 4));
 	}
 
 	return start;
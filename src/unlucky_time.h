@@ -14,6 +14,11 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#ifndef UNLUCKY_TIME_H
+#define UNLUCKY_TIME_H
+
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
 
 enum unlucky_mode {
@@ -25,13 +30,93 @@ enum unlucky_mode {
 	UNLUCKY_RANDOM,
 };
 
+#define UNLUCKY_CACHELINE	64
+
+/*
+ * Written once by unlucky_init(), read on every clock read afterwards.
+ * initialized is published last (release) so a reader which sees it set
+ * (acquire) also sees the other members.
+ */
 struct unlucky_state {
 	int	initialized;
+	enum unlucky_mode mode;
 	time_t  (*diff_fn)(time_t, time_t);
 	time_t  start_time;
 	time_t	diff;
-};
+	int64_t	dilation_num;	/* time since start_time runs num/den as fast */
+	int64_t	dilation_den;
+} __attribute__((aligned(UNLUCKY_CACHELINE)));
+
+/*
+ * d * num / den without overflowing unless the result does, for scaling
+ * times by the dilation.
+ */
+static inline int64_t
+unlucky_scale(int64_t d, int64_t num, int64_t den)
+{
+	return d / den * num + d % den * num / den;
+}
+
+/*
+ * The diff_fn of UNLUCKY_LEAP_SECOND, here so the mode specific builds of
+ * the library can inline it.
+ */
+static inline time_t
+unlucky_leap_seconds(time_t start_time, time_t current_time)
+{
+	time_t delta, offset, leap_seconds;
+	delta = current_time - start_time;
+
+	// Every minute in the delta 1 leap second should be subtracted.
+	// The offset deals with 60 happening twice nicely, and not 59, or something else.
+	offset = ((delta/60) % 60 - start_time % 60)  % 60;
+	leap_seconds = (delta-offset-1) / 60;
+
+	return -leap_seconds;
+}
 
 void	unlucky_init(struct unlucky_state *state, time_t start_time, enum unlucky_mode mode);
-time_t	unlucky_diff(struct unlucky_state *state, time_t current_time);
+time_t	unlucky_diff(const struct unlucky_state *state, time_t current_time);
+
+/*
+ * Initialize state with an already chosen mode and diff, e.g. one picked by
+ * another process.
+ */
+void	unlucky_set(struct unlucky_state *state, time_t start_time, enum unlucky_mode mode, time_t diff);
+
+/*
+ * Let the shifted time run num/den times as fast as the real time from the
+ * start time on. unlucky_set() sets it back to 1/1.
+ */
+void	unlucky_dilate(struct unlucky_state *state, int64_t num, int64_t den);
+
+/*
+ * unlucky_diff() for n times at once, in place: unlucky_shift() turns real
+ * times into the shifted times a process with this state saw, and
+ * unlucky_unshift() turns shifted times back into real ones. A shifted time
+ * which occurred twice because of a leap second becomes the first of the two.
+ */
+void	unlucky_shift(const struct unlucky_state *state, time_t *t, size_t n);
+void	unlucky_unshift(const struct unlucky_state *state, time_t *t, size_t n);
+void	unlucky_shift_timespec(const struct unlucky_state *state, struct timespec *ts, size_t n);
+void	unlucky_unshift_timespec(const struct unlucky_state *state, struct timespec *ts, size_t n);
+
+const char	*unlucky_mode_name(enum unlucky_mode mode);
+int		 unlucky_mode_parse(const char *name, enum unlucky_mode *mode);
+
+
+/*
+ * A virtual clock on top of the shifted time of the process, so tests can
+ * cross the instant a mode picked without waiting for it in real time.
+ *
+ * unlucky_freeze() stops the clock at the given time (the current time if
+ * NULL), unlucky_advance() moves it forward (or backwards) by ns
+ * nanoseconds, whether frozen or not, and unlucky_resume() lets it run again
+ * from where it was frozen. unlucky_reset() goes back to the shifted time.
+ */
+void	unlucky_freeze(const struct timespec *at);
+void	unlucky_advance(int64_t ns);
+void	unlucky_resume(void);
+void	unlucky_reset(void);
 
+#endif /* UNLUCKY_TIME_H */
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Show or change the shifted time of a group of processes started with
+ * UNLUCKY_SHM=<name>, or show the clock reads of a process started with
+ * UNLUCKY_STATS.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "unlucky_time.h"
+#include "control.h"
+#include "stats.h"
+#include "utils.h"
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: unluckyctl [-u] [-d diff] [-m mode] [-s start_time] name\n"
+	    "       unluckyctl -p pid\n");
+	exit(1);
+}
+
+static long long
+parse_time(const char *s, const char *what)
+{
+	char		*end;
+	long long	 v;
+
+	errno = 0;
+	v = strtoll(s, &end, 10);
+	if (errno != 0 || *s == '\0' || *end != '\0')
+		errx(1, "invalid %s: %s", what, s);
+
+	return v;
+}
+
+static void
+show(struct unlucky_control *control)
+{
+	struct unlucky_state	state;
+	time_t			now, shifted;
+
+	memset(&state, 0, sizeof(state));
+	if (control_read(control, &state) == -1)
+		errx(1, "can't read the control page");
+
+	now = current_time();
+	shifted = now + unlucky_diff(&state, now);
+
+	printf("mode %s\n", unlucky_mode_name(state.mode));
+	printf("start_time %lld\n", (long long)state.start_time);
+	printf("diff %lld\n", (long long)state.diff);
+	printf("now %s", ctime(&shifted));
+}
+
+static void
+show_stats(const char *arg)
+{
+	const struct stats_page	*page;
+	struct stats_counter	 sum[STATS_NFN];
+
+	if ((page = stats_attach(parse_time(arg, "pid"))) == NULL)
+		errx(1, "no statistics for process %s", arg);
+
+	stats_sum(page, sum);
+	printf("seed %llu\n", (unsigned long long)page->seed);
+	stats_print(stdout, sum);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct unlucky_control	*control;
+	struct unlucky_state	 state, current;
+	enum unlucky_mode	 mode = UNLUCKY_RANDOM;
+	time_t			 start_time, diff = 0;
+	int			 ch, created, dflag = 0, mflag = 0, sflag = 0;
+	int			 uflag = 0;
+
+	while ((ch = getopt(argc, argv, "d:m:p:s:u")) != -1) {
+		switch (ch) {
+		case 'd':
+			diff = parse_time(optarg, "diff");
+			dflag = 1;
+			break;
+		case 'm':
+			if (unlucky_mode_parse(optarg, &mode) == -1)
+				errx(1, "unknown mode: %s", optarg);
+			mflag = 1;
+			break;
+		case 'p':
+			show_stats(optarg);
+			return 0;
+		case 's':
+			start_time = parse_time(optarg, "start time");
+			sflag = 1;
+			break;
+		case 'u':
+			uflag = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1)
+		usage();
+
+	if (uflag) {
+		if (control_unlink(argv[0]) == -1)
+			err(1, "%s", argv[0]);
+		return 0;
+	}
+
+	control = control_open(argv[0], dflag || mflag || sflag, &created);
+	if (control == NULL)
+		err(1, "%s", argv[0]);
+
+	if (!dflag && !mflag && !sflag) {
+		show(control);
+		return 0;
+	}
+
+	if (!sflag)
+		start_time = current_time();
+
+	/* A new mode replaces the one in the page, even if that's invalid. */
+	memset(&current, 0, sizeof(current));
+	if (!created && !mflag && control_read(control, &current) == -1)
+		errx(1, "can't read the control page");
+
+	/*
+	 * A new mode without a diff picks one like unlucky_init() would,
+	 * otherwise the mode of the group is kept.
+	 */
+	if (mflag && !dflag) {
+		memset(&state, 0, sizeof(state));
+		unlucky_init(&state, start_time, mode);
+		mode = state.mode;
+		diff = state.diff;
+	} else if (!mflag) {
+		mode = created ? UNLUCKY_FIRST_OF_MONTH : current.mode;
+		if (!dflag)
+			diff = current.diff;
+	} else if (mode == UNLUCKY_RANDOM) {
+		errx(1, "a diff needs a mode other than random");
+	}
+
+	control_write(control, mode, start_time, diff);
+	show(control);
+
+	return 0;
+}
@@ -14,13 +14,80 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#define _GNU_SOURCE
+
 #include <sys/time.h>
 #include <time.h>
 #include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "override.h"
 #include "utils.h"
 
+gettimeofday_func_t	original_gettimeofday;
+time_func_t		original_time;
+clock_gettime_func_t	original_clock_gettime;
+timespec_get_func_t	original_timespec_get;
+ftime_func_t		original_ftime;
+
+clock_nanosleep_func_t		original_clock_nanosleep;
+pthread_cond_timedwait_func_t	original_pthread_cond_timedwait;
+pthread_cond_clockwait_func_t	original_pthread_cond_clockwait;
+sem_timedwait_func_t		original_sem_timedwait;
+sem_clockwait_func_t		original_sem_clockwait;
+timer_settime_func_t		original_timer_settime;
+timerfd_settime_func_t		original_timerfd_settime;
+
+nanosleep_func_t	original_nanosleep;
+usleep_func_t		original_usleep;
+sleep_func_t		original_sleep;
+poll_func_t		original_poll;
+select_func_t		original_select;
+#ifdef __linux__
+epoll_wait_func_t	original_epoll_wait;
+#endif
+
+pthread_create_func_t		original_pthread_create;
+pthread_join_func_t		original_pthread_join;
+pthread_cond_wait_func_t	original_pthread_cond_wait;
+sem_wait_func_t			original_sem_wait;
+
+syscall_func_t			original_syscall;
+
+posix_spawn_func_t		original_posix_spawn;
+posix_spawn_func_t		original_posix_spawnp;
+system_func_t			original_system;
+popen_func_t			original_popen;
+pclose_func_t			original_pclose;
+
+stat_func_t			original_stat;
+stat_func_t			original_lstat;
+fstat_func_t			original_fstat;
+fstatat_func_t			original_fstatat;
+utimensat_func_t		original_utimensat;
+futimens_func_t			original_futimens;
+utimes_func_t			original_utimes;
+utime_func_t			original_utime;
+#ifdef UNLUCKY_STATX
+statx_func_t			original_statx;
+#endif
+#ifdef UNLUCKY_STAT64
+stat64_func_t			original_stat64;
+stat64_func_t			original_lstat64;
+fstat64_func_t			original_fstat64;
+fstatat64_func_t		original_fstatat64;
+xstat_func_t			original_xstat;
+xstat_func_t			original_lxstat;
+fxstat_func_t			original_fxstat;
+fxstatat_func_t			original_fxstatat;
+xstat64_func_t			original_xstat64;
+xstat64_func_t			original_lxstat64;
+fxstat64_func_t			original_fxstat64;
+fxstatat64_func_t		original_fxstatat64;
+#endif
+
 time_t
 current_time(void)
 {
@@ -75,3 +142,22 @@ is_leap_year(int tm_year)
 	else
 		return 1; // leap year
 }
+
+/*
+ * Copy path into buf with a %p replaced by the process id, so every process
+ * of a tree can write to a file of its own. Returns -1 if it doesn't fit.
+ */
+int
+pid_path(const char *path, char *buf, size_t len)
+{
+	const char	*p;
+	int		 r;
+
+	if ((p = strstr(path, "%p")) != NULL)
+		r = snprintf(buf, len, "%.*s%d%s", (int)(p - path), path,
+		    (int)getpid(), p + 2);
+	else
+		r = snprintf(buf, len, "%s", path);
+
+	return r < 0 || (size_t)r >= len ? -1 : 0;
+}
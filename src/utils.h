@@ -4,3 +4,4 @@
 time_t current_time(void);
 int days_in_month(int tm_month, int tm_year);
 int is_leap_year(int tm_year);
+int pid_path(const char *path, char *buf, size_t len);
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * The vDSO is an ELF image the kernel maps into every process, and newer
+ * kernels seal it. So it's copied instead, the symbols of the copy are
+ * pointed at the hooks or back at the real vDSO, and AT_SYSINFO_EHDR at the
+ * copy. The code of the copy is never run, libc's pointers into the real
+ * vDSO stay what they were.
+ */
+
+#ifdef __linux__
+#include <sys/auxv.h>
+#include <sys/mman.h>
+
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+#include "vdso.h"
+
+#ifdef __linux__
+/* Where vaddr 0 of the image at base would be. */
+static uintptr_t
+_bias(uintptr_t base)
+{
+	const ElfW(Ehdr)	*eh = (const ElfW(Ehdr) *)base;
+	const ElfW(Phdr)	*ph = (const ElfW(Phdr) *)(base + eh->e_phoff);
+	size_t			 i;
+
+	for (i = 0; i < eh->e_phnum; i++)
+		if (ph[i].p_type == PT_LOAD)
+			return base + ph[i].p_offset - ph[i].p_vaddr;
+
+	return base;
+}
+
+static size_t
+_image_size(uintptr_t base)
+{
+	const ElfW(Ehdr)	*eh = (const ElfW(Ehdr) *)base;
+	const ElfW(Phdr)	*ph = (const ElfW(Phdr) *)(base + eh->e_phoff);
+	size_t			 i, size;
+
+	size = eh->e_shoff + (size_t)eh->e_shnum * eh->e_shentsize;
+	for (i = 0; i < eh->e_phnum; i++)
+		if (ph[i].p_type == PT_LOAD && ph[i].p_offset + ph[i].p_filesz > size)
+			size = ph[i].p_offset + ph[i].p_filesz;
+
+	return size;
+}
+
+static int
+_relocate(uintptr_t copy, uintptr_t real_bias, const struct vdso_hook *hooks,
+    size_t nhooks)
+{
+	const ElfW(Ehdr)	*eh = (const ElfW(Ehdr) *)copy;
+	const ElfW(Shdr)	*sh, *strtab;
+	ElfW(Sym)		*sym;
+	const char		*str, *name;
+	uintptr_t		 bias = _bias(copy), value;
+	size_t			 i, j, n;
+	int			 hooked = 0;
+
+	sh = (const ElfW(Shdr) *)(copy + eh->e_shoff);
+	for (i = 0; i < eh->e_shnum; i++) {
+		if (sh[i].sh_type != SHT_DYNSYM || sh[i].sh_link >= eh->e_shnum)
+			continue;
+
+		strtab = &sh[sh[i].sh_link];
+		str = (const char *)(copy + strtab->sh_offset);
+		sym = (ElfW(Sym) *)(copy + sh[i].sh_offset);
+		for (n = sh[i].sh_size / sizeof(*sym); n > 0; n--, sym++) {
+			if (sym->st_shndx == SHN_UNDEF || sym->st_shndx == SHN_ABS ||
+			    sym->st_name >= strtab->sh_size)
+				continue;
+
+			name = str + sym->st_name;
+			value = real_bias + sym->st_value;
+			for (j = 0; j < nhooks; j++) {
+				if (strcmp(name, hooks[j].name) == 0) {
+					value = (uintptr_t)hooks[j].fn;
+					hooked++;
+					break;
+				}
+			}
+			sym->st_value = value - bias;
+		}
+	}
+
+	return hooked;
+}
+
+/*
+ * The auxiliary vector, which the kernel put after the environment the
+ * process started with. environ isn't that anymore once setenv(3) moved it,
+ * and unsetenv(3) moves its entries, so it's found from argv. What's found
+ * there is only used if it's the vector the kernel says it gave.
+ */
+static ElfW(auxv_t) *
+_auxv(int argc, char **argv)
+{
+	ElfW(auxv_t)	  kernel[64], *auxv;
+	char		**envp;
+	ssize_t		  r;
+	size_t		  len = 0;
+	int		  fd;
+
+	if (argv == NULL || argc < 0 || argv[argc] != NULL)
+		return NULL;
+
+	if ((fd = open("/proc/self/auxv", O_RDONLY | O_CLOEXEC)) == -1)
+		return NULL;
+	while (len < sizeof(kernel) &&
+	    (r = read(fd, (char *)kernel + len, sizeof(kernel) - len)) != 0) {
+		if (r == -1) {
+			close(fd);
+			return NULL;
+		}
+		len += r;
+	}
+	close(fd);
+	if (len < sizeof(kernel[0]))
+		return NULL;
+
+	for (envp = argv + argc + 1; *envp != NULL; envp++)
+		;
+	auxv = (ElfW(auxv_t) *)(envp + 1);
+	if (memcmp(auxv, kernel, len - len % sizeof(kernel[0])) != 0)
+		return NULL;
+
+	return auxv;
+}
+
+int
+vdso_redirect(int argc, char **argv, const struct vdso_hook *hooks, size_t n)
+{
+	const ElfW(Ehdr)	*eh;
+	ElfW(auxv_t)		*auxv;
+	uintptr_t		 base;
+	size_t			 size;
+	void			*copy;
+	int			 hooked;
+
+	if ((base = getauxval(AT_SYSINFO_EHDR)) == 0 ||
+	    (auxv = _auxv(argc, argv)) == NULL)
+		return -1;
+	eh = (const ElfW(Ehdr) *)base;
+	if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 || eh->e_shoff == 0 ||
+	    eh->e_shentsize != sizeof(ElfW(Shdr)))
+		return -1;
+
+	size = _image_size(base);
+	copy = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+	    -1, 0);
+	if (copy == MAP_FAILED)
+		return -1;
+	memcpy(copy, eh, size);
+
+	if ((hooked = _relocate((uintptr_t)copy, _bias(base), hooks, n)) == 0) {
+		munmap(copy, size);
+		return 0;
+	}
+	mprotect(copy, size, PROT_READ);
+
+	for (; auxv->a_type != AT_NULL; auxv++) {
+		if (auxv->a_type == AT_SYSINFO_EHDR && auxv->a_un.a_val == base) {
+			auxv->a_un.a_val = (uintptr_t)copy;
+			return hooked;
+		}
+	}
+
+	munmap(copy, size);
+	return -1;
+}
+#else
+int
+vdso_redirect(int argc, char **argv, const struct vdso_hook *hooks, size_t n)
+{
+	return -1;
+}
+#endif
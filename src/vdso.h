@@ -0,0 +1,36 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <stddef.h>
+
+struct vdso_hook {
+	const char	*name;
+	void		*fn;
+};
+
+/*
+ * Make runtimes which find the vDSO functions themselves, through
+ * AT_SYSINFO_EHDR, like Go's, call the hooks instead. argv is the one the
+ * process started with, the environment it started with and the auxiliary
+ * vector follow it. Returns the number of hooks installed, or -1.
+ */
+int	vdso_redirect(int argc, char **argv, const struct vdso_hook *hooks,
+	    size_t n);
+
+#endif /* VDSO_H */
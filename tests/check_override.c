@@ -18,7 +18,14 @@
 #include <check.h>
 #include <stdlib.h>
 
+#include <sys/stat.h>
+#include <sys/timeb.h>
+#include <sys/wait.h>
+
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
@@ -26,6 +33,7 @@
 
 #include "../src/override.h"
 #include "../src/unlucky_time.h"
+#include "../src/unlucky_clock.h"
 #include "../src/utils.h"
 
 time_t	consistent_time(void);
@@ -189,6 +197,331 @@ START_TEST(test_clock_gettime)
 }
 END_TEST
 
+/*
+ * The other clocks which follow the wall clock, and the other functions to
+ * read it, should be shifted by the same diff.
+ */
+START_TEST(test_realtime_clocks)
+{
+	clockid_t	clocks[] = { CLOCK_REALTIME_COARSE, CLOCK_TAI };
+	struct timespec	tval, tval_orig;
+	struct timeb	tb;
+	time_t		diff;
+	size_t		i;
+
+	for (i = 0; i < sizeof(clocks) / sizeof(clocks[0]); i++) {
+		ck_assert_int_eq(clock_gettime(clocks[i], &tval), 0);
+		ck_assert_int_eq(original_clock_gettime(clocks[i], &tval_orig), 0);
+		diff = gettimediff(tval_orig.tv_sec);
+		ck_assert(tval.tv_sec - tval_orig.tv_sec - diff <= 0);
+		ck_assert(tval.tv_sec - tval_orig.tv_sec - diff >= -1);
+	}
+
+	ck_assert_int_eq(timespec_get(&tval, TIME_UTC), TIME_UTC);
+	ck_assert_int_eq(original_timespec_get(&tval_orig, TIME_UTC), TIME_UTC);
+	diff = gettimediff(tval_orig.tv_sec);
+	ck_assert(tval.tv_sec - tval_orig.tv_sec - diff <= 0);
+	ck_assert(tval.tv_sec - tval_orig.tv_sec - diff >= -1);
+
+	ck_assert_int_eq(ftime(&tb), 0);
+	ck_assert_int_eq(original_clock_gettime(CLOCK_REALTIME, &tval_orig), 0);
+	diff = gettimediff(tval_orig.tv_sec);
+	ck_assert(tb.time - tval_orig.tv_sec - diff <= 0);
+	ck_assert(tb.time - tval_orig.tv_sec - diff >= -1);
+
+	// Clocks which don't follow the wall clock are left alone.
+	ck_assert_int_eq(clock_gettime(CLOCK_MONOTONIC, &tval), 0);
+	ck_assert_int_eq(original_clock_gettime(CLOCK_MONOTONIC, &tval_orig), 0);
+	ck_assert(tval_orig.tv_sec - tval.tv_sec <= 1);
+}
+END_TEST
+
+#define THREAD_CALLS	200000
+#define MAX_THREADS	16
+
+struct thread_result {
+	int	 consistent;
+	double	 ns_per_call;
+};
+
+static void *
+clock_reader(void *arg)
+{
+	struct thread_result	*result = arg;
+	struct timespec		 start, end, tval, tval_orig;
+	int			 i;
+
+	result->consistent = 1;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+	for (i = 0; i < THREAD_CALLS; i++) {
+		if (clock_gettime(CLOCK_REALTIME, &tval) == -1)
+			result->consistent = 0;
+	}
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+
+	result->ns_per_call = ((end.tv_sec - start.tv_sec) * 1e9 +
+	    (end.tv_nsec - start.tv_nsec)) / THREAD_CALLS;
+
+	original_clock_gettime(CLOCK_REALTIME, &tval_orig);
+	if (tval.tv_sec - tval_orig.tv_sec != gettimediff(tval_orig.tv_sec) &&
+	    tval.tv_sec + 1 - tval_orig.tv_sec != gettimediff(tval_orig.tv_sec))
+		result->consistent = 0;
+
+	return NULL;
+}
+
+static double
+run_clock_readers(int nthreads)
+{
+	pthread_t		threads[MAX_THREADS];
+	struct thread_result	results[MAX_THREADS];
+	double			total = 0;
+	int			i;
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, clock_reader, &results[i]) != 0) {
+			perror("pthread_create");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
+		if (!results[i].consistent)
+			return -1;
+		total += results[i].ns_per_call;
+	}
+
+	return total / nthreads;
+}
+
+/*
+ * Read the clock from 1 up to N threads at the same time. Every thread should
+ * get the shifted time, and as the hot path doesn't write to any shared
+ * cache line the per-call cost (in thread cpu time) should stay roughly the
+ * same regardless of the number of threads.
+ */
+START_TEST(test_threads)
+{
+	double	single, multi;
+	long	nthreads;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 2)
+		nthreads = 2;
+	if (nthreads > MAX_THREADS)
+		nthreads = MAX_THREADS;
+
+	single = run_clock_readers(1);
+	ck_assert(single >= 0);
+	multi = run_clock_readers(nthreads);
+	ck_assert(multi >= 0);
+
+	fprintf(stderr, "clock_gettime: %.1f ns/call (1 thread), "
+	    "%.1f ns/call (%ld threads)\n", single, multi, nthreads);
+
+	ck_assert(multi < single * 4);
+}
+END_TEST
+
+/*
+ * Freeze the clock just before Amsterdam switches to summer time, and step
+ * across it.
+ */
+START_TEST(test_virtual_clock)
+{
+	struct timespec	at, tval;
+	struct timeval	tv;
+	struct tm	before_tm, after_tm;
+	time_t		before, after;
+
+	setenv("TZ", "Europe/Amsterdam", 1);
+	tzset();
+
+	// 2016-03-27 00:59:59 UTC, a second before 02:00 CET becomes 03:00 CEST.
+	at.tv_sec = 1459040399;
+	at.tv_nsec = 500000000;
+	unlucky_freeze(&at);
+
+	before = time(NULL);
+	ck_assert_int_eq(before, at.tv_sec);
+	ck_assert_int_eq(consistent_clock_gettime(), at.tv_sec);
+	ck_assert_int_eq(consistent_gettimeofday(), at.tv_sec);
+	usleep(10000);
+	clock_gettime(CLOCK_REALTIME, &tval);
+	ck_assert_int_eq(tval.tv_nsec, at.tv_nsec);
+
+	unlucky_advance(1000000000);
+	after = time(NULL);
+	ck_assert_int_eq(after, at.tv_sec + 1);
+	gettimeofday(&tv, NULL);
+	ck_assert_int_eq(tv.tv_usec, at.tv_nsec / 1000);
+
+	localtime_r(&before, &before_tm);
+	localtime_r(&after, &after_tm);
+	ck_assert_int_eq(before_tm.tm_isdst, 0);
+	ck_assert_int_eq(after_tm.tm_isdst, 1);
+
+	// Runs again from the frozen time.
+	unlucky_resume();
+	after = time(NULL);
+	ck_assert(after >= at.tv_sec + 1 && after <= at.tv_sec + 3);
+
+	unlucky_advance(-2000000000LL);
+	ck_assert(time(NULL) >= at.tv_sec - 1 && time(NULL) <= at.tv_sec + 1);
+
+	unlucky_reset();
+	unsetenv("TZ");
+	tzset();
+
+	ck_assert(consistent_time() != at.tv_sec);
+}
+END_TEST
+
+/*
+ * unlucky_now() skips the override, but should return the same time as
+ * clock_gettime() does, also when the virtual clock is in use.
+ */
+START_TEST(test_unlucky_now)
+{
+	struct timespec	now, tval, at;
+	int		i;
+
+	for (i = 0; i < 1000; i++) {
+		ck_assert_int_eq(unlucky_now(&now), 0);
+		ck_assert_int_eq(clock_gettime(CLOCK_REALTIME, &tval), 0);
+		ck_assert(tval.tv_sec - now.tv_sec >= 0);
+		ck_assert(tval.tv_sec - now.tv_sec <= 1);
+	}
+
+	at.tv_sec = 1451724835;
+	at.tv_nsec = 42;
+	unlucky_freeze(&at);
+	ck_assert_int_eq(unlucky_now(&now), 0);
+	unlucky_reset();
+
+	ck_assert_int_eq(now.tv_sec, at.tv_sec);
+	ck_assert_int_eq(now.tv_nsec, at.tv_nsec);
+}
+END_TEST
+
+/*
+ * A child gets the diff of its parent, and passes it on in UNLUCKY_STATE to
+ * the programs it executes.
+ */
+START_TEST(test_fork)
+{
+	time_t	diff;
+	pid_t	pid;
+	int	status;
+
+	diff = gettimediff(original_time(NULL));
+
+	if ((pid = fork()) == 0) {
+		if (getenv("UNLUCKY_STATE") == NULL)
+			_exit(1);
+		_exit(gettimediff(original_time(NULL)) == diff ? 0 : 2);
+	}
+	ck_assert(pid != -1);
+	ck_assert_int_eq(waitpid(pid, &status, 0), pid);
+	ck_assert(WIFEXITED(status));
+	ck_assert_int_eq(WEXITSTATUS(status), 0);
+}
+END_TEST
+
+static int64_t
+elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000 +
+	    (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/*
+ * A deadline on the shifted clock, ten years ahead of the real one, is
+ * waited for as long as it is away on the shifted clock.
+ */
+START_TEST(test_deadlines)
+{
+	pthread_mutex_t	mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t	cond = PTHREAD_COND_INITIALIZER;
+	struct timespec	begin, deadline;
+	int64_t		ms;
+
+	unlucky_advance(10LL * 365 * 86400 * 1000000000LL);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += 100000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	ck_assert_int_eq(clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME,
+	    &deadline, NULL), 0);
+	ms = elapsed_ms(&begin);
+	ck_assert(ms >= 90 && ms < 1000);
+
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += 100000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+	pthread_mutex_lock(&mutex);
+	ck_assert_int_eq(pthread_cond_timedwait(&cond, &mutex, &deadline),
+	    ETIMEDOUT);
+	pthread_mutex_unlock(&mutex);
+	ms = elapsed_ms(&begin);
+	ck_assert(ms >= 90 && ms < 1000);
+
+	unlucky_reset();
+}
+END_TEST
+
+/*
+ * A file written now is as old as the shifted time says, and the times the
+ * program gives a file are the ones it reads back.
+ */
+START_TEST(test_file_times)
+{
+	char		path[] = "/tmp/check_override.XXXXXX";
+	struct timespec	times[2];
+	struct stat	sb;
+	time_t		now;
+	int		fd;
+
+	fd = mkstemp(path);
+	ck_assert_int_ne(fd, -1);
+
+	now = time(NULL);
+	ck_assert_int_eq(fstat(fd, &sb), 0);
+	ck_assert(sb.st_mtime >= now - 2 && sb.st_mtime <= now + 2);
+
+	times[0].tv_sec = 1000000000;
+	times[0].tv_nsec = 0;
+	times[1].tv_sec = 2000000000;
+	times[1].tv_nsec = 500;
+	ck_assert_int_eq(futimens(fd, times), 0);
+	ck_assert_int_eq(stat(path, &sb), 0);
+	ck_assert_int_eq(sb.st_atim.tv_sec, 1000000000);
+	ck_assert_int_eq(sb.st_mtim.tv_sec, 2000000000);
+	ck_assert_int_eq(sb.st_mtim.tv_nsec, 500);
+
+	times[0].tv_nsec = UTIME_OMIT;
+	times[1].tv_nsec = UTIME_NOW;
+	ck_assert_int_eq(utimensat(AT_FDCWD, path, times, 0), 0);
+	ck_assert_int_eq(lstat(path, &sb), 0);
+	ck_assert_int_eq(sb.st_atim.tv_sec, 1000000000);
+	ck_assert(sb.st_mtime >= now - 2 && sb.st_mtime <= now + 2);
+
+	close(fd);
+	unlink(path);
+}
+END_TEST
 
 Suite * override_suite(void)
 {
@@ -204,6 +537,13 @@ Suite * override_suite(void)
     tcase_add_test(tc_core, test_gettimeofday);
     tcase_add_test(tc_core, test_clock_gettime);
     tcase_add_test(tc_core, test_consistency);
+    tcase_add_test(tc_core, test_realtime_clocks);
+    tcase_add_test(tc_core, test_threads);
+    tcase_add_test(tc_core, test_virtual_clock);
+    tcase_add_test(tc_core, test_unlucky_now);
+    tcase_add_test(tc_core, test_fork);
+    tcase_add_test(tc_core, test_deadlines);
+    tcase_add_test(tc_core, test_file_times);
 
     suite_add_tcase(s, tc_core);
 
@@ -0,0 +1,654 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Tests which run programs with the library preloaded, as it's used, and
+ * look at what they print.
+ */
+
+#include <sys/wait.h>
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/unlucky_time.h"
+#include "../src/record.h"
+
+#define LIBDIR		TOP_BUILDDIR "/.libs"
+#define HELPER		TOP_BUILDDIR "/preload_helper"
+#define PRELOAD		"LD_PRELOAD=" LIBDIR "/libunlucky.so"
+#define PRELOAD_CTOR	PRELOAD " " LIBDIR "/preload_ctor.so"
+#define RETIME		TOP_BUILDDIR "/unlucky-retime"
+#define SWEEP		TOP_BUILDDIR "/unlucky-sweep"
+
+struct result {
+	char	out[16384];
+	char	err[16384];
+	int	status;
+};
+
+extern char	**environ;
+
+static void
+_slurp(FILE *f, char *buf, size_t len)
+{
+	size_t n;
+
+	rewind(f);
+	n = fread(buf, 1, len - 1, f);
+	buf[n] = '\0';
+	fclose(f);
+}
+
+/*
+ * Run argv with the environment of the tests, without LD_PRELOAD and the
+ * UNLUCKY_ variables, plus env. What it writes is kept in r. Returns its exit
+ * status, or 128 plus the signal which killed it.
+ */
+static int
+run(struct result *r, const char *const env[], const char *const argv[])
+{
+	FILE	*out, *err;
+	char	 name[64];
+	pid_t	 pid;
+	size_t	 i, n;
+	int	 status;
+
+	if ((out = tmpfile()) == NULL || (err = tmpfile()) == NULL)
+		return -1;
+
+	if ((pid = fork()) == -1)
+		return -1;
+	if (pid == 0) {
+		dup2(fileno(out), STDOUT_FILENO);
+		dup2(fileno(err), STDERR_FILENO);
+
+		unsetenv("LD_PRELOAD");
+		for (i = 0; environ[i] != NULL; ) {
+			if (strncmp(environ[i], "UNLUCKY_", 8) != 0) {
+				i++;
+				continue;
+			}
+			n = strcspn(environ[i], "=");
+			snprintf(name, sizeof(name), "%.*s", (int)n, environ[i]);
+			unsetenv(name);
+		}
+		for (i = 0; env != NULL && env[i] != NULL; i++)
+			putenv((char *)env[i]);
+
+		execv(argv[0], (char *const *)argv);
+		_exit(127);
+	}
+
+	if (waitpid(pid, &status, 0) == -1)
+		return -1;
+	_slurp(out, r->out, sizeof(r->out));
+	_slurp(err, r->err, sizeof(r->err));
+
+	if (WIFSIGNALED(status))
+		r->status = 128 + WTERMSIG(status);
+	else
+		r->status = WEXITSTATUS(status);
+
+	return r->status;
+}
+
+/*
+ * The constructor picks the shift before main() runs, with UNLUCKY_LAZY
+ * it's picked when the clock is first read.
+ */
+START_TEST(test_constructor)
+{
+	const char	*eager[] = { PRELOAD, NULL };
+	const char	*lazy[] = { PRELOAD, "UNLUCKY_LAZY=1", NULL };
+	const char	*argv[] = { HELPER, "state", NULL };
+	struct result	 r;
+
+	ck_assert_int_eq(run(&r, eager, argv), 0);
+	ck_assert_msg(strncmp(r.out, "1 1 ", 4) == 0, "eager: %s", r.out);
+
+	ck_assert_int_eq(run(&r, lazy, argv), 0);
+	ck_assert_msg(strncmp(r.out, "0 1 ", 4) == 0, "lazy: %s", r.out);
+}
+END_TEST
+
+/*
+ * The constructor of a library preloaded after this one runs before ours,
+ * and may already call the overrides.
+ */
+START_TEST(test_early_constructor)
+{
+	static const char *const calls[] = { "", "stat", "fstat", "statx",
+	    "utimensat", "futimens", "utimes", "utime" };
+	const char	*env[] = { PRELOAD_CTOR, "UNLUCKY_VDSO=1", NULL, NULL };
+	const char	*argv[] = { HELPER, "state", NULL };
+	char		 call[64];
+	struct result	 r;
+	size_t		 i;
+
+	for (i = 0; i < sizeof(calls) / sizeof(calls[0]); i++) {
+		snprintf(call, sizeof(call), "CTOR_CALL=%s", calls[i]);
+		env[2] = call;
+		ck_assert_msg(run(&r, env, argv) == 0, "%s: %d: %s", calls[i],
+		    r.status, r.err);
+		ck_assert_msg(strncmp(r.out, "1 1 ", 4) == 0, "%s: %s", calls[i],
+		    r.out);
+	}
+}
+END_TEST
+
+/*
+ * The libraries built for a single mode use it, whatever UNLUCKY_MODE
+ * says.
+ */
+START_TEST(test_mode_libraries)
+{
+	static const struct {
+		const char	*preload;
+		const char	*mode;
+		const char	*date;
+	} libs[] = {
+		{ "LD_PRELOAD=" LIBDIR "/libunlucky-firstofmonth.so", "first_of_month", "-01" },
+		{ "LD_PRELOAD=" LIBDIR "/libunlucky-lastofmonth.so", "last_of_month", NULL },
+		{ "LD_PRELOAD=" LIBDIR "/libunlucky-leapday.so", "leap_day", "02-29" },
+		{ "LD_PRELOAD=" LIBDIR "/libunlucky-dst.so", "dst_change", NULL },
+		{ "LD_PRELOAD=" LIBDIR "/libunlucky-leapsecond.so", "leap_second", NULL },
+	};
+	const char	*state[] = { HELPER, "state", NULL };
+	const char	*date[] = { HELPER, "date", NULL };
+	const char	*env[4] = { NULL, "UNLUCKY_MODE=random", "TZ=UTC", NULL };
+	struct result	 r;
+	size_t		 i;
+
+	for (i = 0; i < sizeof(libs) / sizeof(libs[0]); i++) {
+		env[0] = libs[i].preload;
+		ck_assert_int_eq(run(&r, env, state), 0);
+		ck_assert_msg(strstr(r.out, libs[i].mode) != NULL, "%s: %s",
+		    libs[i].mode, r.out);
+
+		if (libs[i].date == NULL)
+			continue;
+		ck_assert_int_eq(run(&r, env, date), 0);
+		ck_assert_msg(strstr(r.out, libs[i].date) != NULL, "%s: %s",
+		    libs[i].mode, r.out);
+	}
+}
+END_TEST
+
+/*
+ * Compare the contents of a file with n copies of line.
+ */
+static int
+_file_is(const char *path, const char *line, size_t n)
+{
+	FILE	*f;
+	char	 buf[256];
+	size_t	 i = 0;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return 0;
+	while (fgets(buf, sizeof(buf), f) != NULL && strcmp(buf, line) == 0)
+		i++;
+	fclose(f);
+
+	return i == n;
+}
+
+/*
+ * unlucky-retime turns the Unix and ISO times of a log back into real ones,
+ * and -r turns them into shifted ones again. The log is larger than the
+ * chunks it's cut into, which end in the middle of one of the lines.
+ */
+START_TEST(test_retime)
+{
+	const char	*shifted = "at 1451811235 or 2016-01-03T08:53:55.25 x\n";
+	const char	*real = "at 1451724835 or 2016-01-02T08:53:55.25 x\n";
+	char		 dir[] = "/tmp/unlucky-retime.XXXXXX";
+	char		 in[64], out[64], back[64];
+	const char	*unshift[] = { RETIME, "-j", "2", "-m", "first_of_month",
+	    "-s", "1451724835", "-d", "86400", "-o", out, in, NULL };
+	const char	*shift[] = { RETIME, "-r", "-j", "2", "-m",
+	    "first_of_month", "-s", "1451724835", "-d", "86400", "-o", back,
+	    out, NULL };
+	struct result	 r;
+	FILE		*f;
+	size_t		 i, n;
+
+	/* A little over the 8 MB of a chunk. */
+	n = 9 * 1024 * 1024 / strlen(shifted);
+	ck_assert_int_ne((8 * 1024 * 1024) % strlen(shifted), 0);
+
+	ck_assert_ptr_ne(mkdtemp(dir), NULL);
+	snprintf(in, sizeof(in), "%s/shifted.log", dir);
+	snprintf(out, sizeof(out), "%s/real.log", dir);
+	snprintf(back, sizeof(back), "%s/back.log", dir);
+
+	ck_assert_ptr_ne(f = fopen(in, "w"), NULL);
+	for (i = 0; i < n; i++)
+		fputs(shifted, f);
+	ck_assert_int_eq(fclose(f), 0);
+
+	ck_assert_int_eq(run(&r, NULL, unshift), 0);
+	ck_assert_msg(_file_is(out, real, n), "unshift: %s", r.err);
+	ck_assert_int_eq(run(&r, NULL, shift), 0);
+	ck_assert_msg(_file_is(back, shifted, n), "shift: %s", r.err);
+
+	unlink(in);
+	unlink(out);
+	unlink(back);
+	rmdir(dir);
+}
+END_TEST
+
+/*
+ * A replay gives a program the times it read while it was recorded, also
+ * after it read them in another order.
+ */
+START_TEST(test_record_replay)
+{
+	char		 path[] = "/tmp/unlucky-record.XXXXXX";
+	char		 record[64], replay[64], want[256];
+	const char	*renv[] = { PRELOAD, record, NULL };
+	const char	*penv[] = { PRELOAD, replay, NULL };
+	const char	*reads[] = { HELPER, "reads", "rrmtr", NULL };
+	const char	*threaded[] = { HELPER, "reads", "rrmtr", "thread", NULL };
+	const char	*fewer[] = { HELPER, "reads", "rmtr", NULL };
+	struct result	 r, p;
+	const char	*nl;
+	int		 fd;
+
+	ck_assert_int_ne(fd = mkstemp(path), -1);
+	close(fd);
+	snprintf(record, sizeof(record), "UNLUCKY_RECORD=%s", path);
+	snprintf(replay, sizeof(replay), "UNLUCKY_REPLAY=%s", path);
+
+	ck_assert_int_eq(run(&r, renv, reads), 0);
+	ck_assert_int_eq(run(&p, penv, reads), 0);
+	ck_assert_str_eq(p.out, r.out);
+	ck_assert_msg(p.err[0] == '\0', "%s", p.err);
+
+	ck_assert_int_eq(run(&r, renv, threaded), 0);
+	ck_assert_int_eq(run(&p, penv, threaded), 0);
+	ck_assert_str_eq(p.out, r.out);
+
+	/* Without the second read the replay goes on with the third. */
+	ck_assert_int_eq(run(&p, penv, fewer), 0);
+	nl = strchr(r.out, '\n') + 1;
+	snprintf(want, sizeof(want), "%.*s%s", (int)(nl - r.out), r.out,
+	    strchr(nl, '\n') + 1);
+	ck_assert_str_eq(p.out, want);
+	ck_assert_msg(strstr(p.err, "1 skipped, 0 not recorded") != NULL, "%s",
+	    p.err);
+
+	unlink(path);
+}
+END_TEST
+
+/*
+ * The sequence numbers of the reads in a recording, which should run from 0
+ * to n - 1. Returns how many there are, or -1 if they don't.
+ */
+static int
+_recorded(const char *path)
+{
+	struct record_header	header;
+	struct record_entry	e;
+	FILE			*f;
+	uint64_t		 seq = 0;
+
+	if ((f = fopen(path, "r")) == NULL)
+		return -1;
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0) {
+		fclose(f);
+		return -1;
+	}
+	while (fread(&e, sizeof(e), 1, f) == 1) {
+		if ((e.seq & ((1ULL << RECORD_SEQ_BITS) - 1)) != seq++) {
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+
+	return seq;
+}
+
+/*
+ * The child of a fork records to a file of its own, the parent goes on with
+ * its recording.
+ */
+START_TEST(test_record_fork)
+{
+	char		 path[] = "/tmp/unlucky-record.XXXXXX";
+	char		 record[64], child[80];
+	const char	*env[] = { PRELOAD, record, NULL };
+	const char	*argv[] = { HELPER, "reads", "rmt", "fork", NULL };
+	struct result	 r;
+	const char	*p;
+	int		 fd, pid;
+
+	ck_assert_int_ne(fd = mkstemp(path), -1);
+	close(fd);
+	snprintf(record, sizeof(record), "UNLUCKY_RECORD=%s", path);
+
+	ck_assert_msg(run(&r, env, argv) == 0, "%s", r.err);
+	ck_assert_ptr_ne(p = strstr(r.out, "child "), NULL);
+	ck_assert_int_eq(sscanf(p, "child %d", &pid), 1);
+	snprintf(child, sizeof(child), "%s.%d", path, pid);
+
+	ck_assert_int_eq(_recorded(path), 6);
+	ck_assert_int_eq(_recorded(child), 3);
+
+	unlink(path);
+	unlink(child);
+}
+END_TEST
+
+/*
+ * With UNLUCKY_PROFILE=1 every call is sampled, and the report at exit names
+ * the function which made them.
+ */
+START_TEST(test_profile)
+{
+	const char	*env[] = { PRELOAD, "UNLUCKY_PROFILE=1", NULL };
+	const char	*argv[] = { HELPER, "profile", NULL };
+	struct result	 r;
+
+	ck_assert_int_eq(run(&r, env, argv), 0);
+	ck_assert_msg(strstr(r.err, "callers sampled every 1 calls") != NULL,
+	    "%s", r.err);
+	ck_assert_msg(strstr(r.err, "\nclock_gettime: 100 samples\n") != NULL,
+	    "%s", r.err);
+	ck_assert_msg(strstr(r.err, "100.0%  profiled_caller+") != NULL, "%s",
+	    r.err);
+}
+END_TEST
+
+/*
+ * Children get the state, however they're started, and the environment of
+ * the parent is left alone.
+ */
+START_TEST(test_state_export)
+{
+	static const char *const ways[] = { "fork", "spawn", "system", "popen" };
+	const char	*eager[] = { PRELOAD, NULL };
+	const char	*lazy[] = { PRELOAD, "UNLUCKY_LAZY=1", NULL };
+	const char	*argv[] = { HELPER, "child", NULL, NULL };
+	char		 state[128], want[512];
+	struct result	 r;
+	size_t		 i, j;
+
+	for (i = 0; i < sizeof(ways) / sizeof(ways[0]); i++) {
+		argv[2] = ways[i];
+		for (j = 0; j < 2; j++) {
+			ck_assert_int_eq(run(&r, j ? lazy : eager, argv), 0);
+			snprintf(state, sizeof(state), "%.*s",
+			    (int)strcspn(r.out, "\n"), r.out);
+			snprintf(want, sizeof(want), "%s\nnone\n%s\nnone\n",
+			    state, state);
+			ck_assert_msg(strcmp(r.out, want) == 0, "%s: %s",
+			    ways[i], r.out);
+		}
+	}
+}
+END_TEST
+
+/*
+ * The seed of a run which didn't set one is reported, in UNLUCKY_STATE and
+ * with the statistics, and gives the same shift when it's set. From a fixed
+ * start time that's the mode and the shifted start time, start + diff.
+ */
+START_TEST(test_seed)
+{
+	char		 seed[64], mode[2][32];
+	const char	*stats[] = { PRELOAD, "UNLUCKY_STATS=-",
+	    "UNLUCKY_START_TIME=1451724835", "TZ=UTC", NULL };
+	const char	*seeded[] = { PRELOAD, seed,
+	    "UNLUCKY_START_TIME=1451724835", "TZ=UTC", NULL };
+	const char	*argv[] = { HELPER, "child", "spawn", NULL };
+	struct result	 r;
+	long long	 start[2], diff[2];
+	unsigned long long value[2];
+	int		 i;
+
+	for (i = 0; i < 2; i++) {
+		ck_assert_int_eq(run(&r, i ? seeded : stats, argv), 0);
+		ck_assert_int_eq(sscanf(r.out, "%31[a-z_]:%lld:%lld:%llu",
+		    mode[i], &start[i], &diff[i], &value[i]), 4);
+		snprintf(seed, sizeof(seed), "\nseed %llu\n", value[i]);
+		ck_assert_msg(i == 1 || strstr(r.err, seed) != NULL, "%s",
+		    r.err);
+		snprintf(seed, sizeof(seed), "UNLUCKY_SEED=%llu", value[i]);
+	}
+
+	ck_assert_int_eq(value[1], value[0]);
+	ck_assert_str_eq(mode[1], mode[0]);
+	ck_assert_int_eq(start[1] + diff[1], start[0] + diff[0]);
+}
+END_TEST
+
+/* Threads which race to pick the seed end up with the same one. */
+START_TEST(test_seed_race)
+{
+	const char	*env[] = { PRELOAD, "UNLUCKY_LAZY=1", NULL };
+	const char	*argv[] = { HELPER, "seeds", NULL };
+	struct result	 r;
+	unsigned long long first, seed;
+	const char	*p;
+	int		 i, n;
+
+	for (i = 0; i < 10; i++) {
+		ck_assert_int_eq(run(&r, env, argv), 0);
+		ck_assert_int_eq(sscanf(r.out, "%llu", &first), 1);
+		for (p = r.out, n = 0; sscanf(p, "%llu", &seed) == 1; n++) {
+			ck_assert_msg(seed == first, "%s", r.out);
+			p = strchr(p, '\n') + 1;
+		}
+		ck_assert_int_eq(n, 9);
+	}
+}
+END_TEST
+
+/*
+ * unlucky-sweep runs a command in every mode, and reports the scenarios in
+ * which it failed. The library is preloaded after those of the user, and
+ * the variables of the scenarios aren't inherited.
+ */
+START_TEST(test_sweep)
+{
+	const char	*env[] = { "LD_PRELOAD=libm.so.6", "UNLUCKY_DILATION=60",
+	    NULL };
+	const char	*pass[] = { SWEEP, "-j", "2", "-n", "2", "-l",
+	    LIBDIR "/libunlucky.so", "/bin/true", NULL };
+	const char	*fail[] = { SWEEP, "-j", "2", "-n", "2", "-s",
+	    "1451724835", "-l", LIBDIR "/libunlucky.so", "/bin/sh", "-c",
+	    "echo \"$LD_PRELOAD|$UNLUCKY_DILATION\" >&2; exit 3", NULL };
+	static const char *modes[] = { "first_of_month", "last_of_month",
+	    "leap_day", "dst_change", "leap_second" };
+	struct result	 r;
+	const char	*p;
+	char		 row[64];
+	size_t		 i, n;
+
+	ck_assert_int_eq(run(&r, env, pass), 0);
+	ck_assert_msg(strncmp(r.out, "mode ", 5) == 0, "%s", r.out);
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		snprintf(row, sizeof(row), "\n%-16s %12s\n", modes[i], "ok");
+		ck_assert_msg(strstr(r.out, row) != NULL, "%s", r.out);
+	}
+
+	ck_assert_int_eq(run(&r, env, fail), 1);
+	ck_assert_msg(strstr(r.out, "  1451724835\n") != NULL, "%s", r.out);
+	for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		snprintf(row, sizeof(row), "\n%-16s %12s\n", modes[i], "2/2");
+		ck_assert_msg(strstr(r.out, row) != NULL, "%s", r.out);
+	}
+	for (n = 0, p = r.out; (p = strstr(p, ": exit 3\nlibm.so.6 "
+	    LIBDIR "/libunlucky.so|\n")) != NULL; p++)
+		n++;
+	ck_assert_msg(n == 10, "%s", r.out);
+}
+END_TEST
+
+/*
+ * With UNLUCKY_VDSO raw syscalls and the vDSO found through the auxiliary
+ * vector are shifted like time(), without it only time() is.
+ */
+START_TEST(test_raw_clocks)
+{
+	const char	*vdso[] = { "LD_PRELOAD=" LIBDIR "/libunlucky-leapday.so",
+	    "UNLUCKY_VDSO=1", NULL };
+	const char	*plain[] = { "LD_PRELOAD=" LIBDIR "/libunlucky-leapday.so",
+	    NULL };
+	const char	*unset[] = { "LD_PRELOAD=" LIBDIR "/libunlucky-leapday.so "
+	    LIBDIR "/preload_ctor.so", "UNLUCKY_VDSO=1", "CTOR_CALL=unsetenv",
+	    NULL };
+	const char	*argv[] = { HELPER, "raw", NULL };
+	const char	*loaded[] = { HELPER, "dlopen",
+	    LIBDIR "/libunlucky-leapday.so", NULL };
+	struct result	 r;
+	long long	 t, sc, vd, now;
+
+	now = time(NULL);
+	ck_assert_msg(run(&r, vdso, argv) == 0, "%s", r.err);
+	ck_assert_int_eq(sscanf(r.out, "%lld %lld %lld", &t, &sc, &vd), 3);
+	ck_assert_msg(llabs(t - now) > 86400, "not shifted: %s", r.out);
+	ck_assert_msg(llabs(sc - t) <= 1 && llabs(vd - t) <= 1, "%s", r.out);
+
+	ck_assert_msg(run(&r, plain, argv) == 0, "%s", r.err);
+	ck_assert_int_eq(sscanf(r.out, "%lld %lld %lld", &t, &sc, &vd), 3);
+	ck_assert_msg(llabs(t - now) > 86400, "not shifted: %s", r.out);
+	ck_assert_msg(llabs(sc - now) <= 1 && llabs(vd - now) <= 1, "%s", r.out);
+
+	/*
+	 * Loaded with dlopen() after setenv() moved the environment, the
+	 * auxiliary vector is still found, though the overrides aren't used
+	 * then. When unsetenv() moved the entries in front of it, what's found
+	 * there isn't taken for it.
+	 */
+	ck_assert_msg(run(&r, vdso + 1, loaded) == 0, "%s", r.err);
+	ck_assert_int_eq(sscanf(r.out, "%lld %lld %lld", &t, &sc, &vd), 3);
+	ck_assert_msg(strstr(r.err, "can't redirect") == NULL, "%s", r.err);
+
+	ck_assert_msg(run(&r, unset, argv) == 0, "%s", r.err);
+	ck_assert_int_eq(sscanf(r.out, "%lld %lld %lld", &t, &sc, &vd), 3);
+	ck_assert_msg(llabs(vd - now) <= 1, "%s", r.out);
+	ck_assert_msg(strstr(r.err, "can't redirect") != NULL, "%s", r.err);
+}
+END_TEST
+
+/*
+ * With UNLUCKY_SIMULATE a sleep of the only thread is skipped, but not one
+ * while another thread is busy, whether or not pthread_create() started it.
+ * A signal still ends it, and a child of a fork sleeps on its own.
+ */
+START_TEST(test_simulate)
+{
+	const char	*env[] = { PRELOAD, "UNLUCKY_SIMULATE=1", NULL };
+	const char	*alone[] = { HELPER, "sim", "none", "3600", NULL };
+	const char	*seen[] = { HELPER, "sim", "seen", "0.3", NULL };
+	const char	*unseen[] = { HELPER, "sim", "unseen", "0.3", NULL };
+	const char	*signal[] = { HELPER, "sim", "seen", "10", "signal", NULL };
+	const char	*forked[] = { HELPER, "sim", "seen", "0.3", "fork", NULL };
+	struct result	 r;
+	long long	 mono, real, left;
+	const char	*p;
+	char		 what[16];
+	int		 i;
+
+	ck_assert_int_eq(run(&r, env, alone), 0);
+	ck_assert_int_eq(sscanf(r.out, "%lld %lld", &mono, &real), 2);
+	ck_assert_msg(mono >= 3600000 && real < 1000, "%s", r.out);
+
+	ck_assert_int_eq(run(&r, env, seen), 0);
+	ck_assert_int_eq(sscanf(r.out, "%lld %lld", &mono, &real), 2);
+	ck_assert_msg(mono >= 300 && real >= 290, "%s", r.out);
+
+	ck_assert_int_eq(run(&r, env, unseen), 0);
+	ck_assert_int_eq(sscanf(r.out, "%lld %lld", &mono, &real), 2);
+	ck_assert_msg(mono >= 300 && real >= 290, "%s", r.out);
+
+	/*
+	 * Wherever the signal lands, in a slice or in between, it ends the
+	 * sleep before anything was skipped.
+	 */
+	for (i = 0; i < 10; i++) {
+		ck_assert_int_eq(run(&r, env, signal), 0);
+		ck_assert_msg(sscanf(r.out, "%lld %lld %15s %lld", &mono, &real,
+		    what, &left) == 4, "%d: %s", i, r.out);
+		ck_assert_msg(strcmp(what, "EINTR") == 0 && mono < 5000 &&
+		    left > 5000 && left < 10000, "%d: %s", i, r.out);
+	}
+
+	/* The child has no busy thread. */
+	ck_assert_int_eq(run(&r, env, forked), 0);
+	ck_assert_ptr_ne(p = strstr(r.out, "child "), NULL);
+	ck_assert_int_eq(sscanf(p, "child %lld %lld", &mono, &real), 2);
+	ck_assert_msg(mono >= 300 && real < 250, "%s", r.out);
+	p = r.out[0] == 'c' ? strchr(r.out, '\n') + 1 : r.out;
+	ck_assert_int_eq(sscanf(p, "%lld %lld", &mono, &real), 2);
+	ck_assert_msg(mono >= 300 && real >= 290, "%s", r.out);
+}
+END_TEST
+
+Suite * preload_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("Preload");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_constructor);
+    tcase_add_test(tc_core, test_early_constructor);
+    tcase_add_test(tc_core, test_mode_libraries);
+    tcase_add_test(tc_core, test_retime);
+    tcase_add_test(tc_core, test_record_replay);
+    tcase_add_test(tc_core, test_record_fork);
+    tcase_add_test(tc_core, test_profile);
+    tcase_add_test(tc_core, test_state_export);
+    tcase_add_test(tc_core, test_seed);
+    tcase_add_test(tc_core, test_seed_race);
+    tcase_add_test(tc_core, test_sweep);
+    tcase_add_test(tc_core, test_raw_clocks);
+    tcase_add_test(tc_core, test_simulate);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    int number_failed;
+    Suite *s;
+    SRunner *sr;
+
+    s = preload_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -15,16 +15,28 @@
  */
 
 
+#include <sys/stat.h>
+
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <err.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <check.h>
 
+#include "../src/civil.h"
+#include "../src/dstcache.h"
+#include "../src/tzfile.h"
 #include "../src/unlucky_time.h"
+#include "../src/control.h"
+#include "../src/random.h"
+#include "../src/record.h"
+#include "../src/stats.h"
+#include "../src/timeline.h"
 #include "../src/utils.h"
 
 
@@ -69,6 +81,65 @@ START_TEST (test_unlucky_diff_last_of_month)
 }
 END_TEST
 
+/* Ten real seconds after the start are ten minutes with a dilation of 60. */
+START_TEST (test_unlucky_dilation)
+{
+	struct unlucky_state	state;
+	time_t			start_time = 1451724835;
+
+	memset(&state, 0, sizeof(state));
+	unlucky_set(&state, start_time, UNLUCKY_FIRST_OF_MONTH, 3600);
+	unlucky_dilate(&state, 60, 1);
+
+	ck_assert_int_eq(unlucky_diff(&state, start_time), 3600);
+	ck_assert_int_eq(start_time + 10 + unlucky_diff(&state, start_time + 10),
+	    start_time + 3600 + 600);
+
+	unlucky_dilate(&state, 1, 2);
+	ck_assert_int_eq(start_time + 10 + unlucky_diff(&state, start_time + 10),
+	    start_time + 3600 + 5);
+}
+END_TEST
+
+/* A timeline moves from segment to segment, and survives being exported. */
+START_TEST (test_timeline)
+{
+	struct unlucky_state	base;
+	time_t			start_time = 1451724835, leap;
+	char			buf[1024];
+
+	memset(&base, 0, sizeof(base));
+	unlucky_set(&base, start_time, UNLUCKY_FIRST_OF_MONTH, 3600);
+
+	ck_assert_int_eq(timeline_open("600:-3,600:+86400,60:leap_second",
+	    &base, start_time), 0);
+	ck_assert_int_eq(timeline_diff(start_time - 10), 3600);
+	ck_assert_int_eq(timeline_diff(start_time + 599), 3600);
+	ck_assert_int_eq(timeline_diff(start_time + 600), 3597);
+	ck_assert_int_eq(timeline_diff(start_time + 1200), 3597 + 86400);
+	ck_assert_int_eq(timeline_diff(start_time + 10), 3600);
+
+	/* Leap seconds start counting from the last step on. */
+	leap = start_time + 1260;
+	ck_assert_int_eq(timeline_diff(leap + 3600),
+	    3597 + 86400 + unlucky_leap_seconds(leap, leap + 3600));
+
+	ck_assert_int_eq(timeline_export(buf, sizeof(buf)), 0);
+	ck_assert_int_eq(timeline_open(buf, &base, start_time + 100000), 0);
+	ck_assert_int_eq(timeline_diff(start_time + 600), 3597);
+	ck_assert_int_eq(timeline_diff(leap + 3600),
+	    3597 + 86400 + unlucky_leap_seconds(leap, leap + 3600));
+
+	ck_assert_int_eq(timeline_open("600:tomorrow", &base, start_time), -1);
+	ck_assert_int_eq(timeline_open("soon:+1", &base, start_time), -1);
+	ck_assert_int_eq(timeline_diff(start_time + 100000), 3600);
+
+	ck_assert_int_eq(timeline_open("generate:4", &base, start_time), 0);
+	ck_assert_int_eq(timeline_export(buf, sizeof(buf)), 0);
+	ck_assert_ptr_ne(strchr(buf, ','), NULL);
+}
+END_TEST
+
 START_TEST (test_unlucky_diff_leap_seconds)
 {
 	struct unlucky_state	state;
@@ -92,6 +163,452 @@ START_TEST (test_unlucky_diff_leap_seconds)
 }
 END_TEST
 
+/*
+ * The batch functions should agree with unlucky_diff() in every mode, also
+ * for times long before or after the start time and with dilated time, and
+ * undo each other.
+ */
+START_TEST (test_unlucky_shift)
+{
+	struct unlucky_state	state;
+	struct timespec		ts[1000];
+	time_t			start_time, real[1000], t[1000];
+	enum unlucky_mode	mode;
+	size_t			i, d;
+	int64_t			dilation[][2] = { { 1, 1 }, { 60, 1 }, { 1, 3 } };
+
+	// 2016-1-2 9:53:55
+	start_time = 1451724835;
+
+	for (i = 0; i < 1000; i++)
+		real[i] = start_time - 500 + i * 7;
+	real[998] = start_time + 3000000000LL;
+	real[999] = start_time - 3000000000LL;
+
+	for (d = 0; d < 3; d++)
+	for (mode = UNLUCKY_FIRST_OF_MONTH; mode < UNLUCKY_RANDOM; mode++) {
+		memset(&state, 0, sizeof(state));
+		unlucky_set(&state, start_time, mode, 86400 * 3 + 17);
+		unlucky_dilate(&state, dilation[d][0], dilation[d][1]);
+
+		memcpy(t, real, sizeof(t));
+		for (i = 0; i < 1000; i++) {
+			ts[i].tv_sec = real[i];
+			ts[i].tv_nsec = i;
+		}
+		unlucky_shift(&state, t, 1000);
+		unlucky_shift_timespec(&state, ts, 1000);
+		for (i = 0; i < 1000; i++) {
+			ck_assert_int_eq(t[i], real[i] + unlucky_diff(&state, real[i]));
+			ck_assert_int_eq(ts[i].tv_sec, t[i]);
+			ck_assert_int_eq(ts[i].tv_nsec, i);
+		}
+
+		unlucky_unshift(&state, t, 1000);
+		unlucky_unshift_timespec(&state, ts, 1000);
+		for (i = 0; i < 1000; i++) {
+			ck_assert_int_eq(ts[i].tv_sec, t[i]);
+			ck_assert_int_eq(t[i] + unlucky_diff(&state, t[i]),
+			    real[i] + unlucky_diff(&state, real[i]));
+			ck_assert_int_le(t[i], real[i]);
+		}
+	}
+}
+END_TEST
+
+static int
+local_isdst(time_t t)
+{
+	struct tm tm;
+
+	if (localtime_r(&t, &tm) == NULL)
+		err(1, "localtime_r");
+
+	return tm.tm_isdst > 0;
+}
+
+/*
+ * Every change found in the zone file should be a second after which libc
+ * says the wall clock changed, and libc shouldn't see any other change
+ * between them, checked every six hours. How many there are is up to the
+ * tz database.
+ */
+#define DST_STEP	(6 * 60 * 60)
+
+static int
+dst_changes_match_libc(const char *tz, time_t start_time)
+{
+	time_t		table[100], end, t;
+	ssize_t		size, i;
+	int		isdst;
+
+	setenv("TZ", tz, 1);
+	tzset();
+
+	end = start_time + (60 * 60 * 24 * 365 * 20);
+	size = tzfile_dst_changes(start_time, end, table, 100);
+	if (size <= 0 || size >= 100)
+		return 0;
+
+	isdst = local_isdst(start_time);
+	for (t = start_time, i = 0; t < end; ) {
+		if (i < size && table[i] < t + DST_STEP) {
+			if (table[i] < t || local_isdst(table[i]) != isdst ||
+			    local_isdst(table[i] + 1) == isdst)
+				return 0;
+			isdst = !isdst;
+			t = table[i] + 1;
+			i++;
+		} else {
+			t += DST_STEP;
+			if (t < end && local_isdst(t) != isdst)
+				return 0;
+		}
+	}
+
+	return i == size;
+}
+
+START_TEST (test_tzfile_dst_changes)
+{
+	// 2016-1-2 9:53:55
+	time_t	start_time = 1451724835;
+
+	ck_assert(dst_changes_match_libc("Europe/Amsterdam", start_time));
+	ck_assert(dst_changes_match_libc("America/New_York", start_time));
+	ck_assert(dst_changes_match_libc("Australia/Sydney", start_time));
+	ck_assert(dst_changes_match_libc("CET-1CEST,M3.5.0,M10.5.0/3", start_time));
+
+	setenv("TZ", "UTC", 1);
+	tzset();
+	ck_assert_int_eq(tzfile_dst_changes(start_time, start_time + 1000000000, NULL, 0), 0);
+
+	unsetenv("TZ");
+	tzset();
+}
+END_TEST
+
+/* Dates from 1600 to 2400, a day and a bit apart, agree with libc. */
+START_TEST (test_civil)
+{
+	struct civil	c;
+	struct tm	tm;
+	time_t		t;
+
+	for (t = -11676096000; t < 13569465600; t += 86400 + 3607) {
+		if (gmtime_r(&t, &tm) == NULL)
+			err(1, "gmtime_r");
+		civil_split(t, &c);
+		ck_assert_int_eq(c.year, tm.tm_year + 1900);
+		ck_assert_int_eq(c.mon, tm.tm_mon + 1);
+		ck_assert_int_eq(c.mday, tm.tm_mday);
+		ck_assert_int_eq(c.yday, tm.tm_yday);
+		ck_assert_int_eq(c.hour, tm.tm_hour);
+		ck_assert_int_eq(c.min, tm.tm_min);
+		ck_assert_int_eq(c.sec, tm.tm_sec);
+		ck_assert_int_eq(civil_time(&c), t);
+		ck_assert_int_eq(civil_month_days(c.year, c.mon),
+		    days_in_month(tm.tm_mon, tm.tm_year));
+	}
+}
+END_TEST
+
+static int
+local_matches_libc(const char *tz, time_t start)
+{
+	struct tm	tm;
+	time_t		t;
+	long		utoff;
+	int		isdst;
+
+	setenv("TZ", tz, 1);
+	tzset();
+
+	for (t = start; t < 4000000000; t += 3 * 3600 + 7) {
+		if (localtime_r(&t, &tm) == NULL)
+			err(1, "localtime_r");
+		if ((isdst = tzfile_local(t, &utoff)) == -1)
+			return 0;
+		if (isdst != (tm.tm_isdst > 0) || utoff != tm.tm_gmtoff)
+			return 0;
+	}
+
+	return 1;
+}
+
+START_TEST (test_tzfile_local)
+{
+	/* From before the transitions in the zone files until after them. */
+	ck_assert(local_matches_libc("Europe/Amsterdam", -2000000000));
+	ck_assert(local_matches_libc("America/New_York", -2000000000));
+	ck_assert(local_matches_libc("Australia/Sydney", -2000000000));
+	ck_assert(local_matches_libc("UTC", -2000000000));
+
+	/* glibc doesn't apply a rule in TZ before 1970. */
+	ck_assert(local_matches_libc("CET-1CEST,M3.5.0,M10.5.0/3", 0));
+
+	unsetenv("TZ");
+	tzset();
+}
+END_TEST
+
+START_TEST (test_unlucky_diff_dst_change)
+{
+	struct unlucky_state	state;
+	time_t			start_time, new_time, before, after;
+	struct tm		before_tm, after_tm;
+
+	memset(&state, 0, sizeof(state));
+
+	setenv("TZ", "Europe/Amsterdam", 1);
+	tzset();
+
+	// 2016-1-2 9:53:55
+	start_time = 1451724835;
+
+	unlucky_init(&state, start_time, UNLUCKY_DST_CHANGE);
+	new_time = start_time + unlucky_diff(&state, start_time);
+
+	// The wall clock should change within an hour of the new time.
+	before = new_time - 60 * 60;
+	after = new_time + 60 * 60;
+	if (localtime_r(&before, &before_tm) == NULL)
+		err(1, "localtime_r");
+	if (localtime_r(&after, &after_tm) == NULL)
+		err(1, "localtime_r");
+
+	unsetenv("TZ");
+	tzset();
+
+	ck_assert_int_ne(before_tm.tm_isdst, after_tm.tm_isdst);
+}
+END_TEST
+
+/*
+ * The second process (here: call) needing the DST changes of the same zone
+ * and year should find them in the cache.
+ */
+START_TEST (test_dstcache)
+{
+	struct unlucky_state	state;
+	char			dir[] = "/tmp/check_unlucky.XXXXXX";
+	char			link[sizeof(dir) + 8];
+	uint64_t		hits, misses, hits_before, misses_before;
+	time_t			table[100];
+	const time_t		*cached;
+	size_t			size;
+	ssize_t			n;
+
+	ck_assert(mkdtemp(dir) != NULL);
+	setenv("UNLUCKY_CACHE_DIR", dir, 1);
+	setenv("TZ", "Europe/Amsterdam", 1);
+	tzset();
+
+	dstcache_stats(&hits_before, &misses_before);
+	ck_assert(dstcache_lookup(116, &size) == NULL);
+
+	memset(&state, 0, sizeof(state));
+	unlucky_init(&state, 1451724835, UNLUCKY_DST_CHANGE);
+
+	cached = dstcache_lookup(116, &size);
+	ck_assert(cached != NULL);
+
+	n = tzfile_dst_changes(1451606400, 1451606400 + 60 * 60 * 24 * 366 * 21, table, 100);
+	ck_assert_int_eq(size, n);
+	ck_assert(memcmp(cached, table, n * sizeof(time_t)) == 0);
+
+	dstcache_stats(&hits, &misses);
+	ck_assert_int_eq(hits - hits_before, 1);
+	ck_assert_int_eq(misses - misses_before, 2);
+
+	/* A directory others can get into, or a link to one, isn't used. */
+	ck_assert_int_eq(chmod(dir, 0755), 0);
+	ck_assert(dstcache_lookup(116, &size) == NULL);
+	ck_assert_int_eq(chmod(dir, 0700), 0);
+	ck_assert(dstcache_lookup(116, &size) != NULL);
+
+	snprintf(link, sizeof(link), "%s.link", dir);
+	ck_assert_int_eq(symlink(dir, link), 0);
+	setenv("UNLUCKY_CACHE_DIR", link, 1);
+	ck_assert(dstcache_lookup(116, &size) == NULL);
+	unlink(link);
+
+	unsetenv("UNLUCKY_CACHE_DIR");
+	unsetenv("TZ");
+	tzset();
+}
+END_TEST
+
+START_TEST (test_control)
+{
+	struct unlucky_control	*control, *other;
+	struct unlucky_state	 state;
+	char			 name[32];
+	int			 created;
+
+	snprintf(name, sizeof(name), "check-%d", (int)getpid());
+
+	control = control_open(name, 1, &created);
+	ck_assert(control != NULL);
+	ck_assert(created);
+	control_write(control, UNLUCKY_LEAP_SECOND, 1451724835, 3600);
+
+	other = control_open(name, 1, &created);
+	ck_assert(other != NULL);
+	ck_assert(!created);
+
+	memset(&state, 0, sizeof(state));
+	ck_assert_int_eq(control_read(other, &state), 0);
+	ck_assert_int_eq(state.mode, UNLUCKY_LEAP_SECOND);
+	ck_assert_int_eq(state.diff, 3600);
+	ck_assert_int_eq(unlucky_diff(&state, 1451724835 + 6), 3600 - 1);
+
+	control_write(control, UNLUCKY_FIRST_OF_MONTH, 1451724835, -60);
+	ck_assert_int_eq(control_read(other, &state), 0);
+	ck_assert_int_eq(unlucky_diff(&state, 1451724835 + 6), -60);
+	ck_assert_int_eq(control->seq % 2, 0);
+
+	/* An invalid mode is rejected, the previous state is kept. */
+	control_write(control, UNLUCKY_RANDOM, 1451724835, 3600);
+	ck_assert_int_eq(control_read(other, &state), -1);
+	control_write(control, (enum unlucky_mode)-1, 1451724835, 3600);
+	ck_assert_int_eq(control_read(other, &state), -1);
+	ck_assert_int_eq(state.mode, UNLUCKY_FIRST_OF_MONTH);
+	ck_assert_int_eq(state.diff, -60);
+
+	ck_assert_int_eq(control_unlink(name), 0);
+}
+END_TEST
+
+START_TEST (test_record_replay)
+{
+	struct unlucky_state	state, replayed;
+	struct timespec		raw, shifted, ts;
+	char			path[] = "/tmp/check_unlucky.XXXXXX";
+	int			fd, i;
+
+	fd = mkstemp(path);
+	ck_assert(fd != -1);
+	close(fd);
+
+	memset(&state, 0, sizeof(state));
+	unlucky_set(&state, 1451724835, UNLUCKY_LEAP_SECOND, 3600);
+	ck_assert_int_eq(record_open(path, &state), 0);
+
+	for (i = 0; i < 5000; i++) {
+		raw.tv_sec = 1451724835 + i;
+		raw.tv_nsec = i;
+		shifted = raw;
+		shifted.tv_sec += unlucky_diff(&state, raw.tv_sec);
+		record_add(i % 2 ? RECORD_TIME : RECORD_CLOCK_GETTIME,
+		    CLOCK_REALTIME, &raw, &shifted);
+	}
+	raw.tv_sec = 12;
+	record_add(RECORD_CLOCK_GETTIME, CLOCK_MONOTONIC, &raw, &raw);
+	record_flush();
+
+	memset(&replayed, 0, sizeof(replayed));
+	ck_assert_int_eq(replay_open(path, &replayed), 0);
+	ck_assert_int_eq(replayed.mode, UNLUCKY_LEAP_SECOND);
+	ck_assert_int_eq(replayed.start_time, 1451724835);
+	ck_assert_int_eq(replayed.diff, 3600);
+
+	for (i = 0; i < 5000; i++) {
+		ck_assert_int_eq(replay_next(i % 2 ? RECORD_TIME : RECORD_CLOCK_GETTIME,
+		    CLOCK_REALTIME, &ts), 0);
+		ck_assert_int_eq(ts.tv_sec, 1451724835 + i +
+		    unlucky_diff(&state, 1451724835 + i));
+		ck_assert_int_eq(ts.tv_nsec, i);
+	}
+
+	/* A read the recording doesn't have leaves the time alone. */
+	ts.tv_sec = 1;
+	ck_assert_int_eq(replay_next(RECORD_CLOCK_GETTIME, CLOCK_REALTIME, &ts), -1);
+	ck_assert_int_eq(ts.tv_sec, 1);
+	ck_assert_int_eq(replay_next(RECORD_CLOCK_GETTIME, CLOCK_MONOTONIC, &ts), 0);
+	ck_assert_int_eq(ts.tv_sec, 12);
+	ck_assert_int_eq(replay_next(RECORD_CLOCK_GETTIME, CLOCK_MONOTONIC, &ts), -1);
+
+	unlink(path);
+}
+END_TEST
+
+static void *
+count_calls(void *arg)
+{
+	int i;
+
+	for (i = 0; i < 1000; i++)
+		stats_add(STATS_TIME, 100);
+
+	return NULL;
+}
+
+START_TEST (test_stats)
+{
+	const struct stats_page	*page;
+	struct stats_counter	 sum[STATS_NFN];
+	pthread_t		 threads[4];
+	int			 i;
+
+	ck_assert_int_eq(stats_open("/dev/null"), 0);
+	page = stats_attach(getpid());
+	ck_assert(page != NULL);
+
+	stats_add(STATS_INIT, 1000);
+	stats_add(STATS_CLOCK_GETTIME, 0);
+	stats_add(STATS_CLOCK_GETTIME, 3);
+
+	for (i = 0; i < 4; i++)
+		ck_assert_int_eq(pthread_create(&threads[i], NULL, count_calls, NULL), 0);
+	for (i = 0; i < 4; i++)
+		pthread_join(threads[i], NULL);
+
+	stats_sum(page, sum);
+	ck_assert_int_eq(sum[STATS_INIT].calls, 1);
+	ck_assert_int_eq(sum[STATS_INIT].buckets[10], 1);	// < 1024
+	ck_assert_int_eq(sum[STATS_CLOCK_GETTIME].calls, 2);
+	ck_assert_int_eq(sum[STATS_CLOCK_GETTIME].buckets[0], 1);
+	ck_assert_int_eq(sum[STATS_CLOCK_GETTIME].buckets[2], 1);	// < 4
+	ck_assert_int_eq(sum[STATS_TIME].calls, 4000);
+	ck_assert_int_eq(sum[STATS_TIME].ns, 400000);
+	ck_assert_int_eq(sum[STATS_TIME].buckets[7], 4000);	// < 128
+	ck_assert_int_eq(sum[STATS_GETTIMEOFDAY].calls, 0);
+}
+END_TEST
+
+/*
+ * The same seed picks the same shift, and the numbers drawn stay below the
+ * bound.
+ */
+START_TEST (test_random_seed)
+{
+	struct unlucky_state	state1, state2;
+	time_t			start_time = 1451724835;
+	uint32_t		counts[3] = { 0, 0, 0 };
+	int			i;
+
+	memset(&state1, 0, sizeof(state1));
+	memset(&state2, 0, sizeof(state2));
+
+	random_seed(42);
+	ck_assert(random_seed_value() == 42);
+	unlucky_init(&state1, start_time, UNLUCKY_RANDOM);
+	random_seed(42);
+	unlucky_init(&state2, start_time, UNLUCKY_RANDOM);
+
+	ck_assert_int_eq(state1.mode, state2.mode);
+	ck_assert_int_eq(state1.diff, state2.diff);
+
+	for (i = 0; i < 3000; i++)
+		counts[random_uniform(3)]++;
+	for (i = 0; i < 3; i++)
+		ck_assert(counts[i] > 800 && counts[i] < 1200);
+
+	ck_assert_int_eq(random_uniform(1), 0);
+}
+END_TEST
+
 Suite * unlucky_suite(void)
 {
     Suite *s;
@@ -105,6 +622,18 @@ Suite * unlucky_suite(void)
     tcase_add_test(tc_core, test_unlucky_diff_first_of_month);
     tcase_add_test(tc_core, test_unlucky_diff_last_of_month);
     tcase_add_test(tc_core, test_unlucky_diff_leap_seconds);
+    tcase_add_test(tc_core, test_unlucky_dilation);
+    tcase_add_test(tc_core, test_timeline);
+    tcase_add_test(tc_core, test_unlucky_shift);
+    tcase_add_test(tc_core, test_tzfile_dst_changes);
+    tcase_add_test(tc_core, test_civil);
+    tcase_add_test(tc_core, test_tzfile_local);
+    tcase_add_test(tc_core, test_unlucky_diff_dst_change);
+    tcase_add_test(tc_core, test_dstcache);
+    tcase_add_test(tc_core, test_control);
+    tcase_add_test(tc_core, test_record_replay);
+    tcase_add_test(tc_core, test_stats);
+    tcase_add_test(tc_core, test_random_seed);
 
     suite_add_tcase(s, tc_core);
 
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Linked with --wrap=clock_gettime,--wrap=gettimeofday,--wrap=time against
+ * libunlucky-wrap.a, as a statically linked program would be.
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/override.h"
+
+START_TEST(test_wrapped)
+{
+	struct timespec	ts, ts_orig;
+	struct timeval	tv, tv_orig;
+	time_t		t, t_orig;
+
+	t = time(NULL);
+	t_orig = original_time(NULL);
+	ck_assert(t - t_orig - gettimediff(t_orig) <= 0);
+	ck_assert(t - t_orig - gettimediff(t_orig) >= -1);
+
+	ck_assert_int_eq(gettimeofday(&tv, NULL), 0);
+	ck_assert_int_eq(original_gettimeofday(&tv_orig, NULL), 0);
+	ck_assert(tv.tv_sec - tv_orig.tv_sec - gettimediff(tv_orig.tv_sec) <= 0);
+	ck_assert(tv.tv_sec - tv_orig.tv_sec - gettimediff(tv_orig.tv_sec) >= -1);
+
+	ck_assert_int_eq(clock_gettime(CLOCK_REALTIME, &ts), 0);
+	ck_assert_int_eq(original_clock_gettime(CLOCK_REALTIME, &ts_orig), 0);
+	ck_assert(ts.tv_sec - ts_orig.tv_sec - gettimediff(ts_orig.tv_sec) <= 0);
+	ck_assert(ts.tv_sec - ts_orig.tv_sec - gettimediff(ts_orig.tv_sec) >= -1);
+
+	/* The originals are libc's, not the wrappers. */
+	ck_assert_ptr_ne(original_clock_gettime, NULL);
+	ck_assert(original_time != time);
+}
+END_TEST
+
+Suite * wrap_suite(void)
+{
+    Suite *s;
+    TCase *tc_core;
+
+    s = suite_create("Wrap");
+
+    /* Core test case */
+    tc_core = tcase_create("Core");
+
+    tcase_add_test(tc_core, test_wrapped);
+
+    suite_add_tcase(s, tc_core);
+
+    return s;
+}
+
+int main(void)
+{
+    int number_failed;
+    Suite *s;
+    SRunner *sr;
+
+    s = wrap_suite();
+    sr = srunner_create(s);
+
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
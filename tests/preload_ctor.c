@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Preloaded by check_preload after the library, so its constructor runs
+ * before the library's and calls an override before anything was set up:
+ * the one CTOR_CALL names, then syscall(). Exits with 3 when one fails. It
+ * can also move the entries of the environment the process started with.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utime.h>
+
+static int
+_call(const char *name, const char *path, int fd)
+{
+#ifdef STATX_MTIME
+	struct statx	sx;
+#endif
+	struct stat	sb;
+
+	if (strcmp(name, "stat") == 0)
+		return stat(path, &sb);
+	if (strcmp(name, "fstat") == 0)
+		return fstat(fd, &sb);
+#ifdef STATX_MTIME
+	if (strcmp(name, "statx") == 0)
+		return statx(AT_FDCWD, path, 0, STATX_MTIME, &sx);
+#endif
+	if (strcmp(name, "utimensat") == 0)
+		return utimensat(AT_FDCWD, path, NULL, 0);
+	if (strcmp(name, "futimens") == 0)
+		return futimens(fd, NULL);
+	if (strcmp(name, "utimes") == 0)
+		return utimes(path, NULL);
+	if (strcmp(name, "utime") == 0)
+		return utime(path, NULL);
+	if (strcmp(name, "unsetenv") == 0)
+		return unsetenv("CTOR_CALL");
+
+	return 0;
+}
+
+__attribute__((constructor))
+static void
+_early(void)
+{
+	char		 path[] = "/tmp/unlucky-ctor.XXXXXX";
+	const char	*name;
+	int		 fd, r = 0;
+
+	if ((name = getenv("CTOR_CALL")) != NULL) {
+		if ((fd = mkstemp(path)) == -1)
+			_exit(3);
+		r = _call(name, path, fd);
+		close(fd);
+		unlink(path);
+	}
+
+	if (r == -1 || syscall(SYS_getpid) != getpid())
+		_exit(3);
+}
@@ -0,0 +1,525 @@
+/*
+ * Copyright (c) 2026 Alexander Schrijver <alex@flupzor.nl
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Run by check_preload with the library preloaded, without being linked
+ * against it. Every command does something the library should notice and
+ * prints what it saw on stdout.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/auxv.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <errno.h>
+#include <link.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/unlucky_time.h"
+
+/*
+ * Whether the state was initialized when main() started and after a clock
+ * read, and its mode.
+ */
+static int
+cmd_state(int argc, char **argv)
+{
+	const struct unlucky_state	*s;
+	const char			*(*mode_name)(enum unlucky_mode);
+	int				 before;
+
+	s = dlsym(RTLD_DEFAULT, "unlucky_process_state");
+	mode_name = (const char *(*)(enum unlucky_mode))dlsym(RTLD_DEFAULT,
+	    "unlucky_mode_name");
+	if (s == NULL || mode_name == NULL)
+		return 1;
+
+	before = __atomic_load_n(&s->initialized, __ATOMIC_ACQUIRE);
+	time(NULL);
+	printf("%d %d %s\n", before, s->initialized, mode_name(s->mode));
+
+	return 0;
+}
+
+/* The shifted date, as month-day. */
+static int
+cmd_date(int argc, char **argv)
+{
+	struct tm	tm;
+	time_t		t;
+	char		buf[32];
+
+	t = time(NULL);
+	if (localtime_r(&t, &tm) == NULL ||
+	    strftime(buf, sizeof(buf), "%m-%d", &tm) == 0)
+		return 1;
+	printf("%s\n", buf);
+
+	return 0;
+}
+
+static void *
+_reads(void *arg)
+{
+	const char	*p;
+	struct timespec	 ts;
+
+	for (p = arg; *p != '\0'; p++) {
+		switch (*p) {
+		case 'r':
+			clock_gettime(CLOCK_REALTIME, &ts);
+			break;
+		case 'm':
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			break;
+		default:
+			ts.tv_sec = time(NULL);
+			ts.tv_nsec = 0;
+			break;
+		}
+		printf("%c %lld.%09ld\n", *p, (long long)ts.tv_sec, ts.tv_nsec);
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the clocks in the order given by a string of r (CLOCK_REALTIME), m
+ * (CLOCK_MONOTONIC) and t (time()), and print what they said. With "thread"
+ * the reads are made in another thread. With "fork" they're made before a
+ * fork, by the child, which prints its process id first, and after it.
+ */
+static int
+cmd_reads(int argc, char **argv)
+{
+	pthread_t	thread;
+	pid_t		pid;
+	int		status;
+
+	if (argc < 2)
+		return 2;
+	if (argc == 2) {
+		_reads(argv[1]);
+		return 0;
+	}
+
+	if (strcmp(argv[2], "fork") == 0) {
+		_reads(argv[1]);
+		fflush(stdout);
+		if ((pid = fork()) == -1)
+			return 1;
+		if (pid == 0) {
+			printf("child %d\n", (int)getpid());
+			_reads(argv[1]);
+			exit(0);
+		}
+		if (waitpid(pid, &status, 0) == -1 || status != 0)
+			return 1;
+		_reads(argv[1]);
+		return 0;
+	}
+
+	if (pthread_create(&thread, NULL, _reads, argv[1]) != 0)
+		return 1;
+	pthread_join(thread, NULL);
+
+	return 0;
+}
+
+extern char	**environ;
+
+/* UNLUCKY_STATE, as this process has it. */
+static int
+cmd_env(int argc, char **argv)
+{
+	const char *s;
+
+	s = getenv("UNLUCKY_STATE");
+	printf("%s\n", s ? s : "none");
+
+	return 0;
+}
+
+/*
+ * The state and seed, UNLUCKY_STATE before and after starting a child with fork,
+ * spawn, system or popen, and the UNLUCKY_STATE of the child.
+ */
+static int
+cmd_child(int argc, char **argv)
+{
+	const struct unlucky_state	*s;
+	const char			*(*mode_name)(enum unlucky_mode);
+	uint64_t			(*seed)(void);
+	char				 self[PATH_MAX], command[PATH_MAX + 8];
+	char				 buf[256];
+	char				*child[] = { self, "env", NULL };
+	FILE				*f;
+	pid_t				 pid;
+	ssize_t				 n;
+	int				 status;
+
+	s = dlsym(RTLD_DEFAULT, "unlucky_process_state");
+	mode_name = (const char *(*)(enum unlucky_mode))dlsym(RTLD_DEFAULT,
+	    "unlucky_mode_name");
+	seed = (uint64_t (*)(void))dlsym(RTLD_DEFAULT, "random_seed_value");
+	if (argc < 2 || s == NULL || mode_name == NULL || seed == NULL)
+		return 2;
+	if ((n = readlink("/proc/self/exe", self, sizeof(self) - 1)) == -1)
+		return 1;
+	self[n] = '\0';
+	snprintf(command, sizeof(command), "%s env", self);
+
+	time(NULL);
+	printf("%s:%lld:%lld:%llu\n", mode_name(s->mode),
+	    (long long)s->start_time, (long long)s->diff,
+	    (unsigned long long)seed());
+	cmd_env(0, NULL);
+	fflush(stdout);
+
+	if (strcmp(argv[1], "fork") == 0) {
+		if ((pid = fork()) == -1)
+			return 1;
+		if (pid == 0) {
+			execv(child[0], child);
+			_exit(127);
+		}
+	} else if (strcmp(argv[1], "spawn") == 0) {
+		if (posix_spawn(&pid, child[0], NULL, NULL, child, environ) != 0)
+			return 1;
+	} else if (strcmp(argv[1], "popen") == 0) {
+		if ((f = popen(command, "r")) == NULL)
+			return 1;
+		while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+			fwrite(buf, 1, n, stdout);
+		return pclose(f) == 0 ? cmd_env(0, NULL) : 1;
+	} else {
+		return system(command) == 0 ? cmd_env(0, NULL) : 1;
+	}
+
+	if (waitpid(pid, &status, 0) == -1 || status != 0)
+		return 1;
+	fflush(stdout);
+
+	return cmd_env(0, NULL);
+}
+
+/* Exported, with -rdynamic, so the profile can name it. */
+__attribute__((noinline)) void
+profiled_caller(int n)
+{
+	struct timespec	ts;
+	int		i;
+
+	for (i = 0; i < n; i++)
+		clock_gettime(CLOCK_REALTIME, &ts);
+}
+
+/* Read the clock 100 times from profiled_caller(). */
+static int
+cmd_profile(int argc, char **argv)
+{
+	profiled_caller(100);
+
+	return 0;
+}
+
+static int	 busy_stop;
+
+static void *
+_busy(void *arg)
+{
+	while (!__atomic_load_n(&busy_stop, __ATOMIC_RELAXED))
+		;
+
+	return NULL;
+}
+
+static void
+_alarm(int sig)
+{
+}
+
+/* Milliseconds on the real monotonic clock, which the library can't see. */
+static long long
+_real_ms(void)
+{
+	struct timespec ts;
+
+	syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static long long
+_ms(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000LL + ts->tv_nsec / 1000000;
+}
+
+/*
+ * Sleep for a number of seconds, while another thread is busy, and print how
+ * long that took on the monotonic clock and in reality, in milliseconds. The
+ * busy thread is created with pthread_create() ("seen"), libc's ("unseen")
+ * or not at all ("none"). With "signal" SIGALRM interrupts the sleep after
+ * 100 ms, which prints what was left of it, with "fork" a child sleeps as
+ * well and prints the same.
+ */
+static int
+cmd_sim(int argc, char **argv)
+{
+	int		(*create)(pthread_t *, const pthread_attr_t *,
+			    void *(*)(void *), void *) = pthread_create;
+	struct itimerval it = { { 0, 0 }, { 0, 100000 } };
+	struct sigaction sa;
+	struct timespec	 request, remain, begin, end;
+	sigset_t	 set, old;
+	pthread_t	 thread;
+	double		 seconds;
+	long long	 real;
+	const char	*then = argc > 3 ? argv[3] : "";
+	pid_t		 pid = -1;
+	void		*libc;
+	int		 r, status;
+
+	if (argc < 3)
+		return 2;
+	seconds = atof(argv[2]);
+	request.tv_sec = seconds;
+	request.tv_nsec = (seconds - request.tv_sec) * 1e9;
+
+	if (strcmp(argv[1], "unseen") == 0) {
+		if ((libc = dlopen("libc.so.6", RTLD_NOLOAD | RTLD_NOW)) == NULL ||
+		    (create = (int (*)(pthread_t *, const pthread_attr_t *,
+		    void *(*)(void *), void *))dlsym(libc, "pthread_create")) == NULL)
+			return 1;
+	}
+
+	/* The alarm is for this thread. */
+	sigemptyset(&set);
+	sigaddset(&set, SIGALRM);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	if (strcmp(argv[1], "none") != 0 && create(&thread, NULL, _busy, NULL) != 0)
+		return 1;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (strcmp(then, "signal") == 0) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = _alarm;
+		sigaction(SIGALRM, &sa, NULL);
+		setitimer(ITIMER_REAL, &it, NULL);
+	} else if (strcmp(then, "fork") == 0) {
+		fflush(stdout);
+		if ((pid = fork()) == -1)
+			return 1;
+	}
+
+	real = _real_ms();
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	r = nanosleep(&request, &remain);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	real = _real_ms() - real;
+
+	printf("%s%lld %lld", pid == 0 ? "child " : "", _ms(&end) - _ms(&begin),
+	    real);
+	if (r == -1)
+		printf(" %s %lld", errno == EINTR ? "EINTR" : "error", _ms(&remain));
+	printf("\n");
+	fflush(stdout);
+	if (pid == 0)
+		_exit(0);
+
+	if (strcmp(argv[1], "none") != 0) {
+		__atomic_store_n(&busy_stop, 1, __ATOMIC_RELAXED);
+		pthread_join(thread, NULL);
+	}
+	if (pid > 0 && (waitpid(pid, &status, 0) == -1 || status != 0))
+		return 1;
+
+	return 0;
+}
+
+#define SEED_THREADS	8
+
+static int	  seed_go;
+static uint64_t	(*seed_value)(void);
+
+static void *
+_seed(void *arg)
+{
+	while (!__atomic_load_n(&seed_go, __ATOMIC_ACQUIRE))
+		;
+	*(uint64_t *)arg = seed_value();
+
+	return NULL;
+}
+
+/*
+ * The seed as every one of a few threads which race to pick it sees it, and
+ * as it is afterwards, one per line. The threads are libc's, as the library
+ * sets up its state, and with it the seed, when pthread_create() is called.
+ */
+static int
+cmd_seeds(int argc, char **argv)
+{
+	int		(*create)(pthread_t *, const pthread_attr_t *,
+			    void *(*)(void *), void *);
+	pthread_t	thread[SEED_THREADS];
+	uint64_t	seed[SEED_THREADS];
+	void		*libc;
+	int		i;
+
+	seed_value = (uint64_t (*)(void))dlsym(RTLD_DEFAULT, "random_seed_value");
+	if (seed_value == NULL ||
+	    (libc = dlopen("libc.so.6", RTLD_NOLOAD | RTLD_NOW)) == NULL ||
+	    (create = (int (*)(pthread_t *, const pthread_attr_t *,
+	    void *(*)(void *), void *))dlsym(libc, "pthread_create")) == NULL)
+		return 1;
+
+	for (i = 0; i < SEED_THREADS; i++)
+		if (create(&thread[i], NULL, _seed, &seed[i]) != 0)
+			return 1;
+	__atomic_store_n(&seed_go, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < SEED_THREADS; i++) {
+		pthread_join(thread[i], NULL);
+		printf("%llu\n", (unsigned long long)seed[i]);
+	}
+	printf("%llu\n", (unsigned long long)seed_value());
+
+	return 0;
+}
+
+/* Look up a function in the vDSO image AT_SYSINFO_EHDR points at. */
+static void *
+_vdso_sym(const char *want)
+{
+	const ElfW(Ehdr)	*eh;
+	const ElfW(Phdr)	*ph;
+	const ElfW(Shdr)	*sh;
+	const ElfW(Sym)		*sym;
+	const char		*str;
+	uintptr_t		 base, bias;
+	size_t			 i, n;
+
+	if ((base = getauxval(AT_SYSINFO_EHDR)) == 0)
+		return NULL;
+	eh = (const ElfW(Ehdr) *)base;
+	ph = (const ElfW(Phdr) *)(base + eh->e_phoff);
+	bias = base;
+	for (i = 0; i < eh->e_phnum; i++) {
+		if (ph[i].p_type == PT_LOAD) {
+			bias = base + ph[i].p_offset - ph[i].p_vaddr;
+			break;
+		}
+	}
+
+	sh = (const ElfW(Shdr) *)(base + eh->e_shoff);
+	for (i = 0; i < eh->e_shnum; i++) {
+		if (sh[i].sh_type != SHT_DYNSYM)
+			continue;
+		str = (const char *)(base + sh[sh[i].sh_link].sh_offset);
+		sym = (const ElfW(Sym) *)(base + sh[i].sh_offset);
+		for (n = sh[i].sh_size / sizeof(*sym); n > 0; n--, sym++)
+			if (sym->st_shndx != SHN_UNDEF &&
+			    strcmp(str + sym->st_name, want) == 0)
+				return (void *)(bias + sym->st_value);
+	}
+
+	return NULL;
+}
+
+/*
+ * The wall clock in seconds as time(), a raw syscall() and the vDSO's
+ * clock_gettime() tell it, the latter as found through the auxiliary vector.
+ */
+static int
+cmd_raw(int argc, char **argv)
+{
+	int		(*vdso_gettime)(clockid_t, struct timespec *);
+	struct timespec	 sc, vd;
+
+	if ((vdso_gettime = _vdso_sym("__vdso_clock_gettime")) == NULL &&
+	    (vdso_gettime = _vdso_sym("__kernel_clock_gettime")) == NULL)
+		return 1;
+	if (syscall(SYS_clock_gettime, CLOCK_REALTIME, &sc) == -1 ||
+	    vdso_gettime(CLOCK_REALTIME, &vd) == -1)
+		return 1;
+	printf("%lld %lld %lld\n", (long long)time(NULL), (long long)sc.tv_sec,
+	    (long long)vd.tv_sec);
+
+	return 0;
+}
+
+/*
+ * Load the library given after setenv(3) moved the environment, and print
+ * what raw does. Loaded like that the overrides aren't used, but it
+ * shouldn't crash.
+ */
+static int
+cmd_dlopen(int argc, char **argv)
+{
+	if (argc < 2)
+		return 2;
+	setenv("UNLUCKY_HELPER", "1", 1);
+	if (dlopen(argv[1], RTLD_NOW) == NULL)
+		return 1;
+
+	return cmd_raw(0, NULL);
+}
+
+static const struct {
+	const char	*name;
+	int		(*fn)(int, char **);
+} commands[] = {
+	{ "state", cmd_state },
+	{ "date", cmd_date },
+	{ "reads", cmd_reads },
+	{ "profile", cmd_profile },
+	{ "env", cmd_env },
+	{ "child", cmd_child },
+	{ "sim", cmd_sim },
+	{ "raw", cmd_raw },
+	{ "seeds", cmd_seeds },
+	{ "dlopen", cmd_dlopen },
+};
+
+int
+main(int argc, char **argv)
+{
+	size_t i;
+
+	if (argc < 2)
+		return 2;
+
+	for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+		if (strcmp(argv[1], commands[i].name) == 0)
+			return commands[i].fn(argc - 1, argv + 1);
+
+	fprintf(stderr, "preload_helper: unknown command %s\n", argv[1]);
+	return 2;
+}